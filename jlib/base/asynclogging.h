@@ -0,0 +1,255 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "countdownlatch.h"
+#include "logstream.h"
+#include "logfile.h"
+#include "timestamp.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief Double-buffered asynchronous log backend
+* front-end threads append into pre-allocated FixedBuffer<LARGE_BUFFER>,
+* a background thread swaps full buffers out and writes them through LogFile.
+* usage:
+*   AsyncLogging* g_async = ...;
+*   Logger::setOutput([](const char* msg, int len) { g_async->append(msg, len); });
+*/
+class AsyncLogging : noncopyable
+{
+public:
+	typedef detail::FixedBuffer<detail::LARGE_BUFFER> Buffer;
+	typedef std::unique_ptr<Buffer> BufferPtr;
+	typedef std::vector<BufferPtr> BufferVector;
+
+	//! at least 2 front-end buffers and 2 spare buffers for the back-end
+	static constexpr size_t MIN_BUFFERS = 4;
+
+	/**
+	* @param basename log file basename, see LogFile
+	* @param rollSize roll log file when exceeds rollSize bytes
+	* @param flushInterval back-end writes and flushes at least every flushInterval seconds
+	* @param maxBuffers upper bound of buffers in the pool (4MB each), lines are dropped when exhausted
+	*/
+	AsyncLogging(const std::string& basename, off_t rollSize, int flushInterval = 3, size_t maxBuffers = 16)
+		: flushInterval_(flushInterval)
+		, maxBuffers_(maxBuffers < MIN_BUFFERS ? MIN_BUFFERS : maxBuffers)
+		, running_(false)
+		, basename_(basename)
+		, rollSize_(rollSize)
+		, latch_(1)
+		, mutex_()
+		, cond_()
+		, currentBuffer_()
+		, nextBuffer_()
+		, buffers_()
+		, emptyBuffers_()
+		, allocatedBuffers_(0)
+		, droppedBytes_(0)
+	{
+		currentBuffer_ = newBuffer();
+		nextBuffer_ = newBuffer();
+		buffers_.reserve(maxBuffers_);
+		emptyBuffers_.reserve(maxBuffers_);
+		// spare buffers for the back-end thread
+		emptyBuffers_.push_back(newBuffer());
+		emptyBuffers_.push_back(newBuffer());
+	}
+
+	~AsyncLogging() {
+		if (running_) {
+			stop();
+		}
+	}
+
+	//! called by front-end threads, usually via Logger::setOutput
+	void append(const char* logline, int len) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (currentBuffer_->avail() > len) {
+			currentBuffer_->append(logline, len);
+			return;
+		}
+
+		buffers_.push_back(std::move(currentBuffer_));
+		if (nextBuffer_) {
+			currentBuffer_ = std::move(nextBuffer_);
+		} else if (!emptyBuffers_.empty() || allocatedBuffers_ < maxBuffers_) {
+			currentBuffer_ = takeEmptyBuffer(); // rarely happens
+		} else {
+			// pool exhausted, back-end cannot keep up.
+			// reuse the oldest queued buffer and count its content as dropped
+			droppedBytes_ += buffers_.front()->length();
+			currentBuffer_ = std::move(buffers_.front());
+			buffers_.erase(buffers_.begin());
+			currentBuffer_->reset();
+		}
+		currentBuffer_->append(logline, len);
+		cond_.notify_one();
+	}
+
+	void start() {
+		assert(!running_);
+		running_ = true;
+		thread_ = std::thread(&AsyncLogging::threadFunc, this);
+		latch_.wait();
+	}
+
+	void stop() {
+		running_ = false;
+		cond_.notify_one();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	//! bytes discarded because the buffer pool was exhausted
+	size_t droppedBytes() const { return droppedBytes_; }
+
+	//! buffers allocated so far, never exceeds maxBuffers
+	size_t allocatedBuffers() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return allocatedBuffers_;
+	}
+
+private:
+	//! must be called with mutex_ locked (or from constructor)
+	BufferPtr newBuffer() {
+		++allocatedBuffers_;
+		auto buf = std::make_unique<Buffer>();
+		buf->bzero();
+		return buf;
+	}
+
+	//! must be called with mutex_ locked
+	BufferPtr takeEmptyBuffer() {
+		if (emptyBuffers_.empty()) {
+			return newBuffer();
+		}
+		BufferPtr buf = std::move(emptyBuffers_.back());
+		emptyBuffers_.pop_back();
+		return buf;
+	}
+
+	//! must be called with mutex_ locked
+	void recycle(BufferVector& buffersToWrite, BufferPtr& newBuffer1, BufferPtr& newBuffer2) {
+		if (!newBuffer1) {
+			assert(!buffersToWrite.empty());
+			newBuffer1 = std::move(buffersToWrite.back());
+			buffersToWrite.pop_back();
+			newBuffer1->reset();
+		}
+
+		if (!newBuffer2 && !buffersToWrite.empty()) {
+			newBuffer2 = std::move(buffersToWrite.back());
+			buffersToWrite.pop_back();
+			newBuffer2->reset();
+		}
+
+		for (auto& buf : buffersToWrite) {
+			buf->reset();
+			emptyBuffers_.push_back(std::move(buf));
+		}
+		buffersToWrite.clear();
+	}
+
+	void threadFunc() {
+		assert(running_);
+		latch_.countDown();
+		LogFile output(basename_, rollSize_, false);
+		BufferPtr newBuffer1, newBuffer2;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			newBuffer1 = takeEmptyBuffer();
+			newBuffer2 = takeEmptyBuffer();
+		}
+		BufferVector buffersToWrite;
+		buffersToWrite.reserve(maxBuffers_);
+
+		while (running_) {
+			assert(newBuffer1 && newBuffer1->length() == 0);
+			assert(newBuffer2 && newBuffer2->length() == 0);
+			assert(buffersToWrite.empty());
+
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (buffers_.empty()) { // unusual usage!
+					cond_.wait_for(lock, std::chrono::seconds(flushInterval_));
+				}
+				buffers_.push_back(std::move(currentBuffer_));
+				currentBuffer_ = std::move(newBuffer1);
+				buffersToWrite.swap(buffers_);
+				if (!nextBuffer_) {
+					nextBuffer_ = std::move(newBuffer2);
+				}
+			}
+
+			assert(!buffersToWrite.empty());
+
+			if (droppedBytes_ > reportedDroppedBytes_) {
+				char buf[256];
+				int len = snprintf(buf, sizeof(buf), "Dropped %zu bytes of log messages at %s, %zu buffers queued\n",
+								   droppedBytes_ - reportedDroppedBytes_, format("%F %T", nowTimestamp()).c_str(), buffersToWrite.size());
+				fputs(buf, stderr);
+				output.append(buf, len);
+				reportedDroppedBytes_ = droppedBytes_;
+			}
+
+			for (const auto& buffer : buffersToWrite) {
+				output.append(buffer->data(), buffer->length());
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				recycle(buffersToWrite, newBuffer1, newBuffer2);
+			}
+
+			output.flush();
+		}
+
+		// drain whatever front-ends appended after the last swap
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (currentBuffer_ && currentBuffer_->length() > 0) {
+				buffers_.push_back(std::move(currentBuffer_));
+				currentBuffer_ = std::move(newBuffer1);
+			}
+			buffersToWrite.swap(buffers_);
+		}
+		for (const auto& buffer : buffersToWrite) {
+			output.append(buffer->data(), buffer->length());
+		}
+		output.flush();
+	}
+
+	const int flushInterval_;
+	const size_t maxBuffers_;
+	std::atomic<bool> running_;
+	const std::string basename_;
+	const off_t rollSize_;
+	std::thread thread_;
+	CountDownLatch latch_;
+	mutable std::mutex mutex_;
+	std::condition_variable cond_;
+	BufferPtr currentBuffer_;
+	BufferPtr nextBuffer_;
+	BufferVector buffers_;
+	BufferVector emptyBuffers_;
+	size_t allocatedBuffers_;
+	std::atomic<size_t> droppedBytes_;
+	size_t reportedDroppedBytes_ = 0;
+};
+
+} // namespace jlib
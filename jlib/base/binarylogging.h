@@ -0,0 +1,779 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "logging.h"
+#include "fileutil.h"
+#include "stringpiece.h"
+#include "timestamp.h"
+#include "currentthread.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <type_traits>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <algorithm>
+
+/*
+ Deferred formatting binary log, NanoLog style.
+
+ The call site only copies a static site id, a timestamp and the raw arguments
+ into a per-thread ring buffer, BinaryLogging's thread moves them to a binary file,
+ text is rendered later by BinaryLogDecoder.
+
+ usage:
+   BinaryLogging blog("app.blog");
+   blog.start();
+   BLOG_INFO("conn %d from %s took %.3f ms", fd, peer, ms);
+
+ File format, version 1, little endian, no padding:
+
+   A file holds one or more sessions, one per BinaryLogging::start(),
+   each begins with the file header, site ids are only valid within their session.
+
+   file header, 16 bytes:
+     char[8]  magic "JLIBBLOG"
+     uint32   version, 1
+     uint32   0x01020304, to detect the byte order of the writer
+
+   then a sequence of entries, each starts with a uint8 type:
+
+   BINLOG_ENTRY_SITE = 1, describes a call site, always precedes its first record in the file
+     uint8    type
+     uint32   site id, > 0, unique within the file
+     uint8    level, Logger::LogLevel
+     uint32   line
+     uint16   file name length, then the basename of the source file
+     uint16   format length, then the printf style format
+     uint8    argument count, then one type char per argument:
+              'i' int64, 'u' uint64, 'd' double, 'p' pointer as uint64, 's' uint32 length + bytes
+
+   BINLOG_ENTRY_RECORD = 2, one log statement
+     uint8    type
+     uint32   size of the whole entry in bytes, including type and size
+     uint32   site id
+     int64    microseconds since epoch, UTC
+     uint32   thread id
+     arguments, encoded as described by the site
+
+ Decoders must reject unknown versions, and may skip records of unknown sites using the size.
+*/
+
+namespace jlib
+{
+
+static constexpr char BINLOG_MAGIC[8] = { 'J', 'L', 'I', 'B', 'B', 'L', 'O', 'G' };
+static constexpr uint32_t BINLOG_VERSION = 1;
+static constexpr uint32_t BINLOG_BYTE_ORDER = 0x01020304;
+static constexpr size_t BINLOG_FILE_HEADER_SIZE = 16;
+
+enum BinaryLogEntryType : uint8_t {
+	BINLOG_ENTRY_PAD = 0, // only in staging buffers, skip to the end of the ring
+	BINLOG_ENTRY_SITE = 1,
+	BINLOG_ENTRY_RECORD = 2,
+};
+
+//! type, size, site id, timestamp, tid
+static constexpr size_t BINLOG_RECORD_HEADER_SIZE = 1 + 4 + 4 + 8 + 4;
+
+//! longer string arguments are truncated
+static constexpr uint32_t BINLOG_MAX_STRING_ARG = 16 * 1024;
+
+
+//! static description of a call site, constant initialized by the BLOG_* macros
+struct BinaryLogSite : noncopyable
+{
+	constexpr BinaryLogSite(Logger::LogLevel level, const char* file, int line, const char* fmt)
+		: level_(level), file_(file), line_(line), fmt_(fmt), id_(0)
+	{}
+
+	const Logger::LogLevel level_;
+	const char* const file_;
+	const int line_;
+	const char* const fmt_;
+	//! assigned on first use, 0 before that
+	std::atomic<uint32_t> id_;
+};
+
+
+namespace detail
+{
+
+template <typename T>
+inline void binlogPut(char*& p, T v) {
+	memcpy(p, &v, sizeof(v));
+	p += sizeof(v);
+}
+
+template <typename T>
+inline T binlogGet(const char*& p) {
+	T v;
+	memcpy(&v, p, sizeof(v));
+	p += sizeof(v);
+	return v;
+}
+
+/******** argument encoding *********/
+
+template <typename T, typename Enable = void>
+struct BinlogArg;
+
+template <typename T>
+struct BinlogArg<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+{
+	static constexpr char TYPE = (std::is_unsigned<T>::value || std::is_same<T, bool>::value) ? 'u' : 'i';
+	static size_t size(T) { return 8; }
+	static void put(char*& p, T v) {
+		if (TYPE == 'u') { binlogPut(p, static_cast<uint64_t>(v)); }
+		else { binlogPut(p, static_cast<int64_t>(v)); }
+	}
+};
+
+template <typename T>
+struct BinlogArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+	static constexpr char TYPE = 'd';
+	static size_t size(T) { return 8; }
+	static void put(char*& p, T v) { binlogPut(p, static_cast<double>(v)); }
+};
+
+template <typename T>
+struct BinlogArg<T*, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+	static constexpr char TYPE = 'p';
+	static size_t size(const T*) { return 8; }
+	static void put(char*& p, const T* v) { binlogPut(p, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v))); }
+};
+
+struct BinlogStringArg
+{
+	static constexpr char TYPE = 's';
+	static uint32_t length(size_t len) { return static_cast<uint32_t>(len < BINLOG_MAX_STRING_ARG ? len : BINLOG_MAX_STRING_ARG); }
+	static void put(char*& p, const char* str, size_t len) {
+		uint32_t n = length(len);
+		binlogPut(p, n);
+		memcpy(p, str, n);
+		p += n;
+	}
+};
+
+template <>
+struct BinlogArg<const char*> : BinlogStringArg
+{
+	static size_t size(const char* s) { return 4 + length(s ? strlen(s) : 6); }
+	static void put(char*& p, const char* s) { s ? BinlogStringArg::put(p, s, strlen(s)) : BinlogStringArg::put(p, "(null)", 6); }
+};
+
+template <>
+struct BinlogArg<char*> : BinlogArg<const char*> {};
+
+template <>
+struct BinlogArg<std::string> : BinlogStringArg
+{
+	static size_t size(const std::string& s) { return 4 + length(s.size()); }
+	static void put(char*& p, const std::string& s) { BinlogStringArg::put(p, s.data(), s.size()); }
+};
+
+template <>
+struct BinlogArg<StringPiece> : BinlogStringArg
+{
+	static size_t size(const StringPiece& s) { return 4 + length(s.size()); }
+	static void put(char*& p, const StringPiece& s) { BinlogStringArg::put(p, s.data(), s.size()); }
+};
+
+//! char arrays (string literals) decay to const char*
+template <typename T>
+using BinlogArgOf = BinlogArg<typename std::decay<T>::type>;
+
+//! "id" for (int, double), evaluated at compile time
+template <typename... Args>
+inline const char* binlogSignature() {
+	static constexpr char sig[] = { BinlogArgOf<Args>::TYPE..., '\0' };
+	return sig;
+}
+
+inline size_t binlogArgsSize() { return 0; }
+
+template <typename T, typename... Args>
+inline size_t binlogArgsSize(const T& v, const Args&... args) {
+	return BinlogArgOf<T>::size(v) + binlogArgsSize(args...);
+}
+
+inline void binlogPutArgs(char*&) {}
+
+template <typename T, typename... Args>
+inline void binlogPutArgs(char*& p, const T& v, const Args&... args) {
+	BinlogArgOf<T>::put(p, v);
+	binlogPutArgs(p, args...);
+}
+
+
+/******** per-thread staging buffer *********/
+
+/**
+* @brief single producer single consumer byte ring
+* records are contiguous, a BINLOG_ENTRY_PAD byte tells the consumer to wrap
+*/
+class BinaryLogBuffer : noncopyable
+{
+public:
+	static constexpr size_t SIZE = 1024 * 1024;
+	static constexpr size_t MASK = SIZE - 1;
+	//! larger records are dropped
+	static constexpr size_t MAX_RECORD = SIZE / 4;
+
+	BinaryLogBuffer() : tid_(static_cast<uint32_t>(CurrentThread::tid())), retired_(false), dropped_(0),
+		head_(0), writePos_(0), cachedFree_(SIZE), tail_(0) {}
+
+	//! producer, nullptr if there is no room, the record is dropped
+	char* reserve(size_t n) {
+		size_t idx = writePos_ & MASK;
+		size_t need = idx + n > SIZE ? n + (SIZE - idx) : n;
+		if (need > cachedFree_ || n > MAX_RECORD) {
+			cachedFree_ = SIZE - (writePos_ - tail_.load(std::memory_order_acquire));
+			if (need > cachedFree_ || n > MAX_RECORD) {
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+		if (idx + n > SIZE) {
+			data_[idx] = static_cast<char>(BINLOG_ENTRY_PAD);
+			writePos_ += SIZE - idx;
+			cachedFree_ -= SIZE - idx;
+			idx = 0;
+		}
+		return data_ + idx;
+	}
+
+	//! producer, publish the record written after reserve(n)
+	void commit(size_t n) {
+		writePos_ += n;
+		cachedFree_ -= n;
+		head_.store(writePos_, std::memory_order_release);
+	}
+
+	//! consumer, calls f(const char* record, size_t size) for each record, returns bytes consumed
+	template <typename F>
+	size_t drain(F&& f) {
+		const size_t head = head_.load(std::memory_order_acquire);
+		const size_t begin = tail_.load(std::memory_order_relaxed);
+		size_t tail = begin;
+		while (tail != head) {
+			size_t idx = tail & MASK;
+			const char* p = data_ + idx;
+			if (static_cast<uint8_t>(*p) == BINLOG_ENTRY_PAD) {
+				tail += SIZE - idx;
+				continue;
+			}
+			uint32_t size;
+			memcpy(&size, p + 1, sizeof(size));
+			f(p, size);
+			tail += size;
+		}
+		tail_.store(tail, std::memory_order_release);
+		return tail - begin;
+	}
+
+	bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed); }
+
+	const uint32_t tid_;
+	//! set when the owner thread exits, the consumer frees the buffer once drained
+	std::atomic<bool> retired_;
+	std::atomic<size_t> dropped_;
+
+private:
+	// producer side
+	alignas(64) std::atomic<size_t> head_;
+	size_t writePos_;
+	size_t cachedFree_;
+	// consumer side
+	alignas(64) std::atomic<size_t> tail_;
+	alignas(64) char data_[SIZE];
+};
+
+} // namespace detail
+
+
+/**
+* @brief back-end of the BLOG_* macros, drains per-thread buffers into a binary file
+* only one instance can be started at a time, see the format description above.
+*/
+class BinaryLogging : noncopyable
+{
+public:
+	/**
+	* @param filename binary log file, appended if exists
+	* @param flushInterval flush the file at least every flushInterval seconds
+	*/
+	explicit BinaryLogging(const std::string& filename, int flushInterval = 3)
+		: filename_(filename)
+		, flushInterval_(flushInterval)
+		, running_(false)
+	{}
+
+	~BinaryLogging() {
+		if (running_) {
+			stop();
+		}
+	}
+
+	void start() {
+		assert(!running_);
+		BinaryLogging* expected = nullptr;
+		bool ok = current().compare_exchange_strong(expected, this);
+		assert(ok && "only one BinaryLogging can be started"); (void)ok;
+		running_ = true;
+		thread_ = std::thread(&BinaryLogging::threadFunc, this);
+	}
+
+	/**
+	* @brief records logged before stop() is called are written
+	* BLOG_* stops taking records first, then the thread drains once more. only a record
+	* already past that check when stop() is called can miss the final drain.
+	*/
+	void stop() {
+		current() = nullptr;
+		running_ = false;
+		cond_.notify_one();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	//! records dropped because a thread buffer was full, or the record too large
+	static size_t droppedRecords() {
+		std::lock_guard<std::mutex> lock(globals().buffersMutex);
+		return globals().droppedRecords;
+	}
+
+	//! called by the BLOG_* macros
+	template <typename... Args>
+	static void log(BinaryLogSite& site, const Args&... args) {
+		if (!current().load(std::memory_order_relaxed)) { return; }
+		uint32_t id = site.id_.load(std::memory_order_acquire);
+		if (id == 0) {
+			id = registerSite(site, detail::binlogSignature<Args...>());
+		}
+
+		detail::BinaryLogBuffer* buf = threadBuffer();
+		const size_t size = BINLOG_RECORD_HEADER_SIZE + detail::binlogArgsSize(args...);
+		char* p = buf->reserve(size);
+		if (!p) { return; }
+		const char* begin = p;
+		detail::binlogPut(p, static_cast<uint8_t>(BINLOG_ENTRY_RECORD));
+		detail::binlogPut(p, static_cast<uint32_t>(size));
+		detail::binlogPut(p, id);
+		detail::binlogPut(p, static_cast<int64_t>(nowTimestamp().time_since_epoch().count()));
+		detail::binlogPut(p, buf->tid_);
+		detail::binlogPutArgs(p, args...);
+		assert(static_cast<size_t>(p - begin) == size); (void)begin;
+		buf->commit(size);
+	}
+
+	struct SiteInfo
+	{
+		Logger::LogLevel level;
+		int line;
+		std::string file; // basename
+		std::string fmt;
+		std::string signature;
+	};
+
+private:
+	//! the started instance, checked by every BLOG_*, constant initialized so no guard
+	static std::atomic<BinaryLogging*>& current() {
+		static std::atomic<BinaryLogging*> instance(nullptr);
+		return instance;
+	}
+
+	//! sites and thread buffers, shared by all instances
+	struct Globals
+	{
+		std::mutex sitesMutex;
+		std::vector<SiteInfo> sites;
+		std::mutex buffersMutex;
+		std::vector<std::unique_ptr<detail::BinaryLogBuffer>> buffers;
+		size_t droppedRecords = 0;
+	};
+
+	//! behind an inline function so every translation unit shares one copy
+	static Globals& globals() {
+		static Globals g;
+		return g;
+	}
+
+	static uint32_t registerSite(BinaryLogSite& site, const char* signature) {
+		std::lock_guard<std::mutex> lock(globals().sitesMutex);
+		uint32_t id = site.id_.load(std::memory_order_relaxed);
+		if (id == 0) {
+			SiteInfo info{ site.level_, site.line_, site.file_ + detail::basenameOffset(site.file_), site.fmt_, signature };
+			globals().sites.push_back(std::move(info));
+			id = static_cast<uint32_t>(globals().sites.size());
+			site.id_.store(id, std::memory_order_release);
+		}
+		return id;
+	}
+
+	static SiteInfo siteInfo(uint32_t id) {
+		std::lock_guard<std::mutex> lock(globals().sitesMutex);
+		assert(0 < id && id <= globals().sites.size());
+		return globals().sites[id - 1];
+	}
+
+	//! marks the buffer retired when the thread exits
+	struct ThreadBufferHolder
+	{
+		detail::BinaryLogBuffer* buf = nullptr;
+		~ThreadBufferHolder() {
+			if (buf) { buf->retired_ = true; }
+		}
+	};
+
+	static detail::BinaryLogBuffer* threadBuffer() {
+		static thread_local ThreadBufferHolder holder;
+		if (!holder.buf) {
+			auto buf = std::make_unique<detail::BinaryLogBuffer>();
+			holder.buf = buf.get();
+			std::lock_guard<std::mutex> lock(globals().buffersMutex);
+			globals().buffers.push_back(std::move(buf));
+		}
+		return holder.buf;
+	}
+
+	void writeSite(FileUtil::AppendFile& file, uint32_t id) {
+		SiteInfo info = siteInfo(id);
+		std::string entry;
+		entry.reserve(16 + info.file.size() + info.fmt.size() + info.signature.size());
+		char head[16];
+		char* p = head;
+		detail::binlogPut(p, static_cast<uint8_t>(BINLOG_ENTRY_SITE));
+		detail::binlogPut(p, id);
+		detail::binlogPut(p, static_cast<uint8_t>(info.level));
+		detail::binlogPut(p, static_cast<uint32_t>(info.line));
+		detail::binlogPut(p, static_cast<uint16_t>(info.file.size()));
+		entry.append(head, p - head);
+		entry += info.file;
+		p = head;
+		detail::binlogPut(p, static_cast<uint16_t>(info.fmt.size()));
+		entry.append(head, p - head);
+		entry += info.fmt;
+		entry += static_cast<char>(info.signature.size());
+		entry += info.signature;
+		file.append(entry.data(), entry.size());
+	}
+
+	//! returns bytes consumed from all thread buffers
+	size_t drainAll(FileUtil::AppendFile& file, std::vector<bool>& written) {
+		std::vector<detail::BinaryLogBuffer*> buffers;
+		{
+			std::lock_guard<std::mutex> lock(globals().buffersMutex);
+			for (auto& b : globals().buffers) { buffers.push_back(b.get()); }
+		}
+
+		size_t total = 0;
+		for (auto buf : buffers) {
+			total += buf->drain([&](const char* record, size_t size) {
+				uint32_t id;
+				memcpy(&id, record + 5, sizeof(id));
+				if (id >= written.size()) { written.resize(id + 1, false); }
+				if (!written[id]) {
+					writeSite(file, id);
+					written[id] = true;
+				}
+				file.append(record, size);
+			});
+		}
+
+		// free buffers of exited threads, retired_ is set after their last record
+		std::lock_guard<std::mutex> lock(globals().buffersMutex);
+		for (auto it = globals().buffers.begin(); it != globals().buffers.end();) {
+			if ((*it)->retired_ && (*it)->empty()) {
+				globals().droppedRecords += (*it)->dropped_.exchange(0);
+				it = globals().buffers.erase(it);
+			} else {
+				globals().droppedRecords += (*it)->dropped_.exchange(0);
+				++it;
+			}
+		}
+		return total;
+	}
+
+	void threadFunc() {
+		FileUtil::AppendFile file(filename_);
+		char header[BINLOG_FILE_HEADER_SIZE];
+		char* p = header;
+		memcpy(p, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)); p += sizeof(BINLOG_MAGIC);
+		detail::binlogPut(p, BINLOG_VERSION);
+		detail::binlogPut(p, BINLOG_BYTE_ORDER);
+		file.append(header, sizeof(header));
+
+		// site ids already described in this file
+		std::vector<bool> written;
+		auto lastFlush = std::chrono::steady_clock::now();
+		while (running_) {
+			if (drainAll(file, written) == 0) {
+				// producers never notify, poll while idle
+				std::unique_lock<std::mutex> lock(mutex_);
+				cond_.wait_for(lock, std::chrono::milliseconds(1));
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (now - lastFlush > std::chrono::seconds(flushInterval_)) {
+				file.flush();
+				lastFlush = now;
+			}
+		}
+
+		drainAll(file, written);
+		file.flush();
+	}
+
+	const std::string filename_;
+	const int flushInterval_;
+	std::atomic<bool> running_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+};
+
+
+/**
+* @brief renders a binary log file as text, in the format of Logger
+* "2019-01-01 12:00:00.123456(UTC) 1234 INFO  message - file.cpp:42\n"
+*/
+class BinaryLogDecoder : noncopyable
+{
+public:
+	//! returns false if the file cannot be read or is not a supported binary log
+	bool open(const std::string& filename) {
+		FILE* fp = fopen(filename.c_str(), "rb");
+		if (!fp) {
+			error_ = "cannot open " + filename;
+			return false;
+		}
+		char buf[64 * 1024];
+		size_t n;
+		data_.clear();
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+			data_.append(buf, n);
+		}
+		fclose(fp);
+		return parseHeader();
+	}
+
+	//! decode from memory
+	bool load(const std::string& data) {
+		data_ = data;
+		return parseHeader();
+	}
+
+	/**
+	* @brief render the next record into line, appending
+	* @return false at the end of data or on a corrupted entry, see error()
+	*/
+	bool next(std::string* line) {
+		while (pos_ < data_.size()) {
+			const char* begin = data_.data() + pos_;
+			const char* end = data_.data() + data_.size();
+			const char* p = begin;
+			if (static_cast<size_t>(end - begin) >= sizeof(BINLOG_MAGIC) && memcmp(begin, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) == 0) {
+				// next session, site ids start over
+				if (!parseHeader(pos_)) { return false; }
+				continue;
+			}
+			uint8_t type = detail::binlogGet<uint8_t>(p);
+			if (type == BINLOG_ENTRY_SITE) {
+				if (!parseSite(p, end)) { return fail("truncated site entry"); }
+				pos_ = p - data_.data();
+			} else if (type == BINLOG_ENTRY_RECORD) {
+				if (end - p < 4) { return fail("truncated record"); }
+				uint32_t size = detail::binlogGet<uint32_t>(p);
+				if (size < BINLOG_RECORD_HEADER_SIZE || static_cast<size_t>(end - begin) < size) { return fail("truncated record"); }
+				pos_ += size;
+				if (render(begin, begin + size, line)) { return true; }
+			} else {
+				return fail("unknown entry type");
+			}
+		}
+		return false;
+	}
+
+	const std::string& error() const { return error_; }
+	size_t records() const { return records_; }
+
+private:
+	bool fail(const char* msg) {
+		error_ = msg;
+		pos_ = data_.size();
+		return false;
+	}
+
+	bool parseHeader(size_t pos = 0) {
+		if (pos == 0) {
+			records_ = 0;
+			error_.clear();
+		}
+		sites_.clear();
+		if (data_.size() < pos + BINLOG_FILE_HEADER_SIZE || memcmp(data_.data() + pos, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+			return fail("not a binary log");
+		}
+		const char* p = data_.data() + pos + sizeof(BINLOG_MAGIC);
+		uint32_t version = detail::binlogGet<uint32_t>(p);
+		uint32_t order = detail::binlogGet<uint32_t>(p);
+		if (order != BINLOG_BYTE_ORDER) {
+			return fail("byte order of the writer differs");
+		}
+		if (version != BINLOG_VERSION) {
+			return fail("unsupported version");
+		}
+		pos_ = pos + BINLOG_FILE_HEADER_SIZE;
+		return true;
+	}
+
+	bool parseSite(const char*& p, const char* end) {
+		if (end - p < 11) { return false; }
+		uint32_t id = detail::binlogGet<uint32_t>(p);
+		BinaryLogging::SiteInfo info;
+		info.level = static_cast<Logger::LogLevel>(detail::binlogGet<uint8_t>(p));
+		info.line = static_cast<int>(detail::binlogGet<uint32_t>(p));
+		uint16_t len = detail::binlogGet<uint16_t>(p);
+		if (end - p < len + 2) { return false; }
+		info.file.assign(p, len); p += len;
+		len = detail::binlogGet<uint16_t>(p);
+		if (end - p < len + 1) { return false; }
+		info.fmt.assign(p, len); p += len;
+		uint8_t nargs = detail::binlogGet<uint8_t>(p);
+		if (end - p < nargs) { return false; }
+		info.signature.assign(p, nargs); p += nargs;
+		if (info.level >= Logger::LOGLEVEL_COUNT) { info.level = Logger::LOGLEVEL_FATAL; }
+		if (id >= sites_.size()) { sites_.resize(id + 1); }
+		sites_[id] = std::move(info);
+		return true;
+	}
+
+	bool render(const char* p, const char* end, std::string* line) {
+		p += 5;
+		uint32_t id = detail::binlogGet<uint32_t>(p);
+		int64_t us = detail::binlogGet<int64_t>(p);
+		uint32_t tid = detail::binlogGet<uint32_t>(p);
+		if (id >= sites_.size() || (sites_[id].fmt.empty() && sites_[id].file.empty())) {
+			return false; // unknown site, skipped
+		}
+		const BinaryLogging::SiteInfo& site = sites_[id];
+		records_++;
+
+		Timestamp ts{ std::chrono::microseconds(us) };
+		*line += format("%F %T", ts);
+		*line += "(UTC) ";
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%u ", tid);
+		*line += buf;
+		*line += detail::LogLevelName[site.level];
+		formatMessage(site, p, end, line);
+		*line += " - ";
+		*line += site.file;
+		snprintf(buf, sizeof(buf), ":%d\n", site.line);
+		*line += buf;
+		return true;
+	}
+
+	//! printf the arguments one conversion at a time, length modifiers are replaced by the recorded types
+	static void formatMessage(const BinaryLogging::SiteInfo& site, const char* p, const char* end, std::string* out) {
+		const char* f = site.fmt.c_str();
+		size_t arg = 0;
+		while (*f) {
+			if (*f != '%') { *out += *f++; continue; }
+			if (f[1] == '%') { *out += '%'; f += 2; continue; }
+
+			// %[flags][width][.precision][length]conversion
+			std::string spec(1, *f++);
+			while (*f && strchr("-+ #0", *f)) { spec += *f++; }
+			while (*f && (isdigit(static_cast<unsigned char>(*f)) || *f == '.')) { spec += *f++; }
+			while (*f && strchr("hlLqjztI", *f)) { f++; }
+			while (isdigit(static_cast<unsigned char>(*f))) { f++; } // I64
+			if (!*f) { *out += spec; break; }
+			const char conv = *f++;
+
+			if (arg >= site.signature.size()) {
+				*out += spec; *out += conv; // missing argument
+				continue;
+			}
+			formatArg(spec, conv, site.signature[arg++], p, end, out);
+		}
+	}
+
+	static void formatArg(std::string spec, char conv, char type, const char*& p, const char* end, std::string* out) {
+		char buf[512];
+		const bool isInt = strchr("diouxXc", conv) != nullptr;
+		const bool isFloat = strchr("fFeEgGaA", conv) != nullptr;
+		if (type == 's') {
+			if (end - p < 4) { return; }
+			uint32_t len = detail::binlogGet<uint32_t>(p);
+			if (end - p < len) { return; }
+			std::string str(p, len);
+			p += len;
+			if (conv == 's') {
+				spec += 's';
+				snprintf(buf, sizeof(buf), spec.c_str(), str.c_str());
+				*out += str.size() + 64 < sizeof(buf) ? std::string(buf) : str;
+			} else {
+				*out += str;
+			}
+			return;
+		}
+
+		if (end - p < 8) { return; }
+		int len;
+		if (type == 'd') {
+			double v = detail::binlogGet<double>(p);
+			if (isInt) { spec += "ll"; spec += conv; len = snprintf(buf, sizeof(buf), spec.c_str(), static_cast<long long>(v)); }
+			else { spec += isFloat ? conv : 'g'; len = snprintf(buf, sizeof(buf), spec.c_str(), v); }
+		} else if (type == 'p' && conv == 'p') {
+			uint64_t v = detail::binlogGet<uint64_t>(p);
+			spec += 'p';
+			len = snprintf(buf, sizeof(buf), spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(v)));
+		} else {
+			// 'i', 'u', or 'p' printed as integer
+			uint64_t u = detail::binlogGet<uint64_t>(p);
+			long long i = static_cast<long long>(u);
+			if (conv == 'c') { spec += 'c'; len = snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(i)); }
+			else if (isFloat) { spec += conv; len = snprintf(buf, sizeof(buf), spec.c_str(), type == 'i' ? static_cast<double>(i) : static_cast<double>(u)); }
+			else if (conv == 'd' || conv == 'i') { spec += "ll"; spec += conv; len = snprintf(buf, sizeof(buf), spec.c_str(), type == 'u' ? static_cast<long long>(u) : i); }
+			else if (isInt) { spec += "ll"; spec += conv; len = snprintf(buf, sizeof(buf), spec.c_str(), static_cast<unsigned long long>(u)); }
+			else { spec += "lld"; len = snprintf(buf, sizeof(buf), spec.c_str(), i); }
+		}
+		if (len > 0) {
+			out->append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+		}
+	}
+
+	std::string data_;
+	size_t pos_ = 0;
+	size_t records_ = 0;
+	std::string error_;
+	//! indexed by site id
+	std::vector<BinaryLogging::SiteInfo> sites_;
+};
+
+} // namespace jlib
+
+
+/******** log micros *********/
+
+#define BLOG_LOG(level, fmt, ...) do { JLIB_LOG_IF(level) { \
+	static jlib::BinaryLogSite jlibBinaryLogSite_(level, __FILE__, __LINE__, fmt); \
+	jlib::BinaryLogging::log(jlibBinaryLogSite_, ##__VA_ARGS__); } } while (0)
+
+#define BLOG_TRACE(fmt, ...) BLOG_LOG(jlib::Logger::LogLevel::LOGLEVEL_TRACE, fmt, ##__VA_ARGS__)
+#define BLOG_DEBUG(fmt, ...) BLOG_LOG(jlib::Logger::LogLevel::LOGLEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define BLOG_INFO(fmt, ...) BLOG_LOG(jlib::Logger::LogLevel::LOGLEVEL_INFO, fmt, ##__VA_ARGS__)
+#define BLOG_WARN(fmt, ...) BLOG_LOG(jlib::Logger::LogLevel::LOGLEVEL_WARN, fmt, ##__VA_ARGS__)
+#define BLOG_ERROR(fmt, ...) BLOG_LOG(jlib::Logger::LogLevel::LOGLEVEL_ERROR, fmt, ##__VA_ARGS__)
@@ -1,10 +1,14 @@
-﻿#include "config.h"
+﻿#pragma once
+
+#include "config.h"
 #include "noncopyable.h"
 #include <mutex>
+#include <condition_variable>
 
 namespace jlib
 {
 
+//! every call takes the mutex, Latch in synchronization.h is the atomic, spin-then-park counterpart
 class CountDownLatch : noncopyable
 {
 public:
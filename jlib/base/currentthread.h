@@ -3,9 +3,16 @@
 #include "config.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #ifdef JLIB_LINUX
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #elif defined(JLIB_WINDOWS)
@@ -29,47 +36,142 @@ inline uint64_t gettid() {
 #endif
 }
 
-} // namespace detail
+struct ThreadData {
+    uint64_t cachedTid;
+    char tidString[32];
+    int tidStringLength;
+    const char* threadName;
+    char nameBuffer[32];
+};
+
+//! behind an inline function so every translation unit shares one copy, constant initialized, no guard
+inline ThreadData& threadData() {
+    static thread_local ThreadData data = { 0, { 0 }, 6, "unknown", { 0 } };
+    return data;
+}
 
+//! CPU time consumed by the thread behind handle, zero if unavailable
+inline std::chrono::nanoseconds cpuTime(std::thread::native_handle_type handle) {
+#ifdef JLIB_LINUX
+    clockid_t clock;
+    timespec ts;
+    if (pthread_getcpuclockid(handle, &clock) != 0 || clock_gettime(clock, &ts) != 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#elif defined(JLIB_WINDOWS)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(static_cast<HANDLE>(handle), &creation, &exit, &kernel, &user)) {
+        return std::chrono::nanoseconds(0);
+    }
+    uint64_t ticks = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime)
+        + (static_cast<uint64_t>(user.dwHighDateTime) << 32 | user.dwLowDateTime);
+    return std::chrono::nanoseconds(ticks * 100);
+#endif
+}
+
+} // namespace detail
 
-thread_local uint64_t t_cachedTid = 0;
-thread_local char t_tidString[32] = {0};
-thread_local int t_tidStringLength = 6;
-thread_local const char* t_threadName = "unknown";
 
 inline void cacheTid() {
-    if (t_cachedTid == 0) {
-        t_cachedTid = detail::gettid();
-        t_tidStringLength = snprintf(t_tidString, sizeof(t_tidString), "%llu ", t_cachedTid);
+    auto& data = detail::threadData();
+    if (data.cachedTid == 0) {
+        data.cachedTid = detail::gettid();
+        data.tidStringLength = snprintf(data.tidString, sizeof(data.tidString), "%llu ", static_cast<unsigned long long>(data.cachedTid));
     }
 }
 
 inline uint64_t tid() {
+    auto& data = detail::threadData();
 #ifdef JLIB_LINUX
-    if (__builtin_expect(t_cachedTid == 0, 0)) {
+    if (__builtin_expect(data.cachedTid == 0, 0)) {
 		cacheTid();
     }
 #else
-    if (t_cachedTid != 0) {
-        return t_cachedTid;
-    } else {
+    if (data.cachedTid == 0) {
         cacheTid();
     }
 #endif
 
-    return t_cachedTid;
+    return data.cachedTid;
 }
 
 inline const char* tidString() {
-    return t_tidString;
+    return detail::threadData().tidString;
 }
 
 inline int tidStringLength() {
-    return t_tidStringLength;
+    return detail::threadData().tidStringLength;
 }
 
 inline const char* name() {
-    return t_threadName;
+    return detail::threadData().threadName;
+}
+
+/**
+* @brief name the calling thread for name() and for the OS, as shown by top -H, perf and debuggers
+* the name is kept up to 31 bytes, the OS copy is cut to 15 on linux.
+*/
+inline void setName(const char* name) {
+    auto& data = detail::threadData();
+    snprintf(data.nameBuffer, sizeof(data.nameBuffer), "%s", name);
+    data.threadName = data.nameBuffer;
+#ifdef JLIB_LINUX
+    // cut on purpose, snprintf would draw -Wformat-truncation
+    char osName[16];
+    size_t n = strlen(name);
+    if (n > sizeof(osName) - 1) { n = sizeof(osName) - 1; }
+    memcpy(osName, name, n);
+    osName[n] = '\0';
+    pthread_setname_np(pthread_self(), osName);
+#elif defined(JLIB_WINDOWS)
+    // SetThreadDescription needs Windows 10 1607
+    typedef HRESULT(WINAPI* SetThreadDescriptionFunc)(HANDLE, PCWSTR);
+    auto setThreadDescription = reinterpret_cast<SetThreadDescriptionFunc>(
+        GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+    if (setThreadDescription) {
+        wchar_t wname[32];
+        if (MultiByteToWideChar(CP_UTF8, 0, data.nameBuffer, -1, wname, 32) > 0) {
+            setThreadDescription(GetCurrentThread(), wname);
+        }
+    }
+#endif
+}
+
+//! pin the calling thread to cpus, false if empty or rejected by the OS
+inline bool setAffinity(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return false;
+    }
+#ifdef JLIB_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (0 <= cpu && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(JLIB_WINDOWS)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        if (0 <= cpu && cpu < static_cast<int>(sizeof(mask) * 8)) {
+            mask |= static_cast<DWORD_PTR>(1) << cpu;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#endif
+}
+
+//! CPU time consumed by the calling thread, CLOCK_THREAD_CPUTIME_ID on linux
+inline std::chrono::nanoseconds cpuTime() {
+#ifdef JLIB_LINUX
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#elif defined(JLIB_WINDOWS)
+    return detail::cpuTime(GetCurrentThread());
+#endif
 }
 
 
@@ -0,0 +1,464 @@
+﻿#pragma once
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace jlib
+{
+
+namespace detail
+{
+
+/*
+ Double to shortest round-trip decimal string, Grisu2 by Florian Loitsch,
+ adapted from Milo Yip's dtoa (MIT License, https://github.com/miloyip/dtoa-benchmark).
+
+ The output always parses back (strtod) to the same double,
+ and is the shortest possible representation for >99.9% of inputs.
+*/
+
+struct DiyFp
+{
+	static constexpr int DIY_SIGNIFICAND_SIZE = 64;
+	static constexpr int DP_SIGNIFICAND_SIZE = 52;
+	static constexpr int DP_EXPONENT_BIAS = 0x3FF + DP_SIGNIFICAND_SIZE;
+	static constexpr int DP_MIN_EXPONENT = -DP_EXPONENT_BIAS;
+	static constexpr uint64_t DP_EXPONENT_MASK = 0x7FF0000000000000ULL;
+	static constexpr uint64_t DP_SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFULL;
+	static constexpr uint64_t DP_HIDDEN_BIT = 0x0010000000000000ULL;
+
+	uint64_t f;
+	int e;
+
+	DiyFp() : f(0), e(0) {}
+	DiyFp(uint64_t fp, int exp) : f(fp), e(exp) {}
+
+	explicit DiyFp(double d) {
+		uint64_t u64;
+		memcpy(&u64, &d, sizeof(d));
+		int biased_e = static_cast<int>((u64 & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+		uint64_t significand = (u64 & DP_SIGNIFICAND_MASK);
+		if (biased_e != 0) {
+			f = significand + DP_HIDDEN_BIT;
+			e = biased_e - DP_EXPONENT_BIAS;
+		} else {
+			f = significand;
+			e = DP_MIN_EXPONENT + 1;
+		}
+	}
+
+	DiyFp operator-(const DiyFp& rhs) const {
+		assert(e == rhs.e);
+		assert(f >= rhs.f);
+		return DiyFp(f - rhs.f, e);
+	}
+
+	//! 64x64 -> upper 64 bits, rounded
+	DiyFp operator*(const DiyFp& rhs) const {
+		const uint64_t M32 = 0xFFFFFFFF;
+		const uint64_t a = f >> 32;
+		const uint64_t b = f & M32;
+		const uint64_t c = rhs.f >> 32;
+		const uint64_t d = rhs.f & M32;
+		const uint64_t ac = a * c;
+		const uint64_t bc = b * c;
+		const uint64_t ad = a * d;
+		const uint64_t bd = b * d;
+		uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+		tmp += 1U << 31; // round
+		return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+	}
+
+	DiyFp normalize() const {
+		DiyFp res = *this;
+		while (!(res.f & DP_HIDDEN_BIT)) {
+			res.f <<= 1;
+			res.e--;
+		}
+		res.f <<= (DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 1);
+		res.e = res.e - (DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 1);
+		return res;
+	}
+
+	DiyFp normalizeBoundary() const {
+		DiyFp res = *this;
+		while (!(res.f & (DP_HIDDEN_BIT << 1))) {
+			res.f <<= 1;
+			res.e--;
+		}
+		res.f <<= (DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 2);
+		res.e = res.e - (DIY_SIGNIFICAND_SIZE - DP_SIGNIFICAND_SIZE - 2);
+		return res;
+	}
+
+	//! m- and m+, the boundaries of the rounding interval
+	void normalizedBoundaries(DiyFp* minus, DiyFp* plus) const {
+		DiyFp pl = DiyFp((f << 1) + 1, e - 1).normalizeBoundary();
+		DiyFp mi = (f == DP_HIDDEN_BIT) ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+		mi.f <<= mi.e - pl.e;
+		mi.e = pl.e;
+		*plus = pl;
+		*minus = mi;
+	}
+};
+
+//! cached normalized 10^k, k = -348, -340, ..., 340
+inline DiyFp getCachedPower(int e, int* K)
+{
+	static const uint64_t CACHED_POWERS_F[] = {
+		0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+		0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+		0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+		0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+		0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+		0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+		0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+		0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+		0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+		0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+		0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+		0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+		0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+		0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+		0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+		0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+		0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+		0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+		0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+		0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+		0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+		0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b,
+	};
+	static const int16_t CACHED_POWERS_E[] = {
+		-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+		-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+		-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+		-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+		-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+		109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+		375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+		641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+		907, 933, 960, 986, 1013, 1039, 1066,
+	};
+
+	double dk = (-61 - e) * 0.30102999566398114 + 347; // dk must be positive, so can do ceiling in positive
+	int k = static_cast<int>(dk);
+	if (dk - k > 0.0) {
+		k++;
+	}
+
+	unsigned index = static_cast<unsigned>((k >> 3) + 1);
+	*K = -(-348 + static_cast<int>(index << 3)); // decimal exponent no need lookup table
+	assert(index < sizeof(CACHED_POWERS_F) / sizeof(CACHED_POWERS_F[0]));
+	return DiyFp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+}
+
+static const uint64_t POW10_U64[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+	1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+	1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+inline void grisuRound(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+		   (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) { // closer
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+inline int countDecimalDigit32(uint32_t n)
+{
+	if (n < 10) return 1;
+	if (n < 100) return 2;
+	if (n < 1000) return 3;
+	if (n < 10000) return 4;
+	if (n < 100000) return 5;
+	if (n < 1000000) return 6;
+	if (n < 10000000) return 7;
+	if (n < 100000000) return 8;
+	if (n < 1000000000) return 9;
+	return 10;
+}
+
+inline void digitGen(const DiyFp& W, const DiyFp& Mp, uint64_t delta, char* buffer, int* len, int* K)
+{
+	const DiyFp one(uint64_t(1) << -Mp.e, Mp.e);
+	const DiyFp wp_w = Mp - W;
+	uint32_t p1 = static_cast<uint32_t>(Mp.f >> -one.e);
+	uint64_t p2 = Mp.f & (one.f - 1);
+	int kappa = countDecimalDigit32(p1);
+	*len = 0;
+
+	while (kappa > 0) {
+		uint32_t pow10 = static_cast<uint32_t>(POW10_U64[kappa - 1]);
+		uint32_t d = p1 / pow10;
+		p1 %= pow10;
+		if (d || *len) {
+			buffer[(*len)++] = static_cast<char>('0' + d);
+		}
+		kappa--;
+		uint64_t tmp = (static_cast<uint64_t>(p1) << -one.e) + p2;
+		if (tmp <= delta) {
+			*K += kappa;
+			grisuRound(buffer, *len, delta, tmp, POW10_U64[kappa] << -one.e, wp_w.f);
+			return;
+		}
+	}
+
+	// kappa = 0
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = static_cast<char>(p2 >> -one.e);
+		if (d || *len) {
+			buffer[(*len)++] = static_cast<char>('0' + d);
+		}
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*K += kappa;
+			int index = -kappa;
+			grisuRound(buffer, *len, delta, p2, one.f, wp_w.f * (index < 20 ? POW10_U64[index] : 0));
+			return;
+		}
+	}
+}
+
+//! value > 0, digits written to buffer (no terminating NUL), value = buffer * 10^K
+inline void grisu2(double value, char* buffer, int* length, int* K)
+{
+	const DiyFp v(value);
+	DiyFp w_m, w_p;
+	v.normalizedBoundaries(&w_m, &w_p);
+
+	const DiyFp c_mk = getCachedPower(w_p.e, K);
+	const DiyFp W = v.normalize() * c_mk;
+	DiyFp Wp = w_p * c_mk;
+	DiyFp Wm = w_m * c_mk;
+	Wm.f++;
+	Wp.f--;
+	digitGen(W, Wp, Wp.f - Wm.f, buffer, length, K);
+}
+
+inline char* writeExponent(int K, char* buffer)
+{
+	if (K < 0) {
+		*buffer++ = '-';
+		K = -K;
+	} else {
+		*buffer++ = '+';
+	}
+
+	if (K >= 100) {
+		*buffer++ = static_cast<char>('0' + K / 100);
+		K %= 100;
+	}
+	// at least 2 digits, like printf
+	*buffer++ = static_cast<char>('0' + K / 10);
+	*buffer++ = static_cast<char>('0' + K % 10);
+	return buffer;
+}
+
+/*
+ Place the decimal point like printf("%.17g") does:
+ fixed notation for decimal exponent in [-5, 17), otherwise scientific.
+ 1.5, 0.0001, 12345678901234567, 1e+17, 1.2345e-05
+*/
+inline int prettify(char* buffer, int length, int k)
+{
+	const int kk = length + k; // 10^(kk-1) <= v < 10^kk
+
+	if (length <= kk && kk <= 17) {
+		// 1234e3 -> 1234000
+		for (int i = length; i < kk; i++) {
+			buffer[i] = '0';
+		}
+		return kk;
+	} else if (0 < kk && kk <= 17) {
+		// 1234e-2 -> 12.34
+		memmove(&buffer[kk + 1], &buffer[kk], static_cast<size_t>(length - kk));
+		buffer[kk] = '.';
+		return length + 1;
+	} else if (-4 < kk && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		const int offset = 2 - kk;
+		memmove(&buffer[offset], &buffer[0], static_cast<size_t>(length));
+		buffer[0] = '0';
+		buffer[1] = '.';
+		for (int i = 2; i < offset; i++) {
+			buffer[i] = '0';
+		}
+		return length + offset;
+	} else if (length == 1) {
+		// 1e30
+		buffer[1] = 'e';
+		return static_cast<int>(writeExponent(kk - 1, &buffer[2]) - buffer);
+	} else {
+		// 1234e30 -> 1.234e+33
+		memmove(&buffer[2], &buffer[1], static_cast<size_t>(length - 1));
+		buffer[1] = '.';
+		buffer[length + 1] = 'e';
+		return static_cast<int>(writeExponent(kk - 1, &buffer[length + 2]) - buffer);
+	}
+}
+
+//! buffer must hold at least 32 chars, no terminating NUL is written, returns length
+inline int convertDouble(char* buffer, double value)
+{
+	uint64_t u64;
+	memcpy(&u64, &value, sizeof(value));
+	char* p = buffer;
+	if (u64 >> 63) {
+		*p++ = '-';
+		value = -value;
+		u64 &= ~(1ULL << 63);
+	}
+
+	if ((u64 & DiyFp::DP_EXPONENT_MASK) == DiyFp::DP_EXPONENT_MASK) {
+		if (u64 & DiyFp::DP_SIGNIFICAND_MASK) {
+			buffer[0] = 'n'; buffer[1] = 'a'; buffer[2] = 'n';
+			return 3;
+		}
+		p[0] = 'i'; p[1] = 'n'; p[2] = 'f';
+		return static_cast<int>(p - buffer) + 3;
+	}
+
+	if (u64 == 0) {
+		*p++ = '0';
+		return static_cast<int>(p - buffer);
+	}
+
+	int length, K;
+	grisu2(value, p, &length, &K);
+	return static_cast<int>(p - buffer) + prettify(p, length, K);
+}
+
+
+/*
+ Exact "%.Nf" for |value| < 2^63 and precision <= 9, rounding half to even
+ exactly like printf, without going through the locale or the format parser.
+ Returns -1 when the fast path does not apply.
+*/
+inline int convertFixed(char* buffer, double value, int precision)
+{
+	if (precision < 0 || precision > 9) {
+		return -1;
+	}
+
+	uint64_t u64;
+	memcpy(&u64, &value, sizeof(value));
+	const bool negative = (u64 >> 63) != 0;
+	const int biased_e = static_cast<int>((u64 & DiyFp::DP_EXPONENT_MASK) >> DiyFp::DP_SIGNIFICAND_SIZE);
+	if (biased_e == 0x7FF) {
+		return -1; // inf or nan
+	}
+
+	// value = m * 2^e
+	uint64_t m = u64 & DiyFp::DP_SIGNIFICAND_MASK;
+	int e;
+	if (biased_e != 0) {
+		m += DiyFp::DP_HIDDEN_BIT;
+		e = biased_e - DiyFp::DP_EXPONENT_BIAS;
+	} else {
+		e = DiyFp::DP_MIN_EXPONENT + 1;
+	}
+
+	uint64_t ip = 0;   // integer part
+	uint64_t frac = 0; // fractional part, scaled by 10^precision and rounded
+	const uint64_t scale = POW10_U64[precision];
+
+	if (e >= 0) {
+		if (e > 10 || (m << e) >> e != m || (m << e) >> 63) {
+			return -1; // >= 2^63
+		}
+		ip = m << e;
+	} else {
+		const int s = -e; // value = ip + F / 2^s
+		uint64_t F;
+		if (s < 64) {
+			ip = m >> s;
+			F = m & ((1ULL << s) - 1);
+		} else {
+			F = m;
+		}
+
+		// P = F * 5^precision < 2^53 * 2^21, kept as hi:lo
+		const uint64_t five = scale >> precision;
+		const uint64_t fh = (F >> 32) * five;
+		const uint64_t fl = (F & 0xFFFFFFFF) * five;
+		uint64_t lo = fl + (fh << 32);
+		uint64_t hi = (fh >> 32) + (lo < fl ? 1 : 0);
+
+		// frac = round(P / 2^(s - precision))
+		const int shift = s - precision;
+		if (shift <= 0) {
+			frac = lo << -shift; // exact
+		} else {
+			uint64_t q, remHi, remLo, halfHi, halfLo;
+			if (shift < 64) {
+				q = (lo >> shift) | (shift > 0 ? hi << (64 - shift) : 0);
+				remHi = 0; remLo = lo & ((1ULL << shift) - 1);
+				halfHi = 0; halfLo = 1ULL << (shift - 1);
+			} else if (shift < 128) {
+				q = hi >> (shift - 64);
+				remHi = shift == 64 ? 0 : hi & ((1ULL << (shift - 64)) - 1); remLo = lo;
+				halfHi = shift == 64 ? 0 : 1ULL << (shift - 65); halfLo = shift == 64 ? 1ULL << 63 : 0;
+			} else {
+				q = 0;
+				remHi = 0; remLo = 0; // P < 2^74 < half
+				halfHi = 1; halfLo = 0;
+			}
+
+			frac = q;
+			if (remHi > halfHi || (remHi == halfHi && remLo > halfLo)) {
+				frac++;
+			} else if (remHi == halfHi && remLo == halfLo && ((precision == 0 ? ip : q) & 1)) {
+				frac++; // tie, round half to even on the last printed digit
+			}
+		}
+
+		if (frac >= scale) {
+			frac -= scale;
+			ip++;
+			if (ip >> 63) {
+				return -1;
+			}
+		}
+	}
+
+	char* p = buffer;
+	if (negative) {
+		*p++ = '-';
+	}
+
+	char tmp[24];
+	char* t = tmp;
+	do {
+		*t++ = static_cast<char>('0' + ip % 10);
+		ip /= 10;
+	} while (ip);
+	while (t != tmp) {
+		*p++ = *--t;
+	}
+
+	if (precision > 0) {
+		*p++ = '.';
+		for (int i = precision - 1; i >= 0; i--) {
+			p[i] = static_cast<char>('0' + frac % 10);
+			frac /= 10;
+		}
+		p += precision;
+	}
+
+	return static_cast<int>(p - buffer);
+}
+
+} // namespace detail
+
+} // namespace jlib
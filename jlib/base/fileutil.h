@@ -7,6 +7,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <string.h> // strerror
+#include <stdint.h>
 #include <algorithm>
 #include "cast.h"
 #include "noncopyable.h"
@@ -23,31 +25,30 @@ class ReadSmallFile : noncopyable
 {
 public:
 	ReadSmallFile(StringArg filename)
-		: fd_(::fopen(filename.c_str(), "r"))
+		: fp_(::fopen(filename.c_str(), "rb"))
 		, err_(0)
 	{
 		buf_[0] = '\0';
-		if (fd_ < 0) {
+		if (!fp_) {
 			err_ = errno;
 		}
 	}
 
 	~ReadSmallFile() {
-		if (fd_ >= 0) {
-			::fclose(fd_);
+		if (fp_) {
+			::fclose(fp_);
 		}
 	}
 
 	template <typename StringType>
 	int readToString(int maxSize, StringType* content, int64_t* fileSize, int64_t* modifyTime, int64_t* createTime) {
-		static_assert(sizeof(off_t) == 8, "sizeof(off_t) != 8");
 		assert(content);
 		int err = err_;
-		if (fd_ >= 0) {
+		if (fp_) {
 			content->clear();
 			if (fileSize) {
 				struct stat statbuf;
-				if (::fstat(fd_, &statbuf) == 0) {
+				if (::fstat(fileno(fp_), &statbuf) == 0) {
 					if (S_IFREG & (statbuf.st_mode)) {
 						*fileSize = statbuf.st_size;
 						content->reserve(static_cast<int>(std::min(implicit_cast<int64_t>(maxSize), *fileSize)));
@@ -63,17 +64,17 @@ public:
 						*createTime = statbuf.st_ctime;
 					}
 				} else {
-					err = errno
+					err = errno;
 				}
 			}
 
 			while (content->size() < implicit_cast<size_t>(maxSize)) {
 				size_t toRead = std::min(implicit_cast<size_t>(maxSize) - content->size(), sizeof(buf_));
-				size_t n = ::fread(buf_, 1, toRead, fd_);
+				size_t n = ::fread(buf_, 1, toRead, fp_);
 				if (n > 0) {
 					content->append(buf_, n);
 				} else {
-					if (n < 0) {
+					if (::ferror(fp_)) {
 						err = errno;
 					}
 					break;
@@ -86,9 +87,9 @@ public:
 
 	int readToBuffer(int* size) {
 		int err = err_;
-		if (fd_ >= 0) {
-			size_t n = ::fread(buf_, 1, sizeof(buf_) - 1, fd_);
-			if (n >= 0) {
+		if (fp_) {
+			size_t n = ::fread(buf_, 1, sizeof(buf_) - 1, fp_);
+			if (!::ferror(fp_)) {
 				if (size) {
 					*size = static_cast<int>(n);
 				}
@@ -105,7 +106,7 @@ public:
 	static constexpr int BUFFER_SIZE = 64 * 1024;
 
 private:
-	int fd_;
+	FILE* fp_;
 	int err_;
 	char buf_[BUFFER_SIZE];
 };
@@ -120,20 +121,67 @@ int readFile(StringArg filename, int maxSize, String* content, int64_t* fileSize
 
 
 //! not thread safe
-class AppendToFile : noncopyable
+class AppendFile : noncopyable
 {
 public:
-	explicit AppendToFile(StringArg filename)
+	explicit AppendFile(StringArg filename)
+#ifdef JLIB_WINDOWS
+		: fp_(::fopen(filename.c_str(), "ab"))
+#else
+		: fp_(::fopen(filename.c_str(), "ae")) // 'e' for O_CLOEXEC
+#endif
+		, writtenBytes_(0)
 	{
+		if (fp_) {
+			// user supplied buffer, fwrite only memcpy's until it is full
+			::setvbuf(fp_, buf_, _IOFBF, sizeof(buf_));
+		} else {
+			fprintf(stderr, "AppendFile: open %s failed: %s\n", filename.c_str(), strerror(errno));
+		}
+	}
 
+	~AppendFile() {
+		if (fp_) {
+			::fclose(fp_);
+		}
 	}
 
-	static constexpr int BUFFER_SIZE = 64 * 1024;
+	void append(const char* logLine, size_t len) {
+		if (!fp_) { return; }
+		size_t n = write(logLine, len);
+		size_t remain = len - n;
+		while (remain > 0) {
+			size_t x = write(logLine + n, remain);
+			if (x == 0) {
+				int err = errno; // ferror() only tells whether it failed, errno tells why
+				if (::ferror(fp_)) {
+					fprintf(stderr, "AppendFile::append() failed %s\n", strerror(err));
+				}
+				break;
+			}
+			n += x;
+			remain = len - n;
+		}
+		writtenBytes_ += static_cast<off_t>(len);
+	}
+
+	void flush() {
+		if (fp_) {
+			::fflush(fp_);
+		}
+	}
 
+	off_t writtenBytes() const { return writtenBytes_; }
+
+	static constexpr int BUFFER_SIZE = 64 * 1024;
 
 private:
 	size_t write(const char* logLine, size_t len) {
-
+#ifdef JLIB_WINDOWS
+		return ::_fwrite_nolock(logLine, 1, len, fp_);
+#else
+		return ::fwrite_unlocked(logLine, 1, len, fp_);
+#endif
 	}
 
 	FILE* fp_;
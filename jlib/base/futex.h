@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include <atomic>
+#include <stdint.h>
+
+#ifdef JLIB_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#elif defined(JLIB_WINDOWS)
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! block while *addr == expected, may return spuriously, std::atomic::wait before C++20
+inline void futexWait(std::atomic<uint32_t>* addr, uint32_t expected) {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+#ifdef JLIB_LINUX
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif defined(JLIB_WINDOWS)
+	WaitOnAddress(addr, &expected, sizeof(expected), INFINITE);
+#endif
+}
+
+inline void futexWakeOne(std::atomic<uint32_t>* addr) {
+#ifdef JLIB_LINUX
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(JLIB_WINDOWS)
+	WakeByAddressSingle(addr);
+#endif
+}
+
+inline void futexWakeAll(std::atomic<uint32_t>* addr) {
+#ifdef JLIB_LINUX
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(JLIB_WINDOWS)
+	WakeByAddressAll(addr);
+#endif
+}
+
+} // namespace detail
+
+/**
+* @brief parks threads waiting for a condition that is checked without a lock
+* waiter: key = prepareWait(); if (condition) cancelWait(); else wait(key);
+* notifier: make the condition true, then notifyOne() or notifyAll().
+* Notifying costs one fence and one load when nobody waits.
+*/
+class EventCount : noncopyable
+{
+public:
+	EventCount() : epoch_(0), waiters_(0) {}
+
+	uint32_t prepareWait() {
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+		return epoch_.load(std::memory_order_seq_cst);
+	}
+
+	void cancelWait() {
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void wait(uint32_t key) {
+		while (epoch_.load(std::memory_order_acquire) == key) {
+			detail::futexWait(&epoch_, key);
+		}
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void notifyOne() {
+		// pairs with the fetch_add in prepareWait(), either we see the waiter or it sees the condition
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_relaxed) > 0) {
+			epoch_.fetch_add(1, std::memory_order_release);
+			detail::futexWakeOne(&epoch_);
+		}
+	}
+
+	void notifyAll() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_relaxed) > 0) {
+			epoch_.fetch_add(1, std::memory_order_release);
+			detail::futexWakeAll(&epoch_);
+		}
+	}
+
+private:
+	std::atomic<uint32_t> epoch_;
+	std::atomic<uint32_t> waiters_;
+};
+
+} // namespace jlib
@@ -0,0 +1,167 @@
+﻿#pragma once
+
+#include "config.h"
+#include "logstream.h"
+#include <algorithm>
+#include <string>
+#include <stddef.h>
+
+namespace jlib
+{
+
+/*
+ Offset/hex/ASCII dump of a byte buffer, shared by LogStream, log.h and log2.h.
+
+ 00000000  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  |Hello, world!...|
+ 00000010  FF                                                |.|
+ ... 4079 more bytes
+
+ The output length is known before formatting, so it is written in one pass
+ into a buffer sized by size(), bytes beyond maxBytes are summarized in one line.
+*/
+class HexDump
+{
+public:
+	enum Columns { HEX = 1, ASCII = 2, BOTH = HEX | ASCII };
+	enum { BYTES_PER_ROW = 16, MAX_ROW_SIZE = 79 };
+	static constexpr size_t NO_LIMIT = static_cast<size_t>(-1);
+
+	HexDump(const void* data, size_t len, size_t maxBytes = NO_LIMIT, Columns columns = BOTH)
+		: data_(static_cast<const unsigned char*>(data))
+		, len_(len)
+		, shown_(len < maxBytes ? len : maxBytes)
+		, columns_(columns)
+	{}
+
+	size_t length() const { return len_; }
+	//! bytes that are formatted, the rest is truncated
+	size_t shown() const { return shown_; }
+
+	//! exact number of chars format() writes
+	size_t size() const {
+		size_t rows = shown_ / BYTES_PER_ROW;
+		size_t n = rows * rowSize(BYTES_PER_ROW);
+		if (shown_ % BYTES_PER_ROW) {
+			n += rowSize(shown_ % BYTES_PER_ROW);
+		}
+		if (shown_ < len_) {
+			n += truncatedSize();
+		}
+		return n;
+	}
+
+	//! write size() chars to out, not NUL terminated, return size()
+	size_t format(char* out) const {
+		char* p = out;
+		for (size_t offset = 0; offset < shown_; offset += BYTES_PER_ROW) {
+			p = formatRow(p, offset);
+		}
+		if (shown_ < len_) {
+			p = formatTruncated(p);
+		}
+		return p - out;
+	}
+
+	void appendTo(std::string& str) const {
+		size_t old = str.size();
+		str.resize(old + size());
+		format(&str[old]);
+	}
+
+	std::string toString() const {
+		std::string str;
+		appendTo(str);
+		return str;
+	}
+
+	//! a row of at most MAX_ROW_SIZE chars starting at offset, return the end of it
+	char* formatRow(char* p, size_t offset) const {
+		size_t n = std::min(shown_ - offset, static_cast<size_t>(BYTES_PER_ROW));
+		const unsigned char* bytes = data_ + offset;
+		p = writeOffset(p, offset);
+		*p++ = ' ';
+		*p++ = ' ';
+		if (columns_ & HEX) {
+			for (size_t i = 0; i < n; i++) {
+				*p++ = detail::HEX_PAIRS[bytes[i] * 2];
+				*p++ = detail::HEX_PAIRS[bytes[i] * 2 + 1];
+				*p++ = ' ';
+				if (i == 7 && n > 8) { *p++ = ' '; }
+			}
+			if (columns_ & ASCII) {
+				// pad a short last row so the ASCII column lines up
+				size_t pad = hexWidth(BYTES_PER_ROW) - hexWidth(n) + 1;
+				memset(p, ' ', pad);
+				p += pad;
+			} else {
+				--p; // trailing space
+			}
+		}
+		if (columns_ & ASCII) {
+			*p++ = '|';
+			for (size_t i = 0; i < n; i++) {
+				*p++ = (bytes[i] >= 0x20 && bytes[i] < 0x7F) ? static_cast<char>(bytes[i]) : '.';
+			}
+			*p++ = '|';
+		}
+		*p++ = '\n';
+		return p;
+	}
+
+private:
+	static size_t hexWidth(size_t n) { return n * 3 + (n > 8 ? 1 : 0); }
+
+	size_t rowSize(size_t n) const {
+		size_t size = 8 + 2 + 1;
+		if (columns_ & HEX) {
+			size += (columns_ & ASCII) ? hexWidth(BYTES_PER_ROW) + 1 : hexWidth(n) - 1;
+		}
+		if (columns_ & ASCII) {
+			size += n + 2;
+		}
+		return size;
+	}
+
+	// "... N more bytes\n"
+	size_t truncatedSize() const {
+		return 4 + detail::countDigits(static_cast<uint64_t>(len_ - shown_)) + 12;
+	}
+
+	char* formatTruncated(char* p) const {
+		memcpy(p, "... ", 4);
+		p += 4;
+		p += detail::convert(p, static_cast<uint64_t>(len_ - shown_));
+		memcpy(p, " more bytes\n", 12);
+		return p + 12;
+	}
+
+	static char* writeOffset(char* p, size_t offset) {
+		uint32_t v = static_cast<uint32_t>(offset);
+		for (int i = 3; i >= 0; i--) {
+			unsigned idx = (v & 0xFF) * 2;
+			p[i * 2] = detail::HEX_PAIRS[idx];
+			p[i * 2 + 1] = detail::HEX_PAIRS[idx + 1];
+			v >>= 8;
+		}
+		return p + 8;
+	}
+
+	const unsigned char* data_;
+	size_t len_;
+	size_t shown_;
+	Columns columns_;
+};
+
+//! rows that do not fit in the log line are dropped
+inline LogStream& operator<<(LogStream& s, const HexDump& dump) {
+	char row[HexDump::MAX_ROW_SIZE];
+	for (size_t offset = 0; offset < dump.shown(); offset += HexDump::BYTES_PER_ROW) {
+		s.append(row, static_cast<int>(dump.formatRow(row, offset) - row));
+	}
+	if (dump.shown() < dump.length()) {
+		s << "... " << dump.length() - dump.shown() << " more bytes\n";
+	}
+	return s;
+}
+
+} // namespace jlib
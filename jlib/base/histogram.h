@@ -0,0 +1,172 @@
+﻿#pragma once
+
+#include "config.h"
+#include "copyable.h"
+#include "noncopyable.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef JLIB_WINDOWS
+#include <intrin.h>
+#endif
+
+namespace jlib
+{
+
+namespace detail
+{
+class HistogramCounters;
+}
+
+/**
+* @brief durations in log2 buckets of nanoseconds, 512 bytes, percentiles within a factor of 2
+* bucket 0 counts 0ns, bucket n counts [2^(n-1), 2^n) ns, the last one everything above.
+*/
+class Histogram : public copyable
+{
+public:
+	enum { BUCKETS = 64 };
+
+	Histogram() : count_(0), sum_(0), max_(0) {
+		for (auto& b : buckets_) { b = 0; }
+	}
+
+	static int bucketOf(uint64_t ns) {
+		if (ns == 0) { return 0; }
+#ifdef JLIB_WINDOWS
+		unsigned long index;
+#  ifdef _WIN64
+		_BitScanReverse64(&index, ns);
+#  else
+		if (ns >> 32) {
+			_BitScanReverse(&index, static_cast<unsigned long>(ns >> 32));
+			index += 32;
+		} else {
+			_BitScanReverse(&index, static_cast<unsigned long>(ns));
+		}
+#  endif
+		int bucket = static_cast<int>(index) + 1;
+#else
+		int bucket = 64 - __builtin_clzll(ns);
+#endif
+		return bucket < BUCKETS ? bucket : BUCKETS - 1;
+	}
+
+	void add(uint64_t ns) {
+		buckets_[bucketOf(ns)]++;
+		count_++;
+		sum_ += ns;
+		if (ns > max_) { max_ = ns; }
+	}
+
+	void add(std::chrono::nanoseconds d) { add(static_cast<uint64_t>(d.count() > 0 ? d.count() : 0)); }
+
+	void merge(const Histogram& rhs) {
+		for (int i = 0; i < BUCKETS; i++) { buckets_[i] += rhs.buckets_[i]; }
+		count_ += rhs.count_;
+		sum_ += rhs.sum_;
+		if (rhs.max_ > max_) { max_ = rhs.max_; }
+	}
+
+	uint64_t count() const { return count_; }
+	uint64_t bucket(int i) const { return buckets_[i]; }
+	//! nanoseconds
+	uint64_t sum() const { return sum_; }
+	uint64_t max() const { return max_; }
+	double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+	//! upper bound in ns of the bucket holding the p-th percentile, p in [0, 100], never above max()
+	uint64_t percentile(double p) const {
+		if (count_ == 0) { return 0; }
+		uint64_t rank = static_cast<uint64_t>(p / 100.0 * count_ + 0.5);
+		if (rank < 1) { rank = 1; }
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; i++) {
+			seen += buckets_[i];
+			if (seen >= rank) {
+				uint64_t upper = i == 0 ? 0 : (i < BUCKETS - 1 ? (1ULL << i) - 1 : max_);
+				return upper < max_ ? upper : max_;
+			}
+		}
+		return max_;
+	}
+
+	//! "count=1000 mean=12.3us p50=15.4us p90=31.7us p99=63.5us max=80.1us"
+	std::string toString() const {
+		char buf[160];
+		snprintf(buf, sizeof(buf), "count=%llu mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus",
+				 static_cast<unsigned long long>(count_), mean() / 1e3, percentile(50) / 1e3,
+				 percentile(90) / 1e3, percentile(99) / 1e3, max_ / 1e3);
+		return buf;
+	}
+
+private:
+	friend class detail::HistogramCounters;
+
+	uint64_t buckets_[BUCKETS];
+	uint64_t count_;
+	uint64_t sum_;
+	uint64_t max_;
+};
+
+namespace detail
+{
+
+/**
+* @brief a Histogram written by one thread and read by any, without locks or read-modify-writes
+* the writer does relaxed loads and stores; a snapshot may be a few samples behind.
+*/
+class HistogramCounters : noncopyable
+{
+public:
+	HistogramCounters() : sum_(0), max_(0) {
+		for (auto& b : buckets_) { b.store(0, std::memory_order_relaxed); }
+	}
+
+	//! by the owning thread only
+	void add(std::chrono::nanoseconds d) {
+		uint64_t ns = static_cast<uint64_t>(d.count() > 0 ? d.count() : 0);
+		bump(buckets_[Histogram::bucketOf(ns)], 1);
+		bump(sum_, ns);
+		if (ns > max_.load(std::memory_order_relaxed)) {
+			max_.store(ns, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t count() const {
+		uint64_t n = 0;
+		for (auto& b : buckets_) { n += b.load(std::memory_order_relaxed); }
+		return n;
+	}
+
+	//! nanoseconds
+	uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+	//! count is the sum of the buckets, so it always agrees with them
+	void mergeInto(Histogram& h) const {
+		for (int i = 0; i < Histogram::BUCKETS; i++) {
+			uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+			h.buckets_[i] += n;
+			h.count_ += n;
+		}
+		h.sum_ += sum_.load(std::memory_order_relaxed);
+		uint64_t max = max_.load(std::memory_order_relaxed);
+		if (max > h.max_) { h.max_ = max; }
+	}
+
+private:
+	static void bump(std::atomic<uint64_t>& a, uint64_t n) {
+		a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> buckets_[Histogram::BUCKETS];
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+} // namespace detail
+
+} // namespace jlib
@@ -2,6 +2,9 @@
 
 #include "config.h"
 #include "noncopyable.h"
+#include "fileutil.h"
+#include "process.h"
+#include "time.h" // gmtime_r
 #include <mutex>
 #include <memory>
 #include <string>
@@ -11,11 +14,6 @@
 namespace jlib
 {
 
-namespace FileUtil
-{
-class AppendFile;
-}
-
 class LogFile : noncopyable
 {
 public:
@@ -56,17 +54,58 @@ public:
 	}
 
 	bool rollFile() {
-
+		time_t now = ::time(nullptr);
+		std::string filename = getLogFileName(basename_, now);
+		time_t start = now / ROLL_PER_SECONDS * ROLL_PER_SECONDS;
+
+		// at most one file per second, otherwise the name would collide
+		if (now > lastRoll_) {
+			lastRoll_ = now;
+			lastFlush_ = now;
+			startOfPeriod_ = start;
+			file_.reset(new FileUtil::AppendFile(filename));
+			return true;
+		}
+		return false;
 	}
 
 protected:
 	void appendUnlocked(const char* logLine, int len) {
 		file_->append(logLine, len);
-		
+
+		if (file_->writtenBytes() > rollSize_) {
+			rollFile();
+		} else if (++count_ >= checkEveryN_) {
+			// only look at the clock every checkEveryN_ lines
+			count_ = 0;
+			time_t now = ::time(nullptr);
+			time_t thisPeriod = now / ROLL_PER_SECONDS * ROLL_PER_SECONDS;
+			if (thisPeriod != startOfPeriod_) {
+				rollFile();
+			} else if (now - lastFlush_ > flushInterval_) {
+				lastFlush_ = now;
+				file_->flush();
+			}
+		}
 	}
 
+	//! basename.20190101-120000.pid.log
 	static std::string getLogFileName(const std::string& basename, time_t now) {
+		std::string filename;
+		filename.reserve(basename.size() + 64);
+		filename = basename;
+
+		char timebuf[32];
+		struct tm tm;
+		gmtime_r(&now, &tm);
+		strftime(timebuf, sizeof(timebuf), ".%Y%m%d-%H%M%S.", &tm);
+		filename += timebuf;
+
+		char pidbuf[32];
+		snprintf(pidbuf, sizeof(pidbuf), "%llu.log", static_cast<unsigned long long>(getPid()));
+		filename += pidbuf;
 
+		return filename;
 	}
 
 private:
@@ -5,9 +5,14 @@
 #include "timestamp.h"
 #include "timezone.h"
 #include "currentthread.h"
+#include "logsampling.h"
 #include <stdlib.h> // getenv
 #include <errno.h>
 #include <string.h> // strerror_r
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
 
 #ifdef JLIB_WINDOWS
 inline void strerror_r(int errnum, char* buf, size_t buflen) {
@@ -15,9 +20,57 @@ inline void strerror_r(int errnum, char* buf, size_t buflen) {
 }
 #endif
 
+/*
+ Statements below JLIB_MIN_LOG_LEVEL are compiled out, their arguments never evaluated.
+ 0 TRACE, 1 DEBUG, 2 INFO, 3 WARN, 4 ERROR. FATAL is never compiled out.
+ e.g. -DJLIB_MIN_LOG_LEVEL=2 for release builds.
+*/
+#ifndef JLIB_MIN_LOG_LEVEL
+#define JLIB_MIN_LOG_LEVEL 0
+#endif
+
+/*
+ Module of the log statements for Logger::setModuleLogLevel, defaults to the basename of the source file.
+ Define it before including logging.h to group files, e.g. #define JLIB_LOG_MODULE "net"
+*/
+#ifndef JLIB_LOG_MODULE
+#define JLIB_LOG_MODULE __FILE__
+#endif
+
 namespace jlib
 {
 
+namespace detail
+{
+
+inline constexpr bool isPathSeparator(char c) {
+#ifdef JLIB_WINDOWS
+	return c == '\\' || c == '/';
+#else
+	return c == '/';
+#endif
+}
+
+//! offset of the basename in path, evaluated at compile time for literals
+inline constexpr int basenameOffset(const char* path) {
+	int offset = 0;
+	for (int i = 0; path[i]; i++) {
+		if (isPathSeparator(path[i])) { offset = i + 1; }
+	}
+	return offset;
+}
+
+//! FNV-1a of the basename of module, evaluated at compile time for literals
+inline constexpr uint32_t logModuleId(const char* module) {
+	uint32_t h = 2166136261u;
+	for (const char* p = module + basenameOffset(module); *p; p++) {
+		h = (h ^ static_cast<unsigned char>(*p)) * 16777619u;
+	}
+	return h;
+}
+
+} // namespace detail
+
 class Logger
 {
 public:
@@ -35,25 +88,21 @@ public:
 	struct SourceFile
 	{
 		template <int N>
-		SourceFile(const char(&arr)[N]) : data_(arr), size_(N - 1) {
-#ifdef JLIB_WINDOWS
-			const char* slash = strrchr(data_, '\\');
-#else
-			const char* slash = strrchr(data_, '/');
-#endif
-			if (slash) { data_ = slash + 1; }
-			size_ -= static_cast<int>(data_ - arr);
-		}
-
-		explicit SourceFile(const char* filename) : data_(filename) {
-#ifdef JLIB_WINDOWS
-			const char* slash = strrchr(data_, '\\');
-#else
-			const char* slash = strrchr(data_, '/');
-#endif
-			if (slash) { data_ = slash + 1; }
-			size_ = static_cast<int>(strlen(data_));
-		}
+		constexpr SourceFile(const char(&arr)[N])
+			: data_(arr + detail::basenameOffset(arr))
+			, size_(N - 1 - detail::basenameOffset(arr))
+		{}
+
+		//! offset and size are compile time constants, see JLIB_LOG_SOURCE_FILE
+		constexpr SourceFile(const char* path, int offset, int size)
+			: data_(path + offset)
+			, size_(size - offset)
+		{}
+
+		explicit SourceFile(const char* filename)
+			: data_(filename + detail::basenameOffset(filename))
+			, size_(static_cast<int>(strlen(data_)))
+		{}
 
 		const char* data_;
 		int size_;
@@ -77,14 +126,61 @@ public:
 	LogStream& stream() { return impl_.stream_; }
 
 	static LogLevel logLevel() { return logLevel_; }
-	static void setLogLevel(LogLevel level) { logLevel_ = level; }
+	static void setLogLevel(LogLevel level) {
+		std::lock_guard<std::mutex> lock(moduleMutex_);
+		logLevel_ = level;
+		updateMinLogLevel();
+	}
+
+	/**
+	* @brief override the level of one module, the others keep following logLevel()
+	* @param module basename of a source file like "tcpserver.cpp", or a JLIB_LOG_MODULE name
+	* @return false if there are already MAX_MODULES overrides
+	*/
+	static bool setModuleLogLevel(const char* module, LogLevel level) {
+		const uint32_t id = detail::logModuleId(module);
+		std::lock_guard<std::mutex> lock(moduleMutex_);
+		int n = moduleCount_.load(std::memory_order_relaxed);
+		int i = 0;
+		while (i < n && moduleLevels_[i].id != id) { i++; }
+		if (i == n) {
+			if (n == MAX_MODULES) { return false; }
+			moduleLevels_[i].id = id;
+		}
+		moduleLevels_[i].level.store(level, std::memory_order_relaxed);
+		moduleCount_.store(i == n ? n + 1 : n, std::memory_order_release);
+		updateMinLogLevel();
+		return true;
+	}
+
+	//! level of module, logLevel() if not overridden
+	static LogLevel moduleLogLevel(uint32_t moduleId) {
+		int n = moduleCount_.load(std::memory_order_acquire);
+		for (int i = 0; i < n; i++) {
+			if (moduleLevels_[i].id == moduleId) {
+				return moduleLevels_[i].level.load(std::memory_order_relaxed);
+			}
+		}
+		return logLevel_;
+	}
+
+	static LogLevel moduleLogLevel(const char* module) { return moduleLogLevel(detail::logModuleId(module)); }
+
+	//! disabled statements cost a single compare against the lowest enabled level
+	static bool isEnabled(LogLevel level, uint32_t moduleId) {
+		if (level < minLogLevel_.load(std::memory_order_relaxed)) { return false; }
+		if (moduleCount_.load(std::memory_order_relaxed) == 0) { return true; }
+		return level >= moduleLogLevel(moduleId);
+	}
+
+	static constexpr int MAX_MODULES = 64;
 
 	typedef void (*OutputFunc)(const char* msg, int len);
 	typedef void (*FlushFunc)();
 
-	static void setOutput(OutputFunc);
-	static void setFlush(FlushFunc);
-	static void setTimeZone(const TimeZone& tz);
+	static void setOutput(OutputFunc out) { outputFunc_ = out; }
+	static void setFlush(FlushFunc flush) { flushFunc_ = flush; }
+	static void setTimeZone(const TimeZone& tz) { timeZone_ = &tz; }
 
 private:
 
@@ -104,32 +200,88 @@ private:
 		SourceFile basename_;
 	};
 
+	//! must be called with moduleMutex_ locked
+	static void updateMinLogLevel() {
+		LogLevel minLevel = logLevel_;
+		int n = moduleCount_.load(std::memory_order_relaxed);
+		for (int i = 0; i < n; i++) {
+			minLevel = std::min(minLevel, moduleLevels_[i].level.load(std::memory_order_relaxed));
+		}
+		minLogLevel_.store(minLevel, std::memory_order_relaxed);
+	}
+
+	struct ModuleLevel
+	{
+		uint32_t id;
+		std::atomic<LogLevel> level;
+	};
+
 	static OutputFunc outputFunc_;
 	static FlushFunc flushFunc_;
 	static LogLevel logLevel_;
 	static const TimeZone* timeZone_;
 
+	//! min of logLevel_ and all module levels
+	static std::atomic<LogLevel> minLogLevel_;
+	//! append only, readers scan [0, moduleCount_) without locking
+	static ModuleLevel moduleLevels_[MAX_MODULES];
+	static std::atomic<int> moduleCount_;
+	static std::mutex moduleMutex_;
+
 	Impl impl_;
 };
 
 
 /******** log micros *********/
 
-#define LOG_TRACE if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_TRACE) \
-	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_TRACE, __func__).stream()
+#define JLIB_LOG_MODULE_ID std::integral_constant<uint32_t, jlib::detail::logModuleId(JLIB_LOG_MODULE)>::value
+
+#define JLIB_LOG_SOURCE_FILE jlib::Logger::SourceFile(__FILE__, \
+	std::integral_constant<int, jlib::detail::basenameOffset(__FILE__)>::value, static_cast<int>(sizeof(__FILE__) - 1))
+
+// the first operand is a compile time constant, the whole statement is removed if it is false
+#define JLIB_LOG_IF(level) if ((level) >= JLIB_MIN_LOG_LEVEL && jlib::Logger::isEnabled(level, JLIB_LOG_MODULE_ID))
+
+#define LOG_TRACE JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_TRACE) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_TRACE, __func__).stream()
+
+#define LOG_DEBUG JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_DEBUG) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_DEBUG, __func__).stream()
 
-#define LOG_DEBUG if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_DEBUG) \
-	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_DEBUG, __func__).stream()
+#define LOG_INFO JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_INFO) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_INFO).stream()
 
-#define LOG_INFO if (jlib::Logger::logLevel() <= jlib::Logger::LogLevel::LOGLEVEL_INFO) \
-	jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_INFO).stream()
+#define LOG_WARN JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_WARN) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_WARN).stream()
 
+#define LOG_ERROR JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_ERROR) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_ERROR).stream()
 
-#define LOG_WARN jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_WARN).stream()
-#define LOG_ERROR jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_ERROR).stream()
-#define LOG_FATAL jlib::Logger(__FILE__, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_FATAL).stream()
-#define LOG_SYSERR jlib::Logger(__FILE__, __LINE__, false).stream()
-#define LOG_SYSFATAL jlib::Logger(__FILE__, __LINE__, true).stream()
+#define LOG_SYSERR JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_ERROR) \
+	jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, false).stream()
+
+#define LOG_FATAL jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_FATAL).stream()
+#define LOG_SYSFATAL jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, true).stream()
+
+/*
+ Sampled logging for error storms, level is TRACE, DEBUG, INFO, WARN or ERROR,
+ the next emitted line starts with "(suppressed N lines) ".
+   LOG_EVERY_N(WARN, 1000) << "queue full";      // 1st, 1001st, 2001st ...
+   LOG_FIRST_N(INFO, 10) << "first 10 only";
+   LOG_EVERY_T(ERROR, 1.0) << "at most once per second";
+   LOG_RATELIMITED(ERROR, 10, 100) << "10 lines/s on average, bursts up to 100";
+ counters only advance when the level is enabled.
+*/
+#define JLIB_LOG_SAMPLED(level, shouldLog) \
+	JLIB_LOG_IF(jlib::Logger::LogLevel::LOGLEVEL_##level) \
+	for (uint64_t jlibSuppressed_ = 0, jlibOnce_ = (shouldLog); jlibOnce_; jlibOnce_ = 0) \
+		jlib::Logger(JLIB_LOG_SOURCE_FILE, __LINE__, jlib::Logger::LogLevel::LOGLEVEL_##level).stream() << jlib::detail::Suppressed{ jlibSuppressed_ }
+
+#define LOG_EVERY_N(level, n) JLIB_LOG_SAMPLED(level, JLIB_LOG_SITE(jlib::LogEveryN).shouldLog((n), &jlibSuppressed_))
+#define LOG_FIRST_N(level, n) JLIB_LOG_SAMPLED(level, JLIB_LOG_SITE(jlib::LogFirstN).shouldLog((n), &jlibSuppressed_))
+#define LOG_EVERY_T(level, seconds) JLIB_LOG_SAMPLED(level, JLIB_LOG_SITE(jlib::LogEveryT).shouldLog((seconds), &jlibSuppressed_))
+#define LOG_RATELIMITED(level, perSecond, burst) \
+	JLIB_LOG_SAMPLED(level, JLIB_LOG_SITE(jlib::LogRateLimiter).shouldLog((perSecond), (burst), &jlibSuppressed_))
 
 
 namespace detail
@@ -157,6 +309,12 @@ static Logger::LogLevel initLogLevel() {
 	}
 }
 
+//! prefix of sampled lines
+struct Suppressed
+{
+	uint64_t lines;
+};
+
 struct T
 {
 	explicit T(const char* str, unsigned int len)
@@ -171,9 +329,19 @@ struct T
 };
 
 thread_local char t_errnobuf[512] = { 0 };
+// "2019-01-01 12:00:00" of t_lastSecond in t_zone
 thread_local char t_time[64] = { 0 };
 thread_local time_t t_lastSecond = 0;
-static constexpr unsigned int T_TIME_STR_LEN = 17;
+static constexpr unsigned int T_TIME_STR_LEN = 19;
+
+// cached utc offset of t_zone, valid in [t_zoneBegin, t_zoneEnd)
+thread_local const TimeZone* t_zone = nullptr;
+thread_local time_t t_zoneBegin = 0;
+thread_local time_t t_zoneEnd = 0;
+thread_local time_t t_zoneOffset = 0;
+// "(UTC) "
+thread_local char t_zoneAbbr[32] = { 0 };
+thread_local unsigned int t_zoneAbbrLen = 0;
 
 } // detail
 
@@ -184,6 +352,10 @@ Logger::OutputFunc Logger::outputFunc_ = detail::defaultOutput;
 Logger::FlushFunc Logger::flushFunc_ = detail::defaultFlush;
 Logger::LogLevel Logger::logLevel_ = detail::initLogLevel();
 const jlib::TimeZone* Logger::timeZone_ = date::locate_zone("Etc/UTC");
+std::atomic<Logger::LogLevel> Logger::minLogLevel_(Logger::logLevel_);
+Logger::ModuleLevel Logger::moduleLevels_[Logger::MAX_MODULES] = {};
+std::atomic<int> Logger::moduleCount_(0);
+std::mutex Logger::moduleMutex_;
 
 
 /******** LogStream operators *********/
@@ -196,6 +368,13 @@ inline LogStream& operator<<(LogStream& s, detail::T t) {
 	s.append(t.str_, t.len_); return s;
 }
 
+inline LogStream& operator<<(LogStream& s, detail::Suppressed suppressed) {
+	if (suppressed.lines) {
+		s << "(suppressed " << suppressed.lines << " lines) ";
+	}
+	return s;
+}
+
 inline const char* strerror_t(int savedErrno) {
 	strerror_r(savedErrno, detail::t_errnobuf, sizeof(detail::t_errnobuf));
 	return detail::t_errnobuf;
@@ -222,32 +401,43 @@ Logger::Impl::Impl(LogLevel level, int old_errno, const SourceFile& file, int li
 
 void Logger::Impl::formatTime()
 {
-	//int64_t microSecsSinceEpoch = time_.microSecondsSinceEpoch();
-	//time_t seconds = static_cast<time_t>(microSecsSinceEpoch / MICRO_SECONDS_PER_SECOND);
-	//int microsecs = static_cast<int>(microSecsSinceEpoch % MICRO_SECONDS_PER_SECOND);
-	//if (seconds != detail::t_lastSecond) {
-	//	detail::t_lastSecond = seconds;
-	//	struct tm tm_time;
-	//	if (timeZone_.valid()) {
-	//		// TODO
-	//	} else {
-	//		gmtime_r(&seconds, &tm_time);
-	//	}
-
-	//	int len = snprintf(detail::t_time, sizeof(detail::t_time), "%4d%02d%02d %02d:%02d:%02d",
-	//					   tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-	//					   tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-	//	assert(len == detail::T_TIME_STR_LEN); (void)len;
-	//}
-
-	//if (timeZone_.valid()) {
-	//	// TODO
-	//} else {
-	//	Format us(".%06dZ ", microsecs); assert(us.length() == 9);
-	//	stream_ << detail::T(detail::t_time, detail::T_TIME_STR_LEN) << detail::T(us.data(), 9);
-	//}
-
-	stream_ << format("%F %T(%Z) ", time_);
+	// only the microseconds are formatted per line,
+	// the seconds prefix is re-formatted once per second per thread
+	auto secs = floor<std::chrono::seconds>(time_);
+	int microsecs = static_cast<int>((time_ - secs).count());
+	time_t seconds = static_cast<time_t>(secs.time_since_epoch().count());
+
+	if (seconds != detail::t_lastSecond || timeZone_ != detail::t_zone) {
+		if (timeZone_ != detail::t_zone || seconds < detail::t_zoneBegin || seconds >= detail::t_zoneEnd) {
+			// rarely happens, only on DST transition or zone change
+			auto info = timeZone_->get_info(secs);
+			detail::t_zone = timeZone_;
+			detail::t_zoneBegin = static_cast<time_t>(info.begin.time_since_epoch().count());
+			detail::t_zoneEnd = static_cast<time_t>(info.end.time_since_epoch().count());
+			detail::t_zoneOffset = static_cast<time_t>(info.offset.count());
+			int len = snprintf(detail::t_zoneAbbr, sizeof(detail::t_zoneAbbr), "(%s) ", info.abbrev.c_str());
+			detail::t_zoneAbbrLen = static_cast<unsigned int>(std::min<size_t>(len, sizeof(detail::t_zoneAbbr) - 1));
+		}
+
+		detail::t_lastSecond = seconds;
+		time_t local = seconds + detail::t_zoneOffset;
+		auto dp = floor<days>(sys_seconds(std::chrono::seconds(local)));
+		year_month_day ymd(dp);
+		long sod = static_cast<long>(local - static_cast<time_t>(dp.time_since_epoch().count()) * 86400);
+		int len = snprintf(detail::t_time, sizeof(detail::t_time), "%04d-%02u-%02u %02ld:%02ld:%02ld",
+						   static_cast<int>(ymd.year()), static_cast<unsigned>(ymd.month()), static_cast<unsigned>(ymd.day()),
+						   sod / 3600, sod % 3600 / 60, sod % 60);
+		assert(len == detail::T_TIME_STR_LEN); (void)len;
+	}
+
+	char us[8] = { '.' };
+	for (int i = 6; i > 0; i--) {
+		us[i] = static_cast<char>('0' + microsecs % 10);
+		microsecs /= 10;
+	}
+
+	stream_ << detail::T(detail::t_time, detail::T_TIME_STR_LEN) << detail::T(us, 7)
+		<< detail::T(detail::t_zoneAbbr, detail::t_zoneAbbrLen);
 }
 
 void Logger::Impl::finish()
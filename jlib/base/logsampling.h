@@ -0,0 +1,119 @@
+﻿#pragma once
+
+#include "config.h"
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+namespace jlib
+{
+
+/*
+ Per call site state of the sampled log macros,
+ LOG_EVERY_N and friends in logging.h, JLOG_EVERY_N and friends in log2.h.
+ All lock free and constant initialized, shouldLog() reports through suppressed
+ how many lines were skipped since the previous emitted one.
+*/
+
+namespace detail
+{
+
+inline int64_t logSamplingNowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace detail
+
+//! emit the 1st, (n+1)th, (2n+1)th ... lines
+class LogEveryN
+{
+public:
+	constexpr LogEveryN() : count_(0) {}
+
+	bool shouldLog(uint64_t n, uint64_t* suppressed) {
+		uint64_t c = count_.fetch_add(1, std::memory_order_relaxed);
+		if (n > 1 && c % n != 0) { return false; }
+		*suppressed = (c == 0 || n <= 1) ? 0 : n - 1;
+		return true;
+	}
+
+private:
+	std::atomic<uint64_t> count_;
+};
+
+//! emit the first n lines only
+class LogFirstN
+{
+public:
+	constexpr LogFirstN() : count_(0) {}
+
+	bool shouldLog(uint64_t n, uint64_t* suppressed) {
+		*suppressed = 0;
+		// stop counting once past n, so it never wraps
+		return count_.load(std::memory_order_relaxed) < n && count_.fetch_add(1, std::memory_order_relaxed) < n;
+	}
+
+private:
+	std::atomic<uint64_t> count_;
+};
+
+//! emit at most one line every seconds
+class LogEveryT
+{
+public:
+	constexpr LogEveryT() : last_(0), suppressed_(0) {}
+
+	bool shouldLog(double seconds, uint64_t* suppressed) {
+		const int64_t now = detail::logSamplingNowNs();
+		int64_t last = last_.load(std::memory_order_relaxed);
+		if ((last != 0 && now - last < static_cast<int64_t>(seconds * 1e9))
+			|| !last_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+			suppressed_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+
+private:
+	std::atomic<int64_t> last_;
+	std::atomic<uint64_t> suppressed_;
+};
+
+/**
+* @brief token bucket, perSecond tokens refilled per second, at most burst tokens
+* implemented as GCRA, the whole bucket is one atomic "theoretical arrival time"
+*/
+class LogRateLimiter
+{
+public:
+	constexpr LogRateLimiter() : tat_(0), suppressed_(0) {}
+
+	bool shouldLog(double perSecond, double burst, uint64_t* suppressed) {
+		const int64_t interval = static_cast<int64_t>(1e9 / perSecond);
+		const int64_t tolerance = static_cast<int64_t>(interval * (burst > 1 ? burst - 1 : 0));
+		const int64_t now = detail::logSamplingNowNs();
+		int64_t tat = tat_.load(std::memory_order_relaxed);
+		for (;;) {
+			const int64_t base = tat > now ? tat : now;
+			if (base - now > tolerance) {
+				suppressed_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			if (tat_.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+
+private:
+	std::atomic<int64_t> tat_;
+	std::atomic<uint64_t> suppressed_;
+};
+
+} // namespace jlib
+
+//! reference to a static Type unique to the expanding call site, no guard since Type is constant initialized
+#define JLIB_LOG_SITE(Type) ([]() -> Type& { static Type jlibLogSite_; return jlibLogSite_; }())
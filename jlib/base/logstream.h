@@ -4,6 +4,7 @@
 #include "noncopyable.h"
 #include "stringpiece.h"
 #include "cast.h"
+#include "dtoa.h"
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
@@ -12,6 +13,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <inttypes.h>
+#ifdef JLIB_WINDOWS
+#include <intrin.h>
+#endif
 
 namespace jlib
 {
@@ -71,46 +75,149 @@ template class FixedBuffer<SMALL_BUFFER>;
 template class FixedBuffer<LARGE_BUFFER>;
 
 
-// Efficient Integer to String Conversions, by Matthew Wilson.
-template <typename T>
-inline size_t convert(char buf[], T value)
+//! number of leading zero bits, x must not be 0
+inline int countLeadingZeros(uint64_t x)
 {
-    static const char digits[] = "9876543210123456789";
-    static const char* zero = digits + 9;
-    static_assert(sizeof(digits) == 20, "wrong number of digits");
+	assert(x != 0);
+#ifdef JLIB_WINDOWS
+	unsigned long index = 0;
+	_BitScanReverse64(&index, x);
+	return 63 - static_cast<int>(index);
+#else
+	return __builtin_clzll(x);
+#endif
+}
 
-    T i = value;
-    char *p = buf;
+//! decimal digits of n, 1 for 0
+inline int countDigits(uint64_t n)
+{
+	static const uint64_t POWERS_OF_10[] = {
+		0, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+		1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+		100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+		1000000000000000000ULL, 10000000000000000000ULL,
+	};
+	// log10(x) ~= log2(x) * 1233 / 4096
+	int t = (64 - countLeadingZeros(n | 1)) * 1233 >> 12;
+	return t - (n < POWERS_OF_10[t]) + 1;
+}
 
-    do {
-        int lsd = static_cast<int>(i % 10);
-        i /= 10; *p++ = zero[lsd];
-    } while (i != 0);
+static const char DIGIT_PAIRS[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static const char HEX_PAIRS[] =
+	"000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+//! write exactly len digits of n ending at buf + len, two digits per division
+inline void writeDigits(char* buf, uint64_t n, int len)
+{
+	char* p = buf + len;
+	while (n >= 100) {
+		unsigned idx = static_cast<unsigned>(n % 100) * 2;
+		n /= 100;
+		*--p = DIGIT_PAIRS[idx + 1];
+		*--p = DIGIT_PAIRS[idx];
+	}
+	if (n < 10) {
+		*--p = static_cast<char>('0' + n);
+	} else {
+		unsigned idx = static_cast<unsigned>(n) * 2;
+		*--p = DIGIT_PAIRS[idx + 1];
+		*--p = DIGIT_PAIRS[idx];
+	}
+	assert(p == buf);
+}
 
-    if (value < 0) { *p++ = '-'; }
-    *p = '\0';
-    std::reverse(buf, p);
+/*
+ Integer to string, digit count is computed up front so the output is written
+ backwards in place, two digits per step from a 200-byte table, no std::reverse.
+ buf must hold at least 21 chars, a terminating NUL is written.
+*/
+template <typename T>
+inline size_t convert(char buf[], T value)
+{
+	static_assert(std::is_integral<T>::value, "Must be integral type");
+	typedef typename std::make_unsigned<T>::type U;
+
+	char* p = buf;
+	U u = static_cast<U>(value);
+	if (value < 0) {
+		*p++ = '-';
+		u = static_cast<U>(U(0) - u); // well defined for min()
+	}
 
-    return p - buf;
+	int len = countDigits(u);
+	writeDigits(p, u, len);
+	p += len;
+	*p = '\0';
+	return p - buf;
 }
 
-static size_t convertHex(char buf[], uintptr_t value)
+//! upper case hex without prefix, one table lookup per byte, a terminating NUL is written
+inline size_t convertHex(char buf[], uintptr_t value)
 {
-    static const char digitsHex[] = "0123456789ABCDEF";
-    static_assert(sizeof(digitsHex) == 17, "wrong number of digitsHex");
-    
-    uintptr_t i = value;
-    char *p = buf;
+	uint64_t v = value;
+	int len = (64 - countLeadingZeros(v | 1) + 3) / 4;
+	char* p = buf + len;
+	*p = '\0';
+
+	while (v >= 0x100) {
+		unsigned idx = static_cast<unsigned>(v & 0xFF) * 2;
+		v >>= 8;
+		*--p = HEX_PAIRS[idx + 1];
+		*--p = HEX_PAIRS[idx];
+	}
+	if (v >= 0x10) {
+		unsigned idx = static_cast<unsigned>(v) * 2;
+		*--p = HEX_PAIRS[idx + 1];
+		*--p = HEX_PAIRS[idx];
+	} else {
+		*--p = HEX_PAIRS[v * 2 + 1];
+	}
+	assert(p == buf);
 
-    do {
-        int lsd = static_cast<int>(i % 16);
-        i /= 16; *p++ = digitsHex[lsd];
-    } while (i != 0);
+	return len;
+}
 
-    *p = '\0';
-    std::reverse(buf, p);
+//! n / 10^prec with exactly prec decimals, (999, 2) -> "9.99", no terminating NUL, returns length
+inline int convertScaled(char* buf, uint64_t n, int prec)
+{
+	const int digits = countDigits(n);
+	const int len = (digits > prec ? digits : prec + 1) + (prec > 0 ? 1 : 0);
+	char* p = buf + len;
+	for (int i = 0; i < prec; i++) {
+		*--p = static_cast<char>('0' + n % 10);
+		n /= 10;
+	}
+	if (prec > 0) {
+		*--p = '.';
+	}
+	writeDigits(buf, n, static_cast<int>(p - buf));
+	return len;
+}
 
-    return p - buf;
+//! round(n * m / 2^shift), ties away from zero, exact for n < 2^63, m <= 100, 0 < shift < 64
+inline uint64_t scaleRound(uint64_t n, uint64_t m, int shift)
+{
+	const uint64_t half = 1ULL << (shift - 1);
+	if (shift < 32) {
+		assert(n < (1ULL << 56));
+		return (n * m + half) >> shift;
+	}
+	// n * m + half may overflow 64 bits, divide the low word first
+	const uint64_t low = ((n & 0xFFFFFFFF) * m + half) >> 32;
+	return ((n >> 32) * m + low) >> (shift - 32);
 }
 
 } // namespace detail
@@ -152,9 +259,10 @@ public:
 
 	self& operator<<(float v) { *this << static_cast<double>(v); return *this; }
 
+	//! shortest representation that round-trips, locale independent
 	self& operator<<(double v) {
         if (buffer_.avail() >= MAX_NUMERIC_SIZE) {
-            int len = snprintf(buffer_.current(), MAX_NUMERIC_SIZE, "%.12g", v);
+            int len = detail::convertDouble(buffer_.current(), v);
             buffer_.add(len);
         }
         return *this;
@@ -214,6 +322,9 @@ public:
     template <typename T>
     Format(const char* fmt, T val) {
         static_assert(std::is_arithmetic<T>::value == true, "Must be arithmetic type");
+        if (formatFast(fmt, val, std::is_floating_point<T>())) {
+            return;
+        }
         length_ = snprintf(buf_, sizeof(buf_), fmt, val);
         assert(static_cast<size_t>(length_) < sizeof(buf_));
     }
@@ -222,6 +333,74 @@ public:
     int length() const { return length_; }
 
 private:
+    //! skip '%' and an optional width < 20 without flags, nullptr if fmt does not start so
+    static const char* parseWidth(const char* fmt, int* width) {
+        if (*fmt++ != '%' || *fmt == '0') { return nullptr; }
+        *width = 0;
+        while ('0' <= *fmt && *fmt <= '9') {
+            *width = *width * 10 + (*fmt++ - '0');
+            if (*width >= 20) { return nullptr; }
+        }
+        return fmt;
+    }
+
+    //! right-align the len chars in buf_ to width, like printf does
+    bool finish(int len, int width) {
+        if (len < 0 || len >= static_cast<int>(sizeof(buf_)) || width >= static_cast<int>(sizeof(buf_))) { return false; }
+        if (len < width) {
+            // a short backward copy, memmove here trips -Wstringop-overflow on the len < 0 path it cannot prove dead
+            const int pad = width - len;
+            for (int i = len - 1; i >= 0; i--) {
+                buf_[i + pad] = buf_[i];
+            }
+            memset(buf_, ' ', pad);
+            len = width;
+        }
+        buf_[len] = '\0';
+        length_ = len;
+        return true;
+    }
+
+    //! fast path for "%.Nf" and "%W.Nf", N <= 9
+    bool formatFast(const char* fmt, double val, std::true_type) {
+        int width;
+        fmt = parseWidth(fmt, &width);
+        if (!fmt || fmt[0] != '.' || fmt[1] < '0' || fmt[1] > '9' || fmt[2] != 'f' || fmt[3] != '\0') {
+            return false;
+        }
+        return finish(detail::convertFixed(buf_, val, fmt[1] - '0'), width);
+    }
+
+    //! bool goes to snprintf, this non-template overload keeps convert<bool> from being instantiated
+    bool formatFast(const char*, bool, std::false_type) { return false; }
+
+    //! fast path for "%d", "%i", "%u" with optional width and length modifiers, signedness must match T
+    template <typename T>
+    bool formatFast(const char* fmt, T val, std::false_type) {
+        int width;
+        fmt = parseWidth(fmt, &width);
+        if (!fmt) { return false; }
+        int shorts = 0;
+        while (*fmt == 'h' || *fmt == 'l' || *fmt == 'j' || *fmt == 'z' || *fmt == 'I' || ('0' <= *fmt && *fmt <= '9')) {
+            if (*fmt == 'h') { shorts++; }
+            fmt++; // hh h l ll j z, and I64 of msvc
+        }
+        const char conv = fmt[0];
+        if (fmt[1] != '\0' || !((std::is_signed<T>::value && (conv == 'd' || conv == 'i')) ||
+                                 (std::is_unsigned<T>::value && conv == 'u'))) {
+            return false;
+        }
+        // printf narrows the value for h and hh, so must this
+        typedef typename std::conditional<std::is_signed<T>::value, signed char, unsigned char>::type Char;
+        typedef typename std::conditional<std::is_signed<T>::value, short, unsigned short>::type Short;
+        if (shorts >= 2) {
+            return finish(static_cast<int>(detail::convert(buf_, static_cast<Char>(val))), width);
+        } else if (shorts == 1) {
+            return finish(static_cast<int>(detail::convert(buf_, static_cast<Short>(val))), width);
+        }
+        return finish(static_cast<int>(detail::convert(buf_, val)), width);
+    }
+
     char buf_[32];
     int length_;
 };
@@ -260,43 +439,29 @@ inline LogStream& operator<<(LogStream& s, const Format& fmt) {
 */
 static std::string formatSI(int64_t s)
 {
-    double n = static_cast<double>(s);
     char buf[64];
-    if (s < 1000)
-        snprintf(buf, sizeof(buf), "%" PRId64, s);
-    else if (s < 9995)
-        snprintf(buf, sizeof(buf), "%.2fk", n / 1e3);
-    else if (s < 99950)
-        snprintf(buf, sizeof(buf), "%.1fk", n / 1e3);
-    else if (s < 999500)
-        snprintf(buf, sizeof(buf), "%.0fk", n / 1e3);
-    else if (s < 9995000)
-        snprintf(buf, sizeof(buf), "%.2fM", n / 1e6);
-    else if (s < 99950000)
-        snprintf(buf, sizeof(buf), "%.1fM", n / 1e6);
-    else if (s < 999500000)
-        snprintf(buf, sizeof(buf), "%.0fM", n / 1e6);
-    else if (s < 9995000000)
-        snprintf(buf, sizeof(buf), "%.2fG", n / 1e9);
-    else if (s < 99950000000)
-        snprintf(buf, sizeof(buf), "%.1fG", n / 1e9);
-    else if (s < 999500000000)
-        snprintf(buf, sizeof(buf), "%.0fG", n / 1e9);
-    else if (s < 9995000000000)
-        snprintf(buf, sizeof(buf), "%.2fT", n / 1e12);
-    else if (s < 99950000000000)
-        snprintf(buf, sizeof(buf), "%.1fT", n / 1e12);
-    else if (s < 999500000000000)
-        snprintf(buf, sizeof(buf), "%.0fT", n / 1e12);
-    else if (s < 9995000000000000)
-        snprintf(buf, sizeof(buf), "%.2fP", n / 1e15);
-    else if (s < 99950000000000000)
-        snprintf(buf, sizeof(buf), "%.1fP", n / 1e15);
-    else if (s < 999500000000000000)
-        snprintf(buf, sizeof(buf), "%.0fP", n / 1e15);
-    else
-        snprintf(buf, sizeof(buf), "%.2fE", n / 1e18);
-    return buf;
+    if (s < 1000) {
+        return std::string(buf, detail::convert(buf, s));
+    }
+
+    // same ranges as "%.2f", "%.1f", "%.0f" of n / 1e3, n / 1e6 ..., rounded half up in integers
+    static const char units[] = "kMGTPE";
+    uint64_t n = static_cast<uint64_t>(s);
+    uint64_t unit = 1000;
+    for (int i = 0; ; i++, unit *= 1000) {
+        int prec = 0;
+        uint64_t divisor = unit;
+        if (units[i] == 'E' || n < unit * 9995 / 1000) {
+            prec = 2; divisor = unit / 100;
+        } else if (n < unit * 9995 / 100) {
+            prec = 1; divisor = unit / 10;
+        } else if (n >= unit * 9995 / 10) {
+            continue;
+        }
+        int len = detail::convertScaled(buf, (n + divisor / 2) / divisor, prec);
+        buf[len++] = units[i];
+        return std::string(buf, len);
+    }
 }
 
 // Format quantity n in IEC (binary) units (Ki, Mi, Gi, Ti, Pi, Ei).
@@ -311,58 +476,30 @@ static std::string formatSI(int64_t s)
 */
 static std::string formatIEC(int64_t s)
 {
-	static constexpr double Ki = 1024.0;
-	static constexpr double Mi = Ki * 1024.0;
-	static constexpr double Gi = Mi * 1024.0;
-	static constexpr double Ti = Gi * 1024.0;
-	static constexpr double Pi = Ti * 1024.0;
-	static constexpr double Ei = Pi * 1024.0;
-
     double n = static_cast<double>(s);
     char buf[64];
+    if (n < 1024.0) {
+        return std::string(buf, detail::convert(buf, s));
+    }
 
-    if (n < Ki)
-        snprintf(buf, sizeof buf, "%" PRId64, s);
-    else if (n < Ki * 9.995)
-        snprintf(buf, sizeof buf, "%.2fKi", n / Ki);
-    else if (n < Ki * 99.95)
-        snprintf(buf, sizeof buf, "%.1fKi", n / Ki);
-    else if (n < Ki * 1023.5)
-        snprintf(buf, sizeof buf, "%.0fKi", n / Ki);
-
-    else if (n < Mi * 9.995)
-        snprintf(buf, sizeof buf, "%.2fMi", n / Mi);
-    else if (n < Mi * 99.95)
-        snprintf(buf, sizeof buf, "%.1fMi", n / Mi);
-    else if (n < Mi * 1023.5)
-        snprintf(buf, sizeof buf, "%.0fMi", n / Mi);
-
-    else if (n < Gi * 9.995)
-        snprintf(buf, sizeof buf, "%.2fGi", n / Gi);
-    else if (n < Gi * 99.95)
-        snprintf(buf, sizeof buf, "%.1fGi", n / Gi);
-    else if (n < Gi * 1023.5)
-        snprintf(buf, sizeof buf, "%.0fGi", n / Gi);
-
-    else if (n < Ti * 9.995)
-        snprintf(buf, sizeof buf, "%.2fTi", n / Ti);
-    else if (n < Ti * 99.95)
-        snprintf(buf, sizeof buf, "%.1fTi", n / Ti);
-    else if (n < Ti * 1023.5)
-        snprintf(buf, sizeof buf, "%.0fTi", n / Ti);
-
-    else if (n < Pi * 9.995)
-        snprintf(buf, sizeof buf, "%.2fPi", n / Pi);
-    else if (n < Pi * 99.95)
-        snprintf(buf, sizeof buf, "%.1fPi", n / Pi);
-    else if (n < Pi * 1023.5)
-        snprintf(buf, sizeof buf, "%.0fPi", n / Pi);
-
-    else if (n < Ei * 9.995)
-        snprintf(buf, sizeof buf, "%.2fEi", n / Ei);
-    else
-        snprintf(buf, sizeof buf, "%.1fEi", n / Ei);
-    return buf;
+    // same ranges as "%.2f", "%.1f", "%.0f" of n / Ki, n / Mi ..., rounded half up in integers
+    static const char units[] = "KMGTPE";
+    for (int i = 0; ; i++) {
+        const int shift = 10 * (i + 1);
+        const double unit = static_cast<double>(1ULL << shift);
+        int prec = 0;
+        if (n < unit * 9.995) {
+            prec = 2;
+        } else if (n < unit * 99.95 || units[i] == 'E') {
+            prec = 1;
+        } else if (n >= unit * 1023.5) {
+            continue;
+        }
+        int len = detail::convertScaled(buf, detail::scaleRound(s, prec == 2 ? 100 : prec == 1 ? 10 : 1, shift), prec);
+        buf[len++] = units[i];
+        buf[len++] = 'i';
+        return std::string(buf, len);
+    }
 }
 
 } // namespace jlib
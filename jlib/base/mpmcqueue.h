@@ -0,0 +1,194 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "futex.h"
+#include <atomic>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief lock-free bounded multi-producer multi-consumer queue
+* Dmitry Vyukov's ring, every cell carries a sequence number telling whether it is ready
+* to be written or read at a given position, a push or pop is one CAS on the shared index.
+* push()/pop() spin briefly then park in the kernel only while the queue is full/empty.
+* After close() pushes fail and pops drain what is left then fail.
+*/
+template <typename T>
+class BoundedMpmcQueue : noncopyable
+{
+public:
+	//! capacity is rounded up to a power of 2
+	explicit BoundedMpmcQueue(size_t capacity)
+		: capacity_(roundUpPowerOf2(capacity))
+		, mask_(capacity_ - 1)
+		, cells_(new Cell[capacity_])
+		, enqueuePos_(0)
+		, dequeuePos_(0)
+		, closed_(false)
+	{
+		for (size_t i = 0; i < capacity_; i++) {
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~BoundedMpmcQueue() {
+		T item;
+		while (tryPop(item)) {}
+		delete[] cells_;
+	}
+
+	size_t capacity() const { return capacity_; }
+
+	//! approximate under concurrent use
+	size_t size() const {
+		size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+		size_t head = dequeuePos_.load(std::memory_order_relaxed);
+		return tail > head ? tail - head : 0;
+	}
+
+	//! false if full, item is left untouched then
+	template <typename U>
+	bool tryPush(U&& item) {
+		Cell* cell;
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		::new (&cell->storage) T(std::forward<U>(item));
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		notEmpty_.notifyOne();
+		return true;
+	}
+
+	//! false if empty
+	bool tryPop(T& item) {
+		Cell* cell;
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		T* p = reinterpret_cast<T*>(&cell->storage);
+		item = std::move(*p);
+		p->~T();
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		notFull_.notifyOne();
+		return true;
+	}
+
+	//! block while full, false if closed
+	template <typename U>
+	bool push(U&& item) {
+		for (int spin = 0; ; spin++) {
+			if (closed_.load(std::memory_order_acquire)) { return false; }
+			if (tryPush(std::forward<U>(item))) { return true; }
+			if (spin < SPIN_COUNT) {
+				std::this_thread::yield();
+				continue;
+			}
+			uint32_t key = notFull_.prepareWait();
+			if (closed_.load(std::memory_order_acquire) || !full()) {
+				notFull_.cancelWait();
+			} else {
+				notFull_.wait(key);
+			}
+		}
+	}
+
+	//! block while empty, false if closed and drained
+	bool pop(T& item) {
+		for (int spin = 0; ; spin++) {
+			if (tryPop(item)) { return true; }
+			if (closed_.load(std::memory_order_acquire)) { return tryPop(item); }
+			if (spin < SPIN_COUNT) {
+				std::this_thread::yield();
+				continue;
+			}
+			uint32_t key = notEmpty_.prepareWait();
+			if (closed_.load(std::memory_order_acquire) || !empty()) {
+				notEmpty_.cancelWait();
+			} else {
+				notEmpty_.wait(key);
+			}
+		}
+	}
+
+	//! wake all blocked threads, pushes fail from now on
+	void close() {
+		closed_.store(true, std::memory_order_release);
+		notEmpty_.notifyAll();
+		notFull_.notifyAll();
+	}
+
+	bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+	enum { SPIN_COUNT = 16 };
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	static size_t roundUpPowerOf2(size_t n) {
+		size_t cap = 2;
+		while (cap < n) { cap <<= 1; }
+		return cap;
+	}
+
+	//! the cell at the enqueue position still holds an unread item
+	bool full() const {
+		size_t pos = enqueuePos_.load(std::memory_order_seq_cst);
+		return cells_[pos & mask_].sequence.load(std::memory_order_seq_cst) != pos;
+	}
+
+	//! the cell at the dequeue position is not written yet
+	bool empty() const {
+		size_t pos = dequeuePos_.load(std::memory_order_seq_cst);
+		return cells_[pos & mask_].sequence.load(std::memory_order_seq_cst) != pos + 1;
+	}
+
+	const size_t capacity_;
+	const size_t mask_;
+	Cell* const cells_;
+	// producers and consumers each hammer their own index
+	char pad0_[64];
+	std::atomic<size_t> enqueuePos_;
+	char pad1_[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> dequeuePos_;
+	char pad2_[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<bool> closed_;
+	EventCount notEmpty_;
+	EventCount notFull_;
+};
+
+} // namespace jlib
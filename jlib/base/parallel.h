@@ -0,0 +1,219 @@
+﻿#pragma once
+
+#include "config.h"
+#include "threadpool.h"
+#include "futex.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+
+namespace jlib
+{
+
+/*
+ Data parallel algorithms on a ThreadPool.
+ The calling thread works too, and up to pool.threadCount() helper tasks join it if the pool
+ gets to them before the range is exhausted. Chunks are claimed from one shared index,
+ each claim takes 1/(2 * executors) of what is left but at least grain items (guided scheduling),
+ so slow chunks or busy workers do not leave the others idle. Helpers that start late return at once,
+ the caller only waits for the helpers that joined, so nesting inside pool tasks does not deadlock.
+ The first exception thrown by fn stops the others from claiming more and is rethrown to the caller.
+*/
+
+namespace detail
+{
+
+class ParallelRange : noncopyable
+{
+public:
+	ParallelRange(size_t size, size_t grain, size_t executors)
+		: size_(size)
+		, grain_(grain > 0 ? grain : 1)
+		, executors_(executors)
+		, next_(0)
+		, active_(1) // the caller
+	{}
+
+	//! claim [b, e), false when nothing is left
+	bool claim(size_t& b, size_t& e) {
+		size_t cur = next_.load(std::memory_order_relaxed);
+		size_t chunk;
+		do {
+			if (cur >= size_) { return false; }
+			chunk = std::max(grain_, (size_ - cur) / (2 * executors_));
+			chunk = std::min(chunk, size_ - cur);
+		} while (!next_.compare_exchange_weak(cur, cur + chunk, std::memory_order_relaxed));
+		b = cur;
+		e = cur + chunk;
+		return true;
+	}
+
+	//! a helper task joins unless the work is already done
+	bool join() {
+		int a = active_.load(std::memory_order_relaxed);
+		do {
+			if (a == 0) { return false; }
+		} while (!active_.compare_exchange_weak(a, a + 1, std::memory_order_acquire));
+		return true;
+	}
+
+	void leave() {
+		if (active_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			done_.notifyAll();
+		}
+	}
+
+	//! the caller leaves and waits for the helpers that joined
+	void leaveAndWait() {
+		leave();
+		while (active_.load(std::memory_order_acquire) != 0) {
+			uint32_t key = done_.prepareWait();
+			if (active_.load(std::memory_order_acquire) == 0) {
+				done_.cancelWait();
+				break;
+			}
+			done_.wait(key);
+		}
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+
+	void fail(std::exception_ptr error) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!error_) { error_ = error; }
+		next_.store(size_, std::memory_order_relaxed);
+	}
+
+	size_t executors() const { return executors_; }
+
+private:
+	const size_t size_;
+	const size_t grain_;
+	const size_t executors_;
+	std::atomic<size_t> next_;
+	std::atomic<int> active_;
+	EventCount done_;
+	std::mutex mutex_;
+	std::exception_ptr error_;
+};
+
+//! run body(b, e) over claimed chunks of [0, size) on the caller and pool helpers
+template <typename Body>
+void parallelChunks(ThreadPool& pool, size_t size, size_t grain, Body body) {
+	if (size == 0) { return; }
+	size_t chunks = (size + grain - 1) / (grain > 0 ? grain : 1);
+	size_t helpers = std::min(pool.threadCount(), chunks - 1);
+	if (helpers == 0) {
+		body(0, size);
+		return;
+	}
+
+	auto range = std::make_shared<ParallelRange>(size, grain, helpers + 1);
+	auto work = [range, &body]() {
+		size_t b, e;
+		try {
+			while (range->claim(b, e)) {
+				body(b, e);
+			}
+		} catch (...) {
+			range->fail(std::current_exception());
+		}
+	};
+	for (size_t i = 0; i < helpers; i++) {
+		// body and work live on the caller's stack until every joined helper left
+		pool.run([range, &work]() {
+			if (range->join()) {
+				work();
+				range->leave();
+			}
+		});
+	}
+	work();
+	range->leaveAndWait();
+}
+
+} // namespace detail
+
+//! fn(i) for every i in [begin, end), at least grain consecutive indexes per task
+template <typename Index, typename F>
+void parallel_for(ThreadPool& pool, Index begin, Index end, Index grain, F fn) {
+	static_assert(std::is_integral<Index>::value, "Index must be integral");
+	if (!(begin < end)) { return; }
+	detail::parallelChunks(pool, static_cast<size_t>(end - begin), static_cast<size_t>(grain), [begin, &fn](size_t b, size_t e) {
+		for (size_t i = b; i < e; i++) {
+			fn(static_cast<Index>(begin + static_cast<Index>(i)));
+		}
+	});
+}
+
+/**
+* @brief reduce(... reduce(identity, map(b0, e0, identity)) ...) over chunks [b, e) of [begin, end)
+* map(b, e, init) folds a chunk starting from init, reduce(a, b) combines two partial results.
+* The order partial results are combined in is unspecified, so reduce must be associative and commutative.
+*/
+template <typename Index, typename T, typename Map, typename Reduce>
+T parallel_reduce(ThreadPool& pool, Index begin, Index end, Index grain, T identity, Map map, Reduce reduce) {
+	static_assert(std::is_integral<Index>::value, "Index must be integral");
+	if (!(begin < end)) { return identity; }
+	std::mutex mutex;
+	T result = identity;
+	detail::parallelChunks(pool, static_cast<size_t>(end - begin), static_cast<size_t>(grain), [&](size_t b, size_t e) {
+		T partial = map(static_cast<Index>(begin + static_cast<Index>(b)), static_cast<Index>(begin + static_cast<Index>(e)), identity);
+		// guided chunks are few, O(executors * log(size / grain)), so one lock each is cheap
+		std::lock_guard<std::mutex> lock(mutex);
+		result = reduce(std::move(result), std::move(partial));
+	});
+	return result;
+}
+
+/**
+* @brief sort [first, last) by comp, not stable
+* blocks of at least grain elements are std::sort()ed in parallel,
+* then merged pairwise with std::inplace_merge, one parallel round per level.
+*/
+template <typename RandomIt, typename Compare>
+void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp, size_t grain = 1 << 14) {
+	size_t n = static_cast<size_t>(last - first);
+	size_t executors = pool.threadCount() + 1;
+	if (grain == 0) { grain = 1; }
+	if (n <= grain || executors == 1) {
+		std::sort(first, last, comp);
+		return;
+	}
+
+	size_t blocks = std::min(executors * 2, (n + grain - 1) / grain);
+	std::vector<size_t> bounds(blocks + 1);
+	for (size_t i = 0; i <= blocks; i++) {
+		bounds[i] = n * i / blocks;
+	}
+	parallel_for(pool, size_t(0), blocks, size_t(1), [&](size_t i) {
+		std::sort(first + bounds[i], first + bounds[i + 1], comp);
+	});
+	for (size_t width = 1; width < blocks; width *= 2) {
+		size_t pairs = (blocks + 2 * width - 1) / (2 * width);
+		parallel_for(pool, size_t(0), pairs, size_t(1), [&](size_t p) {
+			size_t lo = p * 2 * width;
+			size_t mid = std::min(lo + width, blocks);
+			size_t hi = std::min(lo + 2 * width, blocks);
+			if (mid < hi) {
+				std::inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], comp);
+			}
+		});
+	}
+}
+
+template <typename RandomIt>
+void parallel_sort(ThreadPool& pool, RandomIt first, RandomIt last) {
+	parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+} // namespace jlib
@@ -3,17 +3,21 @@
 #include "config.h"
 #include <stdint.h>
 
+#ifdef JLIB_WINDOWS
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
 namespace jlib
 {
 
 #ifdef JLIB_WINDOWS
-#include <Windows.h>
 inline uint64_t getPid() {
 	return GetCurrentProcessId();
 }
 #else
-#include <sys/types.h>
-#include <unistd.h>
 inline uint64_t getPid() {
 	return ::getpid();
 }
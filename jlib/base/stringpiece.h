@@ -1,3 +1,5 @@
+#pragma once
+
 // Taken from PCRE pcre_stringpiece.h
 //
 // Copyright (c) 2005, Google Inc.
@@ -0,0 +1,228 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "futex.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define JLIB_HAS_MM_PAUSE
+#endif
+
+namespace jlib
+{
+
+namespace detail
+{
+
+//! a hint in spin loops, lets the sibling hyperthread run
+inline void cpuRelax() {
+#ifdef JLIB_HAS_MM_PAUSE
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+/**
+* @brief how long to spin before parking, learned from recent waits like glibc's adaptive mutex
+* a wait that ended while spinning pulls the limit towards twice its length, one that had to park
+* shrinks it by 1/8. Never spins on a single cpu, the thread we wait for cannot run meanwhile.
+*/
+class AdaptiveSpin : noncopyable
+{
+public:
+	enum { MIN_SPINS = 16, MAX_SPINS = 4096, INITIAL_SPINS = 128 };
+
+	AdaptiveSpin() : limit_(INITIAL_SPINS) {}
+
+	//! spin until done() or the limit, true if done() became true
+	template <typename Pred>
+	bool spin(Pred done) {
+		static const bool multiCore = std::thread::hardware_concurrency() > 1;
+		if (!multiCore) {
+			return done();
+		}
+		int32_t limit = limit_.load(std::memory_order_relaxed);
+		for (int32_t i = 0; i < limit; i++) {
+			if (done()) {
+				int32_t target = std::min<int32_t>(std::max<int32_t>(2 * i, MIN_SPINS), MAX_SPINS);
+				limit_.store(limit + (target - limit) / 8, std::memory_order_relaxed);
+				return true;
+			}
+			cpuRelax();
+		}
+		limit_.store(std::max<int32_t>(limit - limit / 8, MIN_SPINS), std::memory_order_relaxed);
+		return done();
+	}
+
+	int32_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int32_t> limit_;
+};
+
+} // namespace detail
+
+/**
+* @brief CountDownLatch without a mutex: countDown() is one fetch_sub, wait() on an open latch one load
+* the count and a "someone parked" bit share the futex word, so countDown() knows whether to wake
+* from its own RMW and never touches the latch afterwards; a waiter may destroy it as soon as it returns.
+*/
+class Latch : noncopyable
+{
+public:
+	explicit Latch(int count) : word_(static_cast<uint32_t>(count) << 1) {}
+
+	void countDown() {
+		uint32_t prev = word_.fetch_sub(2, std::memory_order_acq_rel);
+		if (countOf(prev) == 1 && (prev & PARKED)) {
+			detail::futexWakeAll(&word_);
+		}
+	}
+
+	//! true if the count is 0 (or below), no waiting
+	bool tryWait() const { return getCount() <= 0; }
+
+	void wait() {
+		if (tryWait() || spin_.spin([this]() { return tryWait(); })) {
+			return;
+		}
+		uint32_t word = word_.load(std::memory_order_acquire);
+		while (countOf(word) > 0) {
+			if (!(word & PARKED) && !word_.compare_exchange_weak(word, word | PARKED, std::memory_order_acquire)) {
+				continue;
+			}
+			detail::futexWait(&word_, word | PARKED);
+			word = word_.load(std::memory_order_acquire);
+		}
+	}
+
+	int getCount() const { return countOf(word_.load(std::memory_order_acquire)); }
+
+private:
+	enum : uint32_t { PARKED = 1 };
+
+	//! the upper 31 bits as a signed count, countDown() past zero goes negative
+	static int countOf(uint32_t word) { return static_cast<int32_t>(word & ~static_cast<uint32_t>(PARKED)) / 2; }
+
+	std::atomic<uint32_t> word_;
+	detail::AdaptiveSpin spin_;
+};
+
+/**
+* @brief counting semaphore, acquire() is one compare-exchange while permits are left,
+* release() one fetch_add plus a load to see if anyone is parked.
+* like std::counting_semaphore it must outlive release() calls in progress.
+*/
+class Semaphore : noncopyable
+{
+public:
+	explicit Semaphore(int permits = 0) : permits_(static_cast<uint32_t>(permits)), waiters_(0) {
+		assert(permits >= 0);
+	}
+
+	bool tryAcquire() {
+		uint32_t permits = permits_.load(std::memory_order_relaxed);
+		while (permits > 0) {
+			if (permits_.compare_exchange_weak(permits, permits - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void acquire() {
+		if (tryAcquire() || spin_.spin([this]() { return tryAcquire(); })) {
+			return;
+		}
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+		for (;;) {
+			uint32_t permits = permits_.load(std::memory_order_seq_cst);
+			if (permits > 0) {
+				if (permits_.compare_exchange_weak(permits, permits - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+				continue;
+			}
+			detail::futexWait(&permits_, 0);
+		}
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void release(int n = 1) {
+		assert(n > 0);
+		permits_.fetch_add(static_cast<uint32_t>(n), std::memory_order_seq_cst);
+		if (waiters_.load(std::memory_order_seq_cst) > 0) {
+			if (n == 1) {
+				detail::futexWakeOne(&permits_);
+			} else {
+				detail::futexWakeAll(&permits_);
+			}
+		}
+	}
+
+	int available() const { return static_cast<int>(permits_.load(std::memory_order_relaxed)); }
+
+private:
+	std::atomic<uint32_t> permits_;
+	std::atomic<uint32_t> waiters_;
+	detail::AdaptiveSpin spin_;
+};
+
+/**
+* @brief reusable barrier for a fixed number of threads, like std::barrier::arrive_and_wait()
+* arriving is one fetch_add; the last thread of a phase also resets the count and swaps in the next
+* generation, which the others spin on, then park on. Generations step by 2, bit 0 marks parked threads.
+*/
+class Barrier : noncopyable
+{
+public:
+	explicit Barrier(int count) : count_(static_cast<uint32_t>(count)), arrived_(0), generation_(0) {
+		assert(count > 0);
+	}
+
+	//! true for the one thread that completed the phase
+	bool arriveAndWait() {
+		uint32_t generation = generation_.load(std::memory_order_acquire) & ~static_cast<uint32_t>(PARKED);
+		if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+			// nobody arrives for the next phase before seeing the new generation
+			arrived_.store(0, std::memory_order_relaxed);
+			if (generation_.exchange(generation + 2, std::memory_order_acq_rel) & PARKED) {
+				detail::futexWakeAll(&generation_);
+			}
+			return true;
+		}
+
+		auto passed = [this, generation]() { return (generation_.load(std::memory_order_acquire) & ~static_cast<uint32_t>(PARKED)) != generation; };
+		if (spin_.spin(passed)) {
+			return false;
+		}
+		uint32_t word = generation_.load(std::memory_order_acquire);
+		while ((word & ~static_cast<uint32_t>(PARKED)) == generation) {
+			if (!(word & PARKED) && !generation_.compare_exchange_weak(word, word | PARKED, std::memory_order_acquire)) {
+				continue;
+			}
+			detail::futexWait(&generation_, generation | PARKED);
+			word = generation_.load(std::memory_order_acquire);
+		}
+		return false;
+	}
+
+	int count() const { return static_cast<int>(count_); }
+
+private:
+	enum : uint32_t { PARKED = 1 };
+
+	const uint32_t count_;
+	std::atomic<uint32_t> arrived_;
+	std::atomic<uint32_t> generation_;
+	detail::AdaptiveSpin spin_;
+};
+
+} // namespace jlib
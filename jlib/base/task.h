@@ -0,0 +1,150 @@
+﻿#pragma once
+
+#include "config.h"
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief move-only void() callable with inline storage, the task type of ThreadPool
+* callables up to INLINE_SIZE bytes that are nothrow move constructible live inside the Task,
+* larger ones are heap allocated once. Unlike std::function it accepts move-only callables
+* such as std::packaged_task or lambdas capturing std::unique_ptr, and is never copied.
+*/
+class Task
+{
+public:
+	enum { INLINE_SIZE = 48 };
+
+	Task() noexcept : ops_(nullptr) {}
+	Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+	template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+	Task(F&& f) : ops_(nullptr) {
+		typedef typename std::decay<F>::type Fn;
+		if (!isNull(f)) {
+			init<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
+		}
+	}
+
+	Task(Task&& rhs) noexcept : ops_(rhs.ops_) {
+		if (ops_) {
+			ops_->move(&storage_, &rhs.storage_);
+			rhs.ops_ = nullptr;
+		}
+	}
+
+	Task& operator=(Task&& rhs) noexcept {
+		if (this != &rhs) {
+			reset();
+			if (rhs.ops_) {
+				rhs.ops_->move(&storage_, &rhs.storage_);
+				ops_ = rhs.ops_;
+				rhs.ops_ = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	Task& operator=(std::nullptr_t) noexcept {
+		reset();
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task() { reset(); }
+
+	void operator()() {
+		assert(ops_);
+		ops_->invoke(&storage_);
+	}
+
+	explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+	//! false if the callable was too big or not nothrow movable and lives on the heap
+	bool isInline() const noexcept { return ops_ != nullptr && ops_->inlined; }
+
+	//! whether a callable of type F is stored without allocation
+	template <typename F>
+	static constexpr bool fitsInline() {
+		return sizeof(F) <= INLINE_SIZE
+			&& alignof(F) <= alignof(Storage)
+			&& std::is_nothrow_move_constructible<F>::value;
+	}
+
+private:
+	typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+	struct Ops {
+		void (*invoke)(void* storage);
+		//! move construct dst from src and destroy src
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* storage);
+		bool inlined;
+	};
+
+	template <typename F>
+	struct InlineOps {
+		static void invoke(void* s) { (*static_cast<F*>(s))(); }
+		static void move(void* dst, void* src) {
+			::new (dst) F(std::move(*static_cast<F*>(src)));
+			static_cast<F*>(src)->~F();
+		}
+		static void destroy(void* s) { static_cast<F*>(s)->~F(); }
+		static const Ops* ops() {
+			static const Ops ops = { &invoke, &move, &destroy, true };
+			return &ops;
+		}
+	};
+
+	template <typename F>
+	struct HeapOps {
+		static void invoke(void* s) { (**static_cast<F**>(s))(); }
+		static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+		static void destroy(void* s) { delete *static_cast<F**>(s); }
+		static const Ops* ops() {
+			static const Ops ops = { &invoke, &move, &destroy, false };
+			return &ops;
+		}
+	};
+
+	template <typename Fn, typename F>
+	void init(F&& f, std::true_type /*inline*/) {
+		::new (&storage_) Fn(std::forward<F>(f));
+		ops_ = InlineOps<Fn>::ops();
+	}
+
+	template <typename Fn, typename F>
+	void init(F&& f, std::false_type /*inline*/) {
+		*reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+		ops_ = HeapOps<Fn>::ops();
+	}
+
+	// an empty std::function or a null function pointer makes an empty Task, as with std::function
+	template <typename F>
+	static bool isNull(const F&) { return false; }
+	template <typename R, typename... Args>
+	static bool isNull(R (*f)(Args...)) { return f == nullptr; }
+	template <typename Sig>
+	static bool isNull(const std::function<Sig>& f) { return !f; }
+
+	void reset() noexcept {
+		if (ops_) {
+			ops_->destroy(&storage_);
+			ops_ = nullptr;
+		}
+	}
+
+	Storage storage_;
+	const Ops* ops_;
+};
+
+} // namespace jlib
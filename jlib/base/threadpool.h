@@ -2,24 +2,238 @@
 
 #include "config.h"
 #include "noncopyable.h"
+#include "workstealingdeque.h"
+#include "task.h"
+#include "mpmcqueue.h"
+#include "timerqueue.h"
+#include "currentthread.h"
+#include "histogram.h"
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <algorithm>
 #include <functional>
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <memory>
 #include <vector>
 #include <deque>
 #include <string>
+#include <unordered_map>
 #include <exception>
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#ifdef JLIB_WINDOWS
+#include <intrin.h>
+#endif
 
 namespace jlib
 {
 
+namespace detail
+{
+
+//! the pool and worker index of the current thread, set in ThreadPool worker threads only
+thread_local const void* t_threadPool = nullptr;
+thread_local size_t t_threadPoolWorker = 0;
+
+//! f(args...) with the arguments moved in, so move-only arguments work
+template <typename F, typename... Args>
+class BoundCall
+{
+public:
+	typedef decltype(std::declval<F>()(std::declval<Args>()...)) Result;
+
+	template <typename G, typename... A>
+	explicit BoundCall(G&& f, A&&... args) : f_(std::forward<G>(f)), args_(std::forward<A>(args)...) {}
+
+	Result operator()() { return call(std::index_sequence_for<Args...>()); }
+
+private:
+	template <size_t... I>
+	Result call(std::index_sequence<I...>) { return f_(std::move(std::get<I>(args_))...); }
+
+	F f_;
+	std::tuple<Args...> args_;
+};
+
+//! index of the highest set bit, x != 0
+inline int highestBit(uint32_t x) {
+#ifdef JLIB_WINDOWS
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return static_cast<int>(index);
+#else
+	return 31 - __builtin_clz(x);
+#endif
+}
+
+//! a task and when it was queued, the time is left zero where nothing needs it
+struct QueuedTask {
+	Task task;
+	std::chrono::steady_clock::time_point enqueued;
+};
+
+//! written by one worker only, merged by ThreadPool::stats()
+struct WorkerMetrics : noncopyable {
+	//! enqueue to start
+	HistogramCounters queueWait;
+	//! its sum is the busy time
+	HistogramCounters execution;
+};
+
+/**
+* @brief one FIFO per priority level and a bitmap of the non-empty ones, not thread safe
+* pop() takes the front of the highest non-empty level in O(1), unless aging applies:
+* a front that waited n aging intervals competes as if it were n levels higher.
+*/
+class PriorityTaskQueue : noncopyable
+{
+public:
+	enum { LEVELS = 8 };
+	typedef std::chrono::steady_clock Clock;
+
+	typedef QueuedTask Entry;
+
+	PriorityTaskQueue() : bitmap_(0), size_(0) {}
+
+	void push(Task&& task, int priority) {
+		priority = std::min(std::max(priority, 0), static_cast<int>(LEVELS) - 1);
+		queues_[priority].push_back(Entry{ std::move(task), Clock::now() });
+		bitmap_ |= 1u << priority;
+		size_++;
+	}
+
+	//! the queue must not be empty
+	Entry pop(Clock::duration agingInterval) {
+		assert(size_ > 0);
+		int level = highestBit(bitmap_);
+		uint32_t lower = bitmap_ & ((1u << level) - 1);
+		if (lower && agingInterval > Clock::duration::zero()) {
+			auto now = Clock::now();
+			auto best = level * agingInterval + (now - queues_[level].front().enqueued);
+			for (; lower; lower &= lower - 1) {
+				int l = highestBit(lower & (~lower + 1)); // lowest set bit
+				auto score = l * agingInterval + (now - queues_[l].front().enqueued);
+				if (score > best) {
+					best = score;
+					level = l;
+				}
+			}
+		}
+
+		auto& queue = queues_[level];
+		Entry entry = std::move(queue.front());
+		queue.pop_front();
+		if (queue.empty()) {
+			bitmap_ &= ~(1u << level);
+		}
+		size_--;
+		return entry;
+	}
+
+	//! enqueue time of the longest waiting entry, the queue must not be empty
+	Clock::time_point oldest() const {
+		assert(size_ > 0);
+		Clock::time_point t = Clock::time_point::max();
+		for (uint32_t bits = bitmap_; bits; bits &= bits - 1) {
+			t = std::min(t, queues_[highestBit(bits & (~bits + 1))].front().enqueued);
+		}
+		return t;
+	}
+
+	bool empty() const { return size_ == 0; }
+	size_t size() const { return size_; }
+	//! bit n is set if level n is not empty
+	uint32_t levels() const { return bitmap_; }
+
+private:
+	std::deque<Entry> queues_[LEVELS];
+	uint32_t bitmap_;
+	size_t size_;
+};
+
+} // namespace detail
+
 class ThreadPool : noncopyable
 {
 public:
-	typedef std::function<void()> Task;
+	typedef jlib::Task Task;
+	typedef std::function<void()> ThreadInitCallback;
+
+	enum Mode {
+		//! one FIFO queue behind one mutex
+		SHARED_QUEUE,
+		//! per-worker Chase-Lev deques for tasks run() by workers,
+		//! the shared queue becomes the injection queue for tasks from other threads,
+		//! idle workers steal from random victims
+		WORK_STEALING,
+		//! one lock-free BoundedMpmcQueue, bounded by setMaxQueueSize() or DEFAULT_LOCK_FREE_QUEUE_SIZE,
+		//! threads park only while it is empty or full
+		LOCK_FREE_QUEUE,
+	};
+
+	enum { DEFAULT_LOCK_FREE_QUEUE_SIZE = 65536 };
+
+	//! run(task, priority) takes 0, the default and lowest, to PRIORITY_LEVELS - 1, the highest
+	enum { PRIORITY_LEVELS = detail::PriorityTaskQueue::LEVELS };
+
+	//! a worker as seen by threadStats()
+	struct ThreadStats {
+		//! the pool name and a 1-based index, e.g. "ThreadPool3"
+		std::string name;
+		uint64_t tid;
+		//! CPU time consumed so far, CLOCK_THREAD_CPUTIME_ID on linux
+		std::chrono::nanoseconds cpuTime;
+		//! since the worker started
+		std::chrono::nanoseconds lifetime;
+		//! tasks run and the time spent running them, zero unless metrics are enabled
+		uint64_t tasks;
+		std::chrono::nanoseconds busyTime;
+
+		//! busy / lifetime, the rest of the time the worker was idle or looking for work
+		double busyRatio() const {
+			return lifetime.count() > 0 ? static_cast<double>(busyTime.count()) / lifetime.count() : 0.0;
+		}
+	};
+
+	//! a snapshot by stats(), histograms are in nanoseconds and cover every task since start()
+	struct Stats {
+		std::string name;
+		//! enqueue to start, not measured for tasks run inline by a pool without threads
+		Histogram queueWait;
+		Histogram execution;
+		size_t queueSize;
+		//! most tasks seen queued by a run(), per deque in WORK_STEALING, approximate in LOCK_FREE_QUEUE
+		size_t peakQueueSize;
+		//! run() calls that blocked on a full queue
+		uint64_t blockedPushes;
+		std::vector<ThreadStats> threads;
+
+		std::string toString() const {
+			std::string str;
+			char buf[256];
+			snprintf(buf, sizeof(buf), "ThreadPool %s: queue %zu, peak %zu, blocked pushes %llu\n", name.c_str(),
+					 queueSize, peakQueueSize, static_cast<unsigned long long>(blockedPushes));
+			str += buf;
+			str += "  wait " + queueWait.toString() + "\n";
+			str += "  run  " + execution.toString() + "\n";
+			for (auto& t : threads) {
+				snprintf(buf, sizeof(buf), "  %s tid %llu: %llu tasks, busy %.1f%%, cpu %.3fs\n", t.name.c_str(),
+						 static_cast<unsigned long long>(t.tid), static_cast<unsigned long long>(t.tasks),
+						 t.busyRatio() * 100, t.cpuTime.count() / 1e9);
+				str += buf;
+			}
+			return str;
+		}
+	};
+
+	typedef std::function<void(const Stats&)> StatsCallback;
 
 	explicit ThreadPool(const std::string& name = "ThreadPool")
 		: mutex_()
@@ -27,7 +241,28 @@ public:
 		, notFull_()
 		, name_(name)
 		, maxQueueSize_(0)
+		, mode_(SHARED_QUEUE)
 		, running_(false)
+		, idleWorkers_(0)
+		, agingInterval_(std::chrono::milliseconds(100))
+		, pendingLevels_(0)
+		, minThreads_(0)
+		, maxThreads_(0)
+		, elastic_(false)
+		, liveThreads_(0)
+		, waitingThreads_(0)
+		, peakThreads_(0)
+		, threadsStarted_(0)
+		, threadsRetired_(0)
+		, growQueueDepth_(16)
+		, growQueueWait_(std::chrono::milliseconds(10))
+		, idleTimeout_(std::chrono::seconds(30))
+		, onePerCpu_(false)
+		, metrics_(false)
+		, peakQueueSize_(0)
+		, blockedPushes_(0)
+		, statsInterval_(0)
+		, timers_([this](Task&& task) { run(std::move(task)); }, name + "-timer")
 	{}
 
 	~ThreadPool() {
@@ -39,88 +274,334 @@ public:
 	//! must be called before start()
 	void setMaxQueueSize(size_t size) { maxQueueSize_ = size; }
 	//! must be called before start()
-	void setThreadInitCallback(const Task& cb) { threadInitCallback_ = cb; }
+	void setThreadInitCallback(const ThreadInitCallback& cb) { threadInitCallback_ = cb; }
+	//! must be called before start()
+	void setMode(Mode mode) { mode_ = mode; }
+	Mode mode() const { return mode_; }
+	/**
+	* @brief must be called before start(), a queued task gains one priority level per interval it waits
+	* so bulk work still progresses under a steady stream of urgent tasks, zero disables aging, default 100ms.
+	*/
+	void setAgingInterval(std::chrono::steady_clock::duration interval) { agingInterval_ = interval; }
+
+	/**
+	* @brief must be called before start(minThreads, maxThreads), when an elastic pool adds a worker
+	* a worker is added while none is idle and the queue holds more than queueDepth tasks or a task waited
+	* at least queueWait, and no sooner than queueWait after the previous resize. Defaults 16 and 10ms.
+	*/
+	void setGrowThreshold(size_t queueDepth, std::chrono::steady_clock::duration queueWait) {
+		growQueueDepth_ = queueDepth;
+		growQueueWait_ = queueWait;
+	}
+
+	/**
+	* @brief must be called before start(), pin workers to cpus
+	* every worker may run on any cpu of the set, or with onePerCpu worker n runs on cpus[n % cpus.size()] only.
+	*/
+	void setCpuAffinity(const std::vector<int>& cpus, bool onePerCpu = false) {
+		cpus_ = cpus;
+		onePerCpu_ = onePerCpu;
+	}
+
+	/**
+	* @brief must be called before start(), time every task for stats()
+	* costs two or three steady_clock reads per task, recorded in per-worker counters without locks.
+	*/
+	void setMetricsEnabled(bool on) { metrics_ = on; }
+	bool metricsEnabled() const { return metrics_; }
+
+	//! must be called before start(), enables metrics and passes stats() to cb every interval, stderr if cb is empty
+	void setStatsLog(std::chrono::steady_clock::duration interval, StatsCallback cb = StatsCallback()) {
+		metrics_ = true;
+		statsInterval_ = interval;
+		statsCallback_ = std::move(cb);
+	}
+
+	//! must be called before start(minThreads, maxThreads), workers above minThreads idle this long retire, default 30s
+	void setIdleTimeout(std::chrono::steady_clock::duration timeout) { idleTimeout_ = timeout; }
 
 	void start(int nThreads) {
 		assert(threads_.empty());
 		running_ = true;
+		minThreads_ = maxThreads_ = peakThreads_ = nThreads;
+		liveThreads_ = nThreads;
+		threadsStarted_ = static_cast<size_t>(nThreads);
+		if (mode_ == WORK_STEALING) {
+			for (int i = 0; i < nThreads; i++) {
+				workers_.emplace_back(new Worker(i));
+			}
+		} else if (mode_ == LOCK_FREE_QUEUE) {
+			lockFreeQueue_.reset(new BoundedMpmcQueue<detail::QueuedTask>(maxQueueSize_ > 0 ? maxQueueSize_ : static_cast<size_t>(DEFAULT_LOCK_FREE_QUEUE_SIZE)));
+		}
 		for (int i = 0; i < nThreads; i++) {
-			threads_.emplace_back(std::thread(std::bind(&ThreadPool::runInThread, this)));
+			threads_.emplace_back(std::thread(std::bind(&ThreadPool::runInThread, this, i)));
 		}
 		if (nThreads == 0 && threadInitCallback_) {
 			threadInitCallback_();
 		}
+		startStatsLog();
+	}
+
+	/**
+	* @brief elastic pool of minThreads to maxThreads workers, SHARED_QUEUE mode only
+	* workers are added as the queue backs up, see setGrowThreshold(), and retire after setIdleTimeout().
+	* with minThreads 0 the first task starts a worker.
+	*/
+	void start(int minThreads, int maxThreads) {
+		assert(threads_.empty());
+		assert(mode_ == SHARED_QUEUE);
+		assert(0 <= minThreads && minThreads <= maxThreads && maxThreads > 0);
+		running_ = true;
+		elastic_ = true;
+		minThreads_ = minThreads;
+		maxThreads_ = maxThreads;
+		std::lock_guard<std::mutex> lock(mutex_);
+		lastResize_ = std::chrono::steady_clock::now();
+		for (int i = 0; i < minThreads; i++) {
+			addThread();
+		}
+		startStatsLog();
 	}
 
 	void stop() {
+		timers_.stop();
 		{
 			std::lock_guard<std::mutex> lock(mutex_);
 			running_ = false;
 		}
 
 		notEmpty_.notify_all();
+		if (lockFreeQueue_) {
+			lockFreeQueue_->close();
+		}
 
+		// workers neither retire nor get added once running_ is false
 		for (auto& t : threads_) {
 			t.join();
 		}
+		for (auto& t : retiredThreads_) {
+			t.join();
+		}
+		retiredThreads_.clear();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (auto& kv : threadInfo_) {
+				retireMetrics(kv.second);
+			}
+			threadInfo_.clear();
+		}
+
+		// tasks left in worker deques are dropped, like those left in the queue
+		detail::QueuedTask* task = nullptr;
+		for (auto& w : workers_) {
+			while (w->deque.pop(task)) { delete task; }
+		}
 	}
 
 	const std::string& name() const { return name_; }
 
+	//! number of worker threads, varies between minThreads() and maxThreads() in an elastic pool
+	size_t threadCount() const { return static_cast<size_t>(liveThreads_.load(std::memory_order_relaxed)); }
+	size_t minThreads() const { return static_cast<size_t>(minThreads_); }
+	size_t maxThreads() const { return static_cast<size_t>(maxThreads_); }
+	bool elastic() const { return elastic_; }
+
+	//! name, tid and CPU time of each live worker, not to be called concurrently with stop()
+	std::vector<ThreadStats> threadStats() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return threadStatsLocked();
+	}
+
+	//! metrics of all workers merged, including retired ones, see setMetricsEnabled()
+	Stats stats() const {
+		Stats stats;
+		stats.name = name_;
+		stats.queueSize = queueSize();
+		stats.peakQueueSize = peakQueueSize_.load(std::memory_order_relaxed);
+		stats.blockedPushes = blockedPushes_.load(std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats.queueWait = retiredQueueWait_;
+		stats.execution = retiredExecution_;
+		for (auto& kv : threadInfo_) {
+			if (kv.second.metrics) {
+				kv.second.metrics->queueWait.mergeInto(stats.queueWait);
+				kv.second.metrics->execution.mergeInto(stats.execution);
+			}
+		}
+		stats.threads = threadStatsLocked();
+		return stats;
+	}
+
+	//! SHARED_QUEUE workers blocked waiting for a task
+	size_t idleThreadCount() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return static_cast<size_t>(waitingThreads_);
+	}
+
+	//! most workers alive at once
+	size_t peakThreadCount() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return static_cast<size_t>(peakThreads_);
+	}
+
+	//! workers started since start(), including the initial ones
+	size_t threadsStarted() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return threadsStarted_;
+	}
+
+	//! workers retired after idling setIdleTimeout()
+	size_t threadsRetired() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return threadsRetired_;
+	}
+
 	size_t queueSize() const {
+		size_t size = 0;
+		for (auto& w : workers_) {
+			size += static_cast<size_t>(w->deque.size());
+		}
+		if (lockFreeQueue_) {
+			size += lockFreeQueue_->size();
+		}
 		std::lock_guard<std::mutex> lock(mutex_);
-		return taskQueue_.size();
+		return size + taskQueue_.size();
 	}
 
-	void run(Task task) {
-		if (threads_.empty()) {
-			task();
+	/**
+	* @brief queue task, or call it now if the pool has no threads
+	* higher priorities run first, see PRIORITY_LEVELS and setAgingInterval().
+	* LOCK_FREE_QUEUE ignores priority. In WORK_STEALING a prioritized task goes through the shared queue,
+	* which workers check before their own deque whenever it holds one.
+	*/
+	void run(Task task, int priority = 0) {
+		if (maxThreads_ == 0) {
+			if (task) { task(); }
+		} else if (mode_ == WORK_STEALING && detail::t_threadPool == this && priority <= 0) {
+			auto& deque = workers_[detail::t_threadPoolWorker]->deque;
+			deque.push(new detail::QueuedTask{ std::move(task), metrics_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point() });
+			if (metrics_) {
+				updatePeakQueueSize(static_cast<size_t>(deque.size()));
+			}
+			// pairs with the fence in park(), either we see the idle worker or it sees the task
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (idleWorkers_.load(std::memory_order_relaxed) > 0) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				notEmpty_.notify_one();
+			}
+		} else if (mode_ == LOCK_FREE_QUEUE) {
+			detail::QueuedTask entry{ std::move(task), metrics_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point() };
+			if (!lockFreeQueue_->tryPush(std::move(entry))) {
+				blockedPushes_.fetch_add(1, std::memory_order_relaxed);
+				lockFreeQueue_->push(std::move(entry));
+			}
+			if (metrics_) {
+				updatePeakQueueSize(lockFreeQueue_->size());
+			}
 		} else {
-			{
-				std::unique_lock<std::mutex> lock(mutex_);
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (isFull()) {
+				blockedPushes_.fetch_add(1, std::memory_order_relaxed);
 				notFull_.wait(lock, [this]() { return !isFull(); });
 			}
-
-			std::lock_guard<std::mutex> lock(mutex_);
-			assert(!isFull());
-			taskQueue_.emplace_back(std::move(task));			
+			taskQueue_.push(std::move(task), priority);
+			pendingLevels_.store(taskQueue_.levels(), std::memory_order_relaxed);
+			if (metrics_) {
+				updatePeakQueueSize(taskQueue_.size());
+			}
 			notEmpty_.notify_one();
+			if (elastic_) {
+				growIfBacklogged(std::chrono::steady_clock::now() - taskQueue_.oldest());
+			}
 		}
 	}
 
+	/**
+	* @brief run f(args...) in the pool, the result or exception is delivered through the future
+	* f and args are moved into the task, so both may be move-only; the arguments are passed as rvalues.
+	*/
+	template <typename F, typename... Args>
+	std::future<typename detail::BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...>::Result>
+	submit(F&& f, Args&&... args) {
+		typedef detail::BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...> Call;
+		std::packaged_task<typename Call::Result()> task(Call(std::forward<F>(f), std::forward<Args>(args)...));
+		auto future = task.get_future();
+		run(std::move(task));
+		return future;
+	}
+
+	/**
+	* @brief run cb in the pool at when, steady_clock or any other clock such as Timestamp
+	* a dedicated timer thread hands due callbacks to run(), see TimerQueue. Timers are dropped by stop().
+	*/
+	template <typename C, typename D>
+	TimerId runAt(std::chrono::time_point<C, D> when, Task cb) { return timers_.runAt(when, std::move(cb)); }
+
+	template <typename Rep, typename Period>
+	TimerId runAfter(std::chrono::duration<Rep, Period> delay, Task cb) { return timers_.runAfter(delay, std::move(cb)); }
+
+	//! fixed rate, a tick is skipped while the previous run of cb is still busy
+	template <typename Rep, typename Period>
+	TimerId runEvery(std::chrono::duration<Rep, Period> interval, Task cb) { return timers_.runEvery(interval, std::move(cb)); }
+
+	//! false if the timer already fired, was cancelled or is unknown; a run in progress is not interrupted
+	bool cancel(TimerId timerId) { return timers_.cancel(timerId); }
+
+	//! number of pending timers
+	size_t timerCount() const { return timers_.size(); }
+
 protected:
 	bool isFull() const {
 		return maxQueueSize_ > 0 && taskQueue_.size() >= maxQueueSize_;
 	}
 
-	Task take() {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			notEmpty_.wait(lock, [this]() { return !(taskQueue_.empty() && running_); });
+	//! false if this worker retires from an elastic pool
+	bool take(detail::QueuedTask& entry) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (taskQueue_.empty() && running_) {
+			waitingThreads_++;
+			bool timedOut = false;
+			if (elastic_) {
+				timedOut = notEmpty_.wait_for(lock, idleTimeout_) == std::cv_status::timeout;
+			} else {
+				notEmpty_.wait(lock);
+			}
+			waitingThreads_--;
+			if (timedOut && taskQueue_.empty() && running_ && liveThreads_ > minThreads_) {
+				retireThread();
+				return false;
+			}
 		}
-		
-		std::lock_guard<std::mutex> lock(mutex_);
-		Task task;
 		if (!taskQueue_.empty()) {
-			task = taskQueue_.front();
-			taskQueue_.pop_front();
+			entry = popQueued();
 			if (maxQueueSize_ > 0) {
 				notFull_.notify_one();
 			}
+			if (elastic_ && !taskQueue_.empty()) {
+				growIfBacklogged(std::chrono::steady_clock::now() - entry.enqueued);
+			}
 		}
-		return task;
+		return true;
 	}
 
-	void runInThread() {
+	void runInThread(int index) {
 		try {
+			detail::t_threadPool = this;
+			detail::t_threadPoolWorker = static_cast<size_t>(index);
+			detail::WorkerMetrics* metrics = initThread(index);
 			if (threadInitCallback_) {
 				threadInitCallback_();
 			}
 
-			while (running_) {
-				Task task(take());
-				if (task) {
-					task();
+			if (mode_ == WORK_STEALING) {
+				runWorkStealing(*workers_[index], metrics);
+			} else {
+				detail::QueuedTask entry;
+				while (running_ && (mode_ == LOCK_FREE_QUEUE ? lockFreeQueue_->pop(entry) : take(entry))) {
+					if (entry.task) {
+						runTask(entry, metrics);
+						entry.task = nullptr;
+					}
 				}
 			}
 		} catch (const std::exception & ex) {
@@ -134,15 +615,279 @@ protected:
 	}
 
 private:
+	struct Worker : noncopyable {
+		explicit Worker(int index) : rng(0x9E3779B97F4A7C15ULL * (index + 1)) {}
+
+		//! xorshift64, picks steal victims
+		size_t random() {
+			rng ^= rng << 13;
+			rng ^= rng >> 7;
+			rng ^= rng << 17;
+			return static_cast<size_t>(rng);
+		}
+
+		WorkStealingDeque<detail::QueuedTask*> deque;
+		uint64_t rng;
+	};
+
+	//! a started worker, with mutex_ held
+	struct ThreadInfo {
+		ThreadStats stats;
+		std::chrono::steady_clock::time_point started;
+		std::unique_ptr<detail::WorkerMetrics> metrics;
+	};
+
+	//! with metrics, time the task from its enqueue time, if recorded, to its end
+	static void runTask(detail::QueuedTask& entry, detail::WorkerMetrics* metrics) {
+		if (!metrics) {
+			entry.task();
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (entry.enqueued != std::chrono::steady_clock::time_point()) {
+			metrics->queueWait.add(start - entry.enqueued);
+		}
+		entry.task();
+		metrics->execution.add(std::chrono::steady_clock::now() - start);
+	}
+
+	void runWorkStealing(Worker& self, detail::WorkerMetrics* metrics) {
+		detail::QueuedTask* task = nullptr;
+		while (running_) {
+			bool urgent = pendingLevels_.load(std::memory_order_relaxed) > 1;
+			if ((urgent && takeInjected(self, task)) || self.deque.pop(task) || takeInjected(self, task) || steal(self, task)) {
+				std::unique_ptr<detail::QueuedTask> holder(task);
+				runTask(*task, metrics);
+			} else {
+				park();
+			}
+		}
+	}
+
+	//! move a fair share of the injection queue to our deque, return the first one
+	bool takeInjected(Worker& self, detail::QueuedTask*& task) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (taskQueue_.empty()) {
+			return false;
+		}
+		// prioritized tasks are taken one at a time, a batch would queue them behind our own deque
+		size_t n = taskQueue_.levels() > 1 ? 1 : std::min<size_t>(std::max<size_t>(taskQueue_.size() / workers_.size(), 1), 32);
+		task = new detail::QueuedTask(popQueued());
+		for (size_t i = 1; i < n; i++) {
+			self.deque.push(new detail::QueuedTask(popQueued()));
+		}
+		if (maxQueueSize_ > 0) {
+			notFull_.notify_all();
+		}
+		if (n > 1 && idleWorkers_.load(std::memory_order_relaxed) > 0) {
+			notEmpty_.notify_one();
+		}
+		return true;
+	}
+
+	//! with mutex_ held
+	detail::QueuedTask popQueued() {
+		auto entry = taskQueue_.pop(agingInterval_);
+		pendingLevels_.store(taskQueue_.levels(), std::memory_order_relaxed);
+		return entry;
+	}
+
+	//! with mutex_ held, keep the totals of a worker that leaves, stats() still covers its tasks
+	void retireMetrics(const ThreadInfo& info) {
+		if (info.metrics) {
+			info.metrics->queueWait.mergeInto(retiredQueueWait_);
+			info.metrics->execution.mergeInto(retiredExecution_);
+		}
+	}
+
+	void updatePeakQueueSize(size_t size) {
+		size_t peak = peakQueueSize_.load(std::memory_order_relaxed);
+		while (size > peak && !peakQueueSize_.compare_exchange_weak(peak, size, std::memory_order_relaxed)) {}
+	}
+
+	void startStatsLog() {
+		if (statsInterval_ > std::chrono::steady_clock::duration::zero()) {
+			timers_.runEvery(statsInterval_, [this]() {
+				Stats stats = this->stats();
+				if (statsCallback_) {
+					statsCallback_(stats);
+				} else {
+					fputs(stats.toString().c_str(), stderr);
+				}
+			});
+		}
+	}
+
+	//! with mutex_ held
+	std::vector<ThreadStats> threadStatsLocked() const {
+		std::vector<ThreadStats> stats;
+		stats.reserve(threads_.size());
+		auto now = std::chrono::steady_clock::now();
+		for (auto& t : threads_) {
+			auto it = threadInfo_.find(t.get_id());
+			if (it == threadInfo_.end()) { // not yet started
+				continue;
+			}
+			const ThreadInfo& info = it->second;
+			stats.push_back(info.stats);
+			ThreadStats& ts = stats.back();
+			ts.cpuTime = CurrentThread::detail::cpuTime(const_cast<std::thread&>(t).native_handle());
+			ts.lifetime = now - info.started;
+			if (info.metrics) {
+				ts.tasks = info.metrics->execution.count();
+				ts.busyTime = std::chrono::nanoseconds(info.metrics->execution.sum());
+			}
+		}
+		return stats;
+	}
+
+	//! name and pin the calling worker, before the ThreadInitCallback so it may override both
+	detail::WorkerMetrics* initThread(int index) {
+		ThreadInfo info;
+		ThreadStats& stats = info.stats;
+		stats.name = name_ + std::to_string(index + 1);
+		stats.tid = CurrentThread::tid();
+		stats.cpuTime = stats.lifetime = stats.busyTime = std::chrono::nanoseconds(0);
+		stats.tasks = 0;
+		info.started = std::chrono::steady_clock::now();
+		if (metrics_) {
+			info.metrics.reset(new detail::WorkerMetrics());
+		}
+		detail::WorkerMetrics* metrics = info.metrics.get();
+		CurrentThread::setName(stats.name.c_str());
+		if (!cpus_.empty()) {
+			if (onePerCpu_) {
+				CurrentThread::setAffinity({ cpus_[static_cast<size_t>(index) % cpus_.size()] });
+			} else {
+				CurrentThread::setAffinity(cpus_);
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		threadInfo_[std::this_thread::get_id()] = std::move(info);
+		return metrics;
+	}
+
+	//! with mutex_ held
+	void addThread() {
+		int live = liveThreads_.fetch_add(1, std::memory_order_relaxed) + 1;
+		peakThreads_ = std::max(peakThreads_, live);
+		threads_.emplace_back(std::thread(std::bind(&ThreadPool::runInThread, this, static_cast<int>(threadsStarted_++))));
+	}
+
+	/**
+	* @brief with mutex_ held, add a worker if the queue backs up while no worker is idle
+	* resizes are at least growQueueWait_ apart and retiring takes a whole idleTimeout_,
+	* so a pool hovering around a threshold does not keep starting and retiring threads.
+	*/
+	void growIfBacklogged(std::chrono::steady_clock::duration waited) {
+		int live = liveThreads_.load(std::memory_order_relaxed);
+		if (!running_ || live >= maxThreads_) {
+			return;
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (live > 0) {
+			if (waitingThreads_ > 0 || (taskQueue_.size() <= growQueueDepth_ && waited < growQueueWait_)) {
+				return;
+			}
+			if (now - lastResize_ < growQueueWait_) {
+				return;
+			}
+		}
+		lastResize_ = now;
+		for (auto& t : retiredThreads_) {
+			t.join(); // already past take(), returns promptly
+		}
+		retiredThreads_.clear();
+		addThread();
+	}
+
+	//! with mutex_ held, the calling worker leaves, its std::thread is joined later
+	void retireThread() {
+		auto id = std::this_thread::get_id();
+		auto it = std::find_if(threads_.begin(), threads_.end(), [id](const std::thread& t) { return t.get_id() == id; });
+		assert(it != threads_.end());
+		retiredThreads_.push_back(std::move(*it));
+		threads_.erase(it);
+		auto info = threadInfo_.find(id);
+		if (info != threadInfo_.end()) {
+			retireMetrics(info->second);
+			threadInfo_.erase(info);
+		}
+		liveThreads_.fetch_sub(1, std::memory_order_relaxed);
+		threadsRetired_++;
+		lastResize_ = std::chrono::steady_clock::now();
+	}
+
+	//! one pass over the other workers starting from a random one
+	bool steal(Worker& self, detail::QueuedTask*& task) {
+		size_t n = workers_.size();
+		size_t start = self.random() % n;
+		for (size_t i = 0; i < n; i++) {
+			Worker& victim = *workers_[(start + i) % n];
+			if (&victim != &self && victim.deque.steal(task)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void park() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		idleWorkers_.fetch_add(1, std::memory_order_seq_cst);
+		bool stealable = false;
+		for (auto& w : workers_) {
+			if (!w->deque.empty()) { stealable = true; break; }
+		}
+		if (running_ && taskQueue_.empty() && !stealable) {
+			notEmpty_.wait(lock);
+		}
+		idleWorkers_.fetch_sub(1, std::memory_order_relaxed);
+	}
+
 	mutable std::mutex mutex_;
 	std::condition_variable notEmpty_;
 	std::condition_variable notFull_;
 	std::string name_;
-	Task threadInitCallback_;
+	ThreadInitCallback threadInitCallback_;
 	std::vector<std::thread> threads_;
-	std::deque<Task> taskQueue_;
+	detail::PriorityTaskQueue taskQueue_;
 	size_t maxQueueSize_;
-	bool running_;
+	Mode mode_;
+	std::atomic<bool> running_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<int> idleWorkers_;
+	std::unique_ptr<BoundedMpmcQueue<detail::QueuedTask>> lockFreeQueue_;
+	std::chrono::steady_clock::duration agingInterval_;
+	//! taskQueue_.levels(), readable without the lock
+	std::atomic<uint32_t> pendingLevels_;
+	//! elastic sizing, maxThreads_ is 0 for a pool that runs tasks inline
+	int minThreads_;
+	int maxThreads_;
+	bool elastic_;
+	std::atomic<int> liveThreads_;
+	//! below with mutex_ held
+	int waitingThreads_;
+	int peakThreads_;
+	size_t threadsStarted_;
+	size_t threadsRetired_;
+	size_t growQueueDepth_;
+	std::chrono::steady_clock::duration growQueueWait_;
+	std::chrono::steady_clock::duration idleTimeout_;
+	std::chrono::steady_clock::time_point lastResize_;
+	std::vector<std::thread> retiredThreads_;
+	std::unordered_map<std::thread::id, ThreadInfo> threadInfo_;
+	std::vector<int> cpus_;
+	bool onePerCpu_;
+	bool metrics_;
+	std::atomic<size_t> peakQueueSize_;
+	std::atomic<uint64_t> blockedPushes_;
+	//! metrics of retired workers, with mutex_ held
+	Histogram retiredQueueWait_;
+	Histogram retiredExecution_;
+	std::chrono::steady_clock::duration statsInterval_;
+	StatsCallback statsCallback_;
+	//! last member, its thread calls run() and must be gone before the rest
+	TimerQueue timers_;
 
 
 };
@@ -0,0 +1,300 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include "task.h"
+#include "currentthread.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+//! identifies a timer for cancel(), default constructed means none
+class TimerId
+{
+public:
+	TimerId() : id_(0) {}
+	explicit TimerId(uint64_t id) : id_(id) {}
+
+	bool valid() const { return id_ != 0; }
+	uint64_t id() const { return id_; }
+
+private:
+	uint64_t id_;
+};
+
+namespace detail
+{
+
+struct Timer : noncopyable
+{
+	typedef std::chrono::steady_clock Clock;
+
+	//! periodic callbacks are shared by every run, a tick is skipped while the previous run is busy
+	struct Periodic {
+		explicit Periodic(Task&& t) : task(std::move(t)), busy(false) {}
+		Task task;
+		std::atomic<bool> busy;
+	};
+
+	Timer(uint64_t i, Clock::time_point w, Clock::duration iv, Task&& cb)
+		: id(i), when(w), interval(iv), heapIndex(0)
+	{
+		if (interval > Clock::duration::zero()) {
+			periodic = std::make_shared<Periodic>(std::move(cb));
+		} else {
+			callback = std::move(cb);
+		}
+	}
+
+	uint64_t id;
+	Clock::time_point when;
+	Clock::duration interval;
+	Task callback;
+	std::shared_ptr<Periodic> periodic;
+	size_t heapIndex;
+};
+
+/**
+* @brief 4-ary min heap of timers by (when, id), each timer knows its index so removal is O(log n)
+* a 4-ary heap is half as deep as a binary one and its children share a cache line.
+*/
+class TimerHeap : noncopyable
+{
+public:
+	bool empty() const { return heap_.empty(); }
+	size_t size() const { return heap_.size(); }
+	Timer* top() const { return heap_.front(); }
+
+	void push(Timer* timer) {
+		timer->heapIndex = heap_.size();
+		heap_.push_back(timer);
+		siftUp(timer->heapIndex);
+	}
+
+	void remove(Timer* timer) {
+		size_t i = timer->heapIndex;
+		assert(i < heap_.size() && heap_[i] == timer);
+		Timer* last = heap_.back();
+		heap_.pop_back();
+		if (i < heap_.size()) {
+			heap_[i] = last;
+			last->heapIndex = i;
+			siftDown(i);
+			siftUp(i);
+		}
+	}
+
+private:
+	static bool less(const Timer* a, const Timer* b) {
+		return a->when < b->when || (a->when == b->when && a->id < b->id);
+	}
+
+	void place(size_t i, Timer* timer) {
+		heap_[i] = timer;
+		timer->heapIndex = i;
+	}
+
+	void siftUp(size_t i) {
+		Timer* timer = heap_[i];
+		while (i > 0) {
+			size_t parent = (i - 1) / 4;
+			if (!less(timer, heap_[parent])) { break; }
+			place(i, heap_[parent]);
+			i = parent;
+		}
+		place(i, timer);
+	}
+
+	void siftDown(size_t i) {
+		Timer* timer = heap_[i];
+		size_t n = heap_.size();
+		for (;;) {
+			size_t first = i * 4 + 1;
+			if (first >= n) { break; }
+			size_t best = first;
+			size_t last = std::min(first + 4, n);
+			for (size_t c = first + 1; c < last; c++) {
+				if (less(heap_[c], heap_[best])) { best = c; }
+			}
+			if (!less(heap_[best], timer)) { break; }
+			place(i, heap_[best]);
+			i = best;
+		}
+		place(i, timer);
+	}
+
+	std::vector<Timer*> heap_;
+};
+
+} // namespace detail
+
+/**
+* @brief delayed and periodic callbacks, fired by one dedicated thread
+* Due callbacks are handed to dispatch, ThreadPool passes its own run(), the timer lock is not held meanwhile.
+* Scheduling and cancelling are O(log n) in a 4-ary heap. The thread starts with the first timer.
+* Periodic timers are fixed rate, a tick is skipped if the previous run has not finished.
+*/
+class TimerQueue : noncopyable
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void(Task&&)> Dispatch;
+
+	explicit TimerQueue(Dispatch dispatch, const std::string& name = "TimerQueue")
+		: dispatch_(std::move(dispatch))
+		, name_(name)
+		, nextId_(1)
+		, running_(false)
+		, stopped_(false)
+	{}
+
+	~TimerQueue() { stop(); }
+
+	TimerId runAt(Clock::time_point when, Task cb) {
+		return add(when, Clock::duration::zero(), std::move(cb));
+	}
+
+	//! any clock, the delay from now is what counts, e.g. Timestamp
+	template <typename C, typename D>
+	TimerId runAt(std::chrono::time_point<C, D> when, Task cb) {
+		return runAfter(when - C::now(), std::move(cb));
+	}
+
+	template <typename Rep, typename Period>
+	TimerId runAfter(std::chrono::duration<Rep, Period> delay, Task cb) {
+		return add(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), Clock::duration::zero(), std::move(cb));
+	}
+
+	//! first run after one interval
+	template <typename Rep, typename Period>
+	TimerId runEvery(std::chrono::duration<Rep, Period> interval, Task cb) {
+		auto iv = std::chrono::duration_cast<Clock::duration>(interval);
+		assert(iv > Clock::duration::zero());
+		return add(Clock::now() + iv, iv, std::move(cb));
+	}
+
+	//! false if the timer already fired (one-shot), was cancelled, or never existed
+	bool cancel(TimerId timerId) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto it = timers_.find(timerId.id());
+		if (it == timers_.end()) {
+			return false;
+		}
+		heap_.remove(it->second.get());
+		timers_.erase(it);
+		return true;
+	}
+
+	//! pending timers
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return heap_.size();
+	}
+
+	//! pending timers are dropped, add() after stop() is ignored
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+		cond_.notify_one();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		while (!heap_.empty()) { heap_.remove(heap_.top()); }
+		timers_.clear();
+	}
+
+private:
+	TimerId add(Clock::time_point when, Clock::duration interval, Task&& cb) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (stopped_) {
+			return TimerId();
+		}
+		uint64_t id = nextId_++;
+		std::unique_ptr<detail::Timer> timer(new detail::Timer(id, when, interval, std::move(cb)));
+		heap_.push(timer.get());
+		bool earliest = heap_.top() == timer.get();
+		timers_.emplace(id, std::move(timer));
+		if (!running_) {
+			running_ = true;
+			thread_ = std::thread(&TimerQueue::runInThread, this);
+		} else if (earliest) {
+			cond_.notify_one();
+		}
+		return TimerId(id);
+	}
+
+	void runInThread() {
+		CurrentThread::setName(name_.c_str());
+		std::vector<Task> due;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!stopped_) {
+			if (heap_.empty()) {
+				cond_.wait(lock);
+				continue;
+			}
+			auto now = Clock::now();
+			if (heap_.top()->when > now) {
+				cond_.wait_until(lock, heap_.top()->when);
+				continue;
+			}
+
+			while (!heap_.empty() && heap_.top()->when <= now) {
+				detail::Timer* timer = heap_.top();
+				heap_.remove(timer);
+				if (timer->periodic) {
+					if (!timer->periodic->busy.exchange(true, std::memory_order_acq_rel)) {
+						auto periodic = timer->periodic;
+						due.emplace_back([periodic]() {
+							periodic->task();
+							periodic->busy.store(false, std::memory_order_release);
+						});
+					}
+					// fixed rate, but never schedule into the past after a stall
+					timer->when += timer->interval;
+					if (timer->when <= now) {
+						timer->when = now + timer->interval;
+					}
+					heap_.push(timer);
+				} else {
+					due.emplace_back(std::move(timer->callback));
+					timers_.erase(timer->id);
+				}
+			}
+
+			lock.unlock();
+			for (auto& task : due) {
+				dispatch_(std::move(task));
+			}
+			due.clear();
+			lock.lock();
+		}
+	}
+
+	Dispatch dispatch_;
+	std::string name_;
+	mutable std::mutex mutex_;
+	std::condition_variable cond_;
+	detail::TimerHeap heap_;
+	std::unordered_map<uint64_t, std::unique_ptr<detail::Timer>> timers_;
+	uint64_t nextId_;
+	bool running_;
+	bool stopped_;
+	std::thread thread_;
+};
+
+} // namespace jlib
@@ -0,0 +1,158 @@
+﻿#pragma once
+
+#include "noncopyable.h"
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief hashed timing wheel of one slot per tick, for idle timeouts of many connections
+* the owner calls tick() once a second from its event loop, schedule() is an O(1) relink,
+* a tick only walks its own slot. not thread-safe, use it in the thread that ticks it,
+* after bindToCurrentThread() debug builds assert that.
+*/
+class TimingWheel : noncopyable
+{
+public:
+	//! intrusive entry, embed one per timeout, unlinks itself when destroyed
+	class Node : noncopyable
+	{
+	public:
+		Node() : user_data(nullptr), prev_(nullptr), next_(nullptr), deadline_(0) {}
+		~Node() { unlink(); }
+
+		bool scheduled() const { return next_ != nullptr && next_ != this; }
+		//! the tick it expires on
+		int64_t deadline() const { return deadline_; }
+
+		//! for the ExpireCallback
+		void* user_data;
+
+	private:
+		friend class TimingWheel;
+
+		void unlink() {
+			if (scheduled()) {
+				prev_->next_ = next_;
+				next_->prev_ = prev_;
+				prev_ = next_ = nullptr;
+			}
+		}
+
+		void linkBefore(Node* head) {
+			prev_ = head->prev_;
+			next_ = head;
+			head->prev_->next_ = this;
+			head->prev_ = this;
+		}
+
+		void makeHead() { prev_ = next_ = this; }
+
+		Node* prev_;
+		Node* next_;
+		int64_t deadline_;
+	};
+
+	typedef void(*ExpireCallback)(Node* node, void* user_data);
+
+	//! slots is rounded up to a power of 2, timeouts longer than that take extra rounds
+	explicit TimingWheel(size_t slots = 64)
+		: slots_(roundUp(slots))
+		, now_(0)
+	{
+		for (auto& head : slots_) {
+			head.makeHead();
+		}
+	}
+
+	//! nodes still scheduled are left unlinked, so they can outlive the wheel
+	~TimingWheel() {
+		for (auto& head : slots_) {
+			for (Node* node = head.next_; node != &head;) {
+				Node* next = node->next_;
+				node->prev_ = node->next_ = nullptr;
+				node = next;
+			}
+			head.prev_ = head.next_ = nullptr;
+		}
+	}
+
+	//! ticks so far
+	int64_t now() const { return now_; }
+
+	//! call it in the thread that ticks the wheel, schedule(), cancel() and tick() then assert they run there
+	void bindToCurrentThread() { owner_ = std::this_thread::get_id(); }
+
+	void assertInOwnerThread() const {
+		assert(owner_ == std::thread::id() || owner_ == std::this_thread::get_id());
+	}
+
+	/**
+	* @brief (re)schedule node to expire on the ticks-th tick from now
+	* called between two ticks that is after ticks-1 to ticks seconds, add 1 for at least ticks seconds.
+	* does nothing when node already expires on that tick.
+	*/
+	void schedule(Node* node, int64_t ticks) {
+		assertInOwnerThread();
+		assert(ticks > 0);
+		int64_t deadline = now_ + (ticks > 0 ? ticks : 1);
+		if (node->scheduled() && node->deadline_ == deadline) {
+			return;
+		}
+		node->unlink();
+		node->deadline_ = deadline;
+		node->linkBefore(&slots_[deadline & (slots_.size() - 1)]);
+	}
+
+	void cancel(Node* node) {
+		assertInOwnerThread();
+		node->unlink();
+	}
+
+	/**
+	* @brief advance one tick and expire the nodes due, return how many
+	* a node is unlinked before its callback, which may schedule or cancel any node, or destroy this one.
+	*/
+	size_t tick(ExpireCallback cb, void* user_data) {
+		assertInOwnerThread();
+		++now_;
+		Node* head = &slots_[now_ & (slots_.size() - 1)];
+		Node due;
+		due.makeHead();
+		for (Node* node = head->next_; node != head;) {
+			Node* next = node->next_;
+			if (node->deadline_ <= now_) {
+				node->unlink();
+				node->linkBefore(&due);
+			}
+			node = next;
+		}
+
+		size_t expired = 0;
+		while (due.next_ != &due) {
+			Node* node = due.next_;
+			node->unlink();
+			expired++;
+			cb(node, user_data);
+		}
+		return expired;
+	}
+
+private:
+	static size_t roundUp(size_t slots) {
+		size_t n = 1;
+		while (n < slots) { n <<= 1; }
+		return n;
+	}
+
+	std::vector<Node> slots_;
+	int64_t now_;
+	std::thread::id owner_;
+};
+
+}
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include "config.h"
+#include "noncopyable.h"
+#include <atomic>
+#include <vector>
+#include <type_traits>
+#include <stdint.h>
+#include <assert.h>
+
+namespace jlib
+{
+
+/**
+* @brief Chase-Lev work-stealing deque, with the C11 memory orderings of
+* Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013.
+* The owner thread push()es and pop()s at the bottom, LIFO; any thread may steal() from the top, FIFO.
+* The ring grows by doubling; replaced rings are kept until destruction since a thief may still read them.
+* T is stored in atomics so it must be trivially copyable, typically a pointer.
+*/
+template <typename T>
+class WorkStealingDeque : noncopyable
+{
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+	explicit WorkStealingDeque(int64_t capacity = 256)
+		: top_(0)
+		, bottom_(0)
+		, array_(new Array(roundUpPowerOf2(capacity)))
+	{}
+
+	~WorkStealingDeque() {
+		for (auto a : garbage_) { delete a; }
+		delete array_.load(std::memory_order_relaxed);
+	}
+
+	//! owner only
+	void push(T item) {
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_acquire);
+		Array* a = array_.load(std::memory_order_relaxed);
+		if (b - t > a->capacity - 1) {
+			a = grow(a, t, b);
+		}
+		a->put(b, item);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom_.store(b + 1, std::memory_order_relaxed);
+	}
+
+	//! owner only, the most recently pushed item
+	bool pop(T& item) {
+		int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		Array* a = array_.load(std::memory_order_relaxed);
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		if (t > b) { // empty
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		item = a->get(b);
+		if (t == b) { // the last one, race with thieves
+			bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	//! any thread, the least recently pushed item, fails if empty or another thread took it first
+	bool steal(T& item) {
+		int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom_.load(std::memory_order_acquire);
+		if (t >= b) {
+			return false;
+		}
+		Array* a = array_.load(std::memory_order_acquire);
+		item = a->get(t);
+		return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	//! approximate unless called by the owner with no concurrent thieves
+	int64_t size() const {
+		int64_t b = bottom_.load(std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_seq_cst);
+		return b > t ? b - t : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+private:
+	struct Array : noncopyable {
+		explicit Array(int64_t cap) : capacity(cap), mask(cap - 1), buffer(new std::atomic<T>[cap]) {}
+		~Array() { delete[] buffer; }
+
+		T get(int64_t i) const { return buffer[i & mask].load(std::memory_order_relaxed); }
+		void put(int64_t i, T item) { buffer[i & mask].store(item, std::memory_order_relaxed); }
+
+		const int64_t capacity;
+		const int64_t mask;
+		std::atomic<T>* buffer;
+	};
+
+	static int64_t roundUpPowerOf2(int64_t n) {
+		int64_t cap = 2;
+		while (cap < n) { cap <<= 1; }
+		return cap;
+	}
+
+	Array* grow(Array* a, int64_t t, int64_t b) {
+		Array* bigger = new Array(a->capacity * 2);
+		for (int64_t i = t; i < b; i++) {
+			bigger->put(i, a->get(i));
+		}
+		garbage_.push_back(a);
+		array_.store(bigger, std::memory_order_release);
+		return bigger;
+	}
+
+	std::atomic<int64_t> top_;
+	// top_ and bottom_ are written by different threads, keep them off one cache line
+	char pad_[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> bottom_;
+	std::atomic<Array*> array_;
+	std::vector<Array*> garbage_;
+};
+
+} // namespace jlib
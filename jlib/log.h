@@ -19,6 +19,7 @@
 #include <cstdarg>
 #include <algorithm>
 #include "utf8.h"
+#include "base/hexdump.h"
 #include "util/chrono_wrapper.h"
 #include "dp/singleton.h"
 
@@ -97,54 +98,30 @@ public:
 
 	// static operations
 
-	static void dump_hex(const char* buff, size_t buff_len)
+	static void dump_hex(const char* buff, size_t buff_len, size_t max_bytes = HexDump::NO_LIMIT)
 	{
-		try {
-			auto instance = log::get_instance();
+		dump(buff, buff_len, HexDump::BOTH, max_bytes);
+	}
 
-			if (instance->log_to_file_ || instance->log_to_dbg_view_ || instance->log_to_console_) {
-				size_t output_len = buff_len * 6 + 64;
-				std::unique_ptr<char[]> output = std::unique_ptr<char[]>(new char[output_len]);
-				output[0] = 0;
-				char c[64] = { 0 };
-				std::sprintf(c, "len %d\n", buff_len);
-				std::strcat(output.get(), c);
-				for (size_t i = 0; i < buff_len; i++) {
-					std::sprintf(c, "%02X ", static_cast<unsigned char>(buff[i]));
-					std::strcat(output.get(), c);
-					if (i > 0 && (i + 1) % 16 == 0) {
-						std::strcat(output.get(), "\n");
-					}
-				}
-				std::strcat(output.get(), "\n");
-				instance->output(output.get());
-			}
-		} catch (...) {
-			assert(0);
-		}
+	static void dump_ascii(const char* buff, size_t buff_len, size_t max_bytes = HexDump::NO_LIMIT)
+	{
+		dump(buff, buff_len, HexDump::ASCII, max_bytes);
 	}
 
-	static void dump_ascii(const char* buff, size_t buff_len)
+	static void dump(const char* buff, size_t buff_len, HexDump::Columns columns, size_t max_bytes)
 	{
 		try {
 			auto instance = log::get_instance();
 
 			if (instance->log_to_file_ || instance->log_to_dbg_view_ || instance->log_to_console_) {
-				size_t output_len = buff_len * 6 + 64;
-				std::unique_ptr<char[]> output = std::unique_ptr<char[]>(new char[output_len]);
-				output[0] = 0;
+				HexDump hex(buff, buff_len, max_bytes, columns);
+				std::string output;
+				output.reserve(32 + hex.size());
 				char c[64] = { 0 };
-				std::sprintf(c, "len %d\n", buff_len);
-				std::strcat(output.get(), c);
-				for (size_t i = 0; i < buff_len; i++) {
-					std::sprintf(c, "%C ", static_cast<unsigned char>(buff[i]));
-					std::strcat(output.get(), c);
-					if (i > 0 && (i + 1) % 16 == 0) {
-						std::strcat(output.get(), "\n");
-					}
-				}
-				std::strcat(output.get(), "\n");
-				instance->output(output.get());
+				int len = std::snprintf(c, sizeof(c), "len %zu\n", buff_len);
+				output.append(c, len);
+				hex.appendTo(output);
+				instance->output(output);
 			}
 		} catch (...) {
 			assert(0);
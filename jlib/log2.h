@@ -14,6 +14,12 @@
 #endif // JLIB_WINDOWS
 
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "3rdparty/spdlog/spdlog.h"
 
 #ifdef JLIB_WINDOWS
@@ -21,18 +27,122 @@
 #endif // JLIB_WINDOWS
 
 #include "utf8.h"
+#include "base/logsampling.h"
+#include "base/hexdump.h"
 
 namespace jlib {
     
 static constexpr char g_logger_name[] = "jlogger";
-    
-inline void init_logger( 
+
+struct log_options
+{
+	//! true to format and write in spdlog's background thread, see spdlog::async_logger
+	bool async = false;
+	//! capacity of the async queue (details::mpmc_bounded_q), must be a power of 2
+	size_t queue_size = 8192;
+	//! what the logging thread does when the async queue is full
+	spdlog::async_overflow_policy overflow_policy = spdlog::async_overflow_policy::block_retry;
+	//! sinks are flushed at least this often, by the async worker or by a flusher thread
+	std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000);
+	//! messages at or above this level are flushed immediately
+	spdlog::level::level_enum flush_level = spdlog::level::err;
+};
+
+namespace detail {
+
+//! the logger behind the JLOG_* macros, shared by all translation units
+inline std::atomic<spdlog::logger*>& cached_logger()
+{
+	static std::atomic<spdlog::logger*> logger(nullptr);
+	return logger;
+}
+
+//! keeps the cached logger alive
+inline std::shared_ptr<spdlog::logger>& logger_holder()
+{
+	static std::shared_ptr<spdlog::logger> holder;
+	return holder;
+}
+
+//! loggers replaced by init_logger(), never freed, other threads may still hold them from cached_logger()
+inline std::vector<std::shared_ptr<spdlog::logger>>& retired_loggers()
+{
+	static std::vector<std::shared_ptr<spdlog::logger>> retired;
+	return retired;
+}
+
+inline std::mutex& logger_mutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+//! flushes a synchronous logger every flush_interval instead of after each message
+class periodic_flusher
+{
+public:
+	periodic_flusher(std::shared_ptr<spdlog::logger> logger, std::chrono::milliseconds interval)
+		: logger_(std::move(logger)), interval_(interval), running_(true)
+		, thread_([this]() { run(); })
+	{}
+
+	~periodic_flusher() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			running_ = false;
+		}
+		cond_.notify_one();
+		thread_.join();
+		logger_->flush();
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (running_) {
+			cond_.wait_for(lock, interval_);
+			logger_->flush();
+		}
+	}
+
+	std::shared_ptr<spdlog::logger> logger_;
+	std::chrono::milliseconds interval_;
+	bool running_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::thread thread_;
+};
+
+inline std::unique_ptr<periodic_flusher>& flusher_holder()
+{
+	static std::unique_ptr<periodic_flusher> holder;
+	return holder;
+}
+
+//! publishes logger, logger_mutex() must be held, the previous one is retired but stays valid
+inline void install_logger_locked(const std::shared_ptr<spdlog::logger>& logger, const log_options* options)
+{
+	flusher_holder().reset();
+	if (logger_holder() && logger_holder() != logger) {
+		logger_holder()->flush();
+		retired_loggers().push_back(logger_holder());
+	}
+	spdlog::drop(g_logger_name);
+	spdlog::register_logger(logger);
+	logger_holder() = logger;
+	cached_logger().store(logger.get(), std::memory_order_release);
+	if (options && !options->async && options->flush_interval.count() > 0) {
+		flusher_holder().reset(new periodic_flusher(logger, options->flush_interval));
+	}
+}
+
 #ifdef JLIB_WINDOWS
-std::wstring file_name = L""
+typedef std::wstring log_file_name;
 #else
-std::string file_name = ""
+typedef std::string log_file_name;
 #endif
-)
+
+inline std::shared_ptr<spdlog::logger> make_logger(log_file_name file_name, const log_options& options)
 {
 	if (!file_name.empty()) {
 #ifdef JLIB_WINDOWS
@@ -51,10 +161,18 @@ std::string file_name = ""
 		if (!file_name.empty()) {
 			sinks.push_back(std::make_shared<spdlog::sinks::daily_file_sink_mt>(file_name, 23, 59));
 		}
-		auto combined_logger = std::make_shared<spdlog::logger>(g_logger_name, begin(sinks), end(sinks));
+
+		std::shared_ptr<spdlog::logger> combined_logger;
+		if (options.async) {
+			combined_logger = std::make_shared<spdlog::async_logger>(g_logger_name, begin(sinks), end(sinks),
+																	 options.queue_size, options.overflow_policy,
+																	 nullptr, options.flush_interval);
+		} else {
+			combined_logger = std::make_shared<spdlog::logger>(g_logger_name, begin(sinks), end(sinks));
+		}
 		combined_logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%t] [%L] %v");
-		spdlog::register_logger(combined_logger);
-		combined_logger->flush_on(spdlog::level::trace);
+		combined_logger->flush_on(options.flush_level);
+		return combined_logger;
 	} catch (const spdlog::spdlog_ex& ex) {
 #ifdef JLIB_WINDOWS
 		char msg[1024] = { 0 };
@@ -67,19 +185,105 @@ std::string file_name = ""
 	}    
 }
 
+} // namespace detail
+
+/**
+* @brief installs a new logger for the JLOG_* macros
+* may be called again, the previous logger is flushed and kept alive, not freed,
+* since other threads may be writing to it at that moment.
+*/
+inline void init_logger(detail::log_file_name file_name = detail::log_file_name(), const log_options& options = log_options())
+{
+	auto logger = detail::make_logger(std::move(file_name), options);
+	std::lock_guard<std::mutex> lock(detail::logger_mutex());
+	detail::install_logger_locked(logger, &options);
+}
 
-#define JLOG_DBUG spdlog::get(jlib::g_logger_name)->debug
-#define JLOG_INFO spdlog::get(jlib::g_logger_name)->info
-#define JLOG_WARN spdlog::get(jlib::g_logger_name)->warn
-#define JLOG_ERRO spdlog::get(jlib::g_logger_name)->error
-#define JLOG_CRTC spdlog::get(jlib::g_logger_name)->critical
+/**
+* @brief the logger of the JLOG_* macros, one atomic load once initialized
+* a logger registered directly with spdlog is picked up, otherwise init_logger() with defaults.
+*/
+inline spdlog::logger* get_logger()
+{
+	spdlog::logger* logger = detail::cached_logger().load(std::memory_order_acquire);
+	if (logger) {
+		return logger;
+	}
+
+	// all under the mutex, so racing first uses and an explicit init_logger() install only one logger
+	std::lock_guard<std::mutex> lock(detail::logger_mutex());
+	logger = detail::cached_logger().load(std::memory_order_acquire);
+	if (logger) {
+		return logger;
+	}
+	auto registered = spdlog::get(g_logger_name);
+	if (registered) {
+		detail::install_logger_locked(registered, nullptr);
+		return registered.get();
+	}
+	log_options options;
+	detail::install_logger_locked(detail::make_logger(detail::log_file_name(), options), &options);
+	return detail::cached_logger().load(std::memory_order_acquire);
+}
+
+
+#define JLOG_DBUG jlib::get_logger()->debug
+#define JLOG_INFO jlib::get_logger()->info
+#define JLOG_WARN jlib::get_logger()->warn
+#define JLOG_ERRO jlib::get_logger()->error
+#define JLOG_CRTC jlib::get_logger()->critical
 
 #ifdef JLIB_WINDOWS
-#define JLOG_ALL(args, ...) spdlog::get(jlib::g_logger_name)->log(spdlog::level::off, args, __VA_ARGS__)
+#define JLOG_ALL(args, ...) jlib::get_logger()->log(spdlog::level::off, args, __VA_ARGS__)
 #else
-#define JLOG_ALL(args...) spdlog::get(jlib::g_logger_name)->log(spdlog::level::off, args)
+#define JLOG_ALL(args...) jlib::get_logger()->log(spdlog::level::off, args)
 #endif /* JLIB_WINDOWS */
 
+#define JLIB_LOG2_LEVEL_DBUG spdlog::level::debug
+#define JLIB_LOG2_LEVEL_INFO spdlog::level::info
+#define JLIB_LOG2_LEVEL_WARN spdlog::level::warn
+#define JLIB_LOG2_LEVEL_ERRO spdlog::level::err
+#define JLIB_LOG2_LEVEL_CRTC spdlog::level::critical
+
+template <typename... Args>
+inline void log_sampled(spdlog::level::level_enum lvl, uint64_t suppressed, const char* fmt, const Args&... args)
+{
+	auto logger = get_logger();
+	if (suppressed == 0) {
+		logger->log(lvl, fmt, args...);
+	} else {
+		fmt::MemoryWriter w;
+		w.write("(suppressed {} lines) ", suppressed);
+		w.write(fmt, args...);
+		logger->log(lvl, w.c_str());
+	}
+}
+
+inline bool should_log(spdlog::level::level_enum lvl)
+{
+	return get_logger()->should_log(lvl);
+}
+
+/*
+ Sampled logging for error storms, lvl is DBUG, INFO, WARN, ERRO or CRTC,
+ the next emitted line starts with "(suppressed N lines) ".
+   JLOG_EVERY_N(WARN, 1000, "queue full, size {}", n);
+   JLOG_FIRST_N(INFO, 10, "first 10 only");
+   JLOG_EVERY_T(ERRO, 1.0, "at most once per second");
+   JLOG_RATELIMITED(CRTC, 10, 100, "10 lines/s on average, bursts up to 100, fd #{}", fd);
+*/
+#define JLOG_SAMPLED(lvl, shouldLog, ...) do { \
+	uint64_t jlibSuppressed_ = 0; \
+	if (jlib::should_log(JLIB_LOG2_LEVEL_##lvl) && (shouldLog)) { \
+		jlib::log_sampled(JLIB_LOG2_LEVEL_##lvl, jlibSuppressed_, __VA_ARGS__); \
+	} } while (0)
+
+#define JLOG_EVERY_N(lvl, n, ...) JLOG_SAMPLED(lvl, JLIB_LOG_SITE(jlib::LogEveryN).shouldLog((n), &jlibSuppressed_), __VA_ARGS__)
+#define JLOG_FIRST_N(lvl, n, ...) JLOG_SAMPLED(lvl, JLIB_LOG_SITE(jlib::LogFirstN).shouldLog((n), &jlibSuppressed_), __VA_ARGS__)
+#define JLOG_EVERY_T(lvl, seconds, ...) JLOG_SAMPLED(lvl, JLIB_LOG_SITE(jlib::LogEveryT).shouldLog((seconds), &jlibSuppressed_), __VA_ARGS__)
+#define JLOG_RATELIMITED(lvl, perSecond, burst, ...) \
+	JLOG_SAMPLED(lvl, JLIB_LOG_SITE(jlib::LogRateLimiter).shouldLog((perSecond), (burst), &jlibSuppressed_), __VA_ARGS__)
+
 class range_log
 {
 private:
@@ -114,82 +318,83 @@ public:
 #define AUTO_LOG_FUNCTION jlib::range_log __log_function_object__(__the_pretty_name_of_this_function__);
 
 
-constexpr size_t MAX_OUT_BUFF_LEN = 4096;
-constexpr size_t MAX_INPUT_BUFF_LEN = 672;
+namespace detail {
 
-inline void dump_hex(const void* buff, size_t buff_len, spdlog::level::level_enum level_enum = spdlog::level::warn)
+inline void dump(const char* name, const void* buff, size_t buff_len, HexDump::Columns columns,
+				 spdlog::level::level_enum level_enum, size_t max_bytes)
 {
-	size_t output_len = buff_len * 6 + 64;
-	if (output_len > MAX_OUT_BUFF_LEN) {
-		JLOG_ERRO("dump_hex, output_len {} > MAX_OUT_BUFF_LEN {}", output_len, MAX_OUT_BUFF_LEN);
+	auto logger = get_logger();
+	if (!logger->should_log(level_enum)) {
 		return;
 	}
 
-	char output[MAX_OUT_BUFF_LEN] = { 0 };
-	char c[128] = { 0 };
-	std::sprintf(c, "dump_hex: buff 0x%p, buff_len %zu\n", buff, buff_len);
-
-	for (size_t i = 0; i < 16; i++) {
-		char tmp[4];
-		std::sprintf(tmp, "%02zX ", i);
-		std::strcat(c, tmp);
-	}
+	HexDump hex(buff, buff_len, max_bytes, columns);
+	std::string output;
+	output.reserve(64 + hex.size());
+	char c[128];
+	int len = std::snprintf(c, sizeof(c), "%s: buff %p, buff_len %zu\n", name, buff, buff_len);
+	output.append(c, len);
+	hex.appendTo(output);
+	output.pop_back(); // the logger ends the line
+	logger->log(level_enum, output.c_str());
+}
 
-	std::strcat(output, c); std::strcat(output, "\n");
+} // namespace detail
 
-	for (size_t i = 0; i < buff_len; i++) {
-		std::sprintf(c, "%02X ", reinterpret_cast<const unsigned char*>(buff)[i]);
-		std::strcat(output, c);
-		if (i > 0 && (i + 1) % 16 == 0) {
-			std::strcat(output, "\n");
-		}
-	}
+//! offset/hex/ASCII rows of the first max_bytes bytes, see HexDump
+inline void dump_hex(const void* buff, size_t buff_len, spdlog::level::level_enum level_enum = spdlog::level::warn, size_t max_bytes = HexDump::NO_LIMIT)
+{
+	detail::dump("dump_hex", buff, buff_len, HexDump::BOTH, level_enum, max_bytes);
+}
 
-	spdlog::get(jlib::g_logger_name)->log(level_enum, output);
+//! offset/ASCII rows of the first max_bytes bytes, unprintable bytes shown as '.'
+inline void dump_asc(const void* buff, size_t buff_len, spdlog::level::level_enum level_enum = spdlog::level::warn, size_t max_bytes = HexDump::NO_LIMIT)
+{
+	detail::dump("dump_asc", buff, buff_len, HexDump::ASCII, level_enum, max_bytes);
 }
 
-inline void dump_asc(const void* buff, size_t buff_len, bool seperate_with_space = true, bool force_new_line = true, spdlog::level::level_enum level_enum = spdlog::level::warn)
+/**
+* @brief the old layout, kept for existing callers
+* force_new_line: rows of 16 under a column header, otherwise a single line;
+* seperate_with_space: each byte is followed by two spaces, aligned with the "%02X " header
+*/
+inline void dump_asc(const void* buff, size_t buff_len, bool seperate_with_space, bool force_new_line = true, spdlog::level::level_enum level_enum = spdlog::level::warn)
 {
-	size_t output_len = buff_len * 6 + 64;
-	if (output_len > MAX_OUT_BUFF_LEN) {
-		JLOG_ERRO("dump_asc, output_len {} > MAX_OUT_BUFF_LEN {}", output_len, MAX_OUT_BUFF_LEN);
+	if (force_new_line && !seperate_with_space) {
+		dump_asc(buff, buff_len, level_enum);
 		return;
 	}
 
-	char output[MAX_OUT_BUFF_LEN] = { 0 };
-	char c[128] = { 0 };
-	std::sprintf(c, "dump_asc: buff 0x%p, buff_len %zu\n", buff, buff_len);
-	std::strcat(output, c); std::strcat(output, "\n");
+	auto logger = get_logger();
+	if (!logger->should_log(level_enum)) {
+		return;
+	}
 
+	const size_t step = seperate_with_space ? 3 : 1;
+	std::string output;
+	output.reserve(64 + (force_new_line ? 16 * 3 + 1 : 0) + buff_len * step + buff_len / 16);
+	char c[128];
+	int len = std::snprintf(c, sizeof(c), "dump_asc: buff %p, buff_len %zu\n", buff, buff_len);
+	output.append(c, len);
 	if (force_new_line) {
 		for (size_t i = 0; i < 16; i++) {
-			char tmp[4];
-			std::sprintf(tmp, "%02zX", i);
-			std::strcat(c, tmp);
-			if (seperate_with_space) {
-				std::strcat(c, " ");
-			}
+			len = std::snprintf(c, sizeof(c), "%02zX ", i);
+			output.append(c, len);
 		}
-		std::strcat(output, c); std::strcat(output, "\n");
+		output.push_back('\n');
 	}
 
+	const unsigned char* bytes = static_cast<const unsigned char*>(buff);
 	for (size_t i = 0; i < buff_len; i++) {
-		if (std::isprint(reinterpret_cast<const char*>(buff)[i])) {
-			std::sprintf(c, "%c", reinterpret_cast<const char*>(buff)[i]);
-		} else {
-			std::sprintf(c, "$");
-		}
-		
+		output.push_back((bytes[i] >= 0x20 && bytes[i] < 0x7F) ? static_cast<char>(bytes[i]) : '.');
 		if (seperate_with_space) {
-			std::strcat(c, "  ");
+			output.append("  ");
 		}
-		std::strcat(output, c);
-		if (force_new_line && i > 0 && (i + 1) % 16 == 0) {
-			std::strcat(output, "\n");
+		if (force_new_line && (i + 1) % 16 == 0 && i + 1 < buff_len) {
+			output.push_back('\n');
 		}
 	}
-
-	spdlog::get(jlib::g_logger_name)->log(level_enum, output);
+	logger->log(level_enum, output.c_str());
 }
 
 #define JLOG_HEX(b, l) jlib::dump_hex((b), (l))
@@ -11,6 +11,10 @@
 #define JLOG_ERRO
 #define JLOG_CRTC
 #define JLOG_ALL
+#define JLOG_EVERY_N(...)
+#define JLOG_FIRST_N(...)
+#define JLOG_EVERY_T(...)
+#define JLOG_RATELIMITED(...)
 
 class range_log {
 public:
@@ -24,7 +24,7 @@ struct Helper {
 	int groups_of[N][GROUPS_OF]; 
 	int groups[GROUPS][9]; 
 
-    std::default_random_engine rng = jlib::seeded_random_engine();
+    std::mt19937 rng = jlib::seeded_random_engine();
 
     // 初始化辅助结构体，用户调用 solve 之前手动调用一次即可
     Helper() {
@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <signal.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #if defined(DISABLE_JLIB_LOG2) && !defined(JLIB_DISABLE_LOG)
 #define JLIB_DISABLE_LOG
@@ -34,6 +35,7 @@
 #define JLOG_WARN(...)
 #define JLOG_ERRO(...)
 #define JLOG_CRTC(...)
+#define JLOG_RATELIMITED(...)
 #define JLOG_ALL(...)
 
 class range_log {
@@ -51,6 +53,12 @@ public:
 #endif // JLIB_DISABLE_LOG
 
 
+#ifdef SIMPLELIBEVENTCLIENTSLIB
+# include "../base/timingwheel.h"
+#else
+# include <jlib/base/timingwheel.h>
+#endif
+
 namespace jlib {
 namespace net {
 
@@ -59,12 +67,14 @@ struct simple_libevent_clients::BaseClient::PrivateData {
 	int client_id = 0;
 	int fd = 0;
 	bufferevent* bev = nullptr;
-	event* timer = nullptr;
+	//! the wheel of its worker thread, timer and lifetimer are linked in it
+	TimingWheel* wheel = nullptr;
+	TimingWheel::Node timer{};
 	int timeout = 5;
 	OnTimerCallback on_timer = nullptr;
 	void* user_data = nullptr;
 	int lifetime = -1;
-	event* lifetimer = nullptr;
+	TimingWheel::Node lifetimer{};
 	std::string server_ip{};
 	uint16_t server_port = 0;
 	bool auto_reconnect = false;
@@ -140,6 +150,91 @@ void simple_libevent_clients::BaseClient::send(const void* data, size_t len)
 	evbuffer_unlock(output);
 }
 
+void simple_libevent_clients::BaseClient::sendv(const IoVec* vec, int count)
+{
+	if (!privateData->bev) {
+		JLOG_CRTC("BaseClient::sendv bev is nullptr, #{}", fd());
+		return;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)privateData->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::sendv bev output nullptr, #{}", fd());
+		return;
+	}
+
+	evbuffer_lock(output);
+	for (int i = 0; i < count; i++) {
+		evbuffer_add(output, vec[i].data, vec[i].len);
+	}
+	evbuffer_unlock(output);
+}
+
+static void releaseSharedBuffer(const void*, size_t, void* extra)
+{
+	delete (simple_libevent_clients::SharedBuffer*)extra;
+}
+
+void simple_libevent_clients::BaseClient::send(const SharedBuffer& buffer)
+{
+	if (!privateData->bev) {
+		JLOG_CRTC("BaseClient::send bev is nullptr, #{}", fd());
+		return;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)privateData->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::send bev output nullptr, #{}", fd());
+		return;
+	}
+
+	if (!buffer || buffer->empty()) {
+		return;
+	}
+
+	// released by releaseSharedBuffer once the bytes are written or the bufferevent is freed
+	auto ref = new SharedBuffer(buffer);
+	if (evbuffer_add_reference(output, buffer->data(), buffer->size(), releaseSharedBuffer, ref) != 0) {
+		JLOG_ERRO("BaseClient::send evbuffer_add_reference failed, #{}", fd());
+		delete ref;
+	}
+}
+
+bool simple_libevent_clients::BaseClient::sendFile(int file, int64_t offset, int64_t length)
+{
+	if (!privateData->bev) {
+		JLOG_CRTC("BaseClient::sendFile bev is nullptr, #{}", fd());
+		return false;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)privateData->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::sendFile bev output nullptr, #{}", fd());
+		return false;
+	}
+
+	if (length < 0) {
+		// evbuffer_add_file would take -1 for the whole file even with an offset
+#ifdef _WIN32
+		struct _stati64 st;
+		if (_fstati64(file, &st) != 0) {
+#else
+		struct stat st;
+		if (fstat(file, &st) != 0) {
+#endif
+			JLOG_ERRO("BaseClient::sendFile fstat failed, #{} file={}", fd(), file);
+			return false;
+		}
+		length = std::max<int64_t>(0, (int64_t)st.st_size - offset);
+	}
+
+	if (evbuffer_add_file(output, file, (ev_off_t)offset, (ev_off_t)length) != 0) {
+		JLOG_ERRO("BaseClient::sendFile evbuffer_add_file failed, #{} file={}", fd(), file);
+		return false;
+	}
+	return true;
+}
+
 void simple_libevent_clients::BaseClient::shutdown(int what)
 {
 	if (fd() != 0) {
@@ -177,9 +272,33 @@ struct simple_libevent_clients::PrivateImpl
 		std::unordered_map<int, simple_libevent_clients::BaseClient*> clients{};
 		int clients_to_connect = 0;
 		int client_id_to_connect = 0;
+		//! timers and lifetimes of the clients, ticked every second, only touched by this worker thread
+		TimingWheel wheel;
+		event* ticker = nullptr;
 
-		static void dummy_timercb_avoid_worker_exit(evutil_socket_t, short, void*)
-		{}
+		// also keeps event_base_dispatch running without clients
+		static void tickcb(evutil_socket_t, short, void* arg)
+		{
+			auto context = (WorkerThreadContext*)arg;
+			context->wheel.tick(expirecb, context);
+		}
+
+		static void expirecb(TimingWheel::Node* node, void* arg)
+		{
+			auto context = (WorkerThreadContext*)arg;
+			auto client = (BaseClient*)node->user_data;
+			if (node == &client->privateData->lifetimer) {
+				client->shutdown();
+				return;
+			}
+			if (client->privateData->on_timer) {
+				client->privateData->on_timer(client, client->privateData->user_data);
+			}
+			// unless on_timer has set a new one
+			if (!node->scheduled()) {
+				context->wheel.schedule(node, client->privateData->timeout);
+			}
+		}
 
 		explicit WorkerThreadContext(simple_libevent_clients* ctx, int thread_id, const std::string& name = {})
 			: ctx(ctx)
@@ -191,8 +310,10 @@ struct simple_libevent_clients::PrivateImpl
 
 		void worker() {
 			JLOG_INFO("{} WorkerThread #{} started", name, thread_id);
+			wheel.bindToCurrentThread();
 			timeval tv = { 1, 0 };
-			event_add(event_new(base, -1, EV_PERSIST, dummy_timercb_avoid_worker_exit, nullptr), &tv);
+			ticker = event_new(base, -1, EV_PERSIST, tickcb, this);
+			event_add(ticker, &tv);
 			event_base_dispatch(base);
 			JLOG_INFO("{} WorkerThread #{} exited", name.data(), thread_id);
 		}
@@ -206,6 +327,9 @@ struct simple_libevent_clients::PrivateImpl
 			}
 			auto client = ctx->newClient_();
 			client->privateData->bev = bev;
+			client->privateData->wheel = &wheel;
+			client->privateData->timer.user_data = client;
+			client->privateData->lifetimer.user_data = client;
 			client->privateData->thread_id = thread_id;
 			client->privateData->client_id = client_id_to_connect++;
 			client->privateData->server_ip = ip;
@@ -307,7 +431,7 @@ struct simple_libevent_clients::PrivateImpl
 				if (iter != context->clients.end()) {
 					client = iter->second;
 				} else {
-					JLOG_CRTC("eventcb cannot find client by fd #{}", (int)fd);
+					JLOG_RATELIMITED(CRTC, 10, 10, "eventcb cannot find client by fd #{}", (int)fd);
 				}
 			}
 
@@ -317,15 +441,8 @@ struct simple_libevent_clients::PrivateImpl
 				}
 
 				if (!up) {
-					if (client->privateData->timer) {
-						event_del(client->privateData->timer);
-						client->privateData->timer = nullptr;
-					}
-
-					if (client->privateData->lifetimer) {
-						event_del(client->privateData->lifetimer);
-						client->privateData->lifetimer = nullptr;
-					}
+					context->wheel.cancel(&client->privateData->timer);
+					context->wheel.cancel(&client->privateData->lifetimer);
 
 					{
 						std::lock_guard<std::mutex> lg(context->mutex);
@@ -416,6 +533,9 @@ struct simple_libevent_clients::PrivateImpl
 		}
 		threads.clear();
 		for (auto context : contexts) {
+			if (context->ticker) {
+				event_free(context->ticker);
+			}
 			event_base_free(context->base);
 			context->clients.clear();
 			delete context;
@@ -423,23 +543,6 @@ struct simple_libevent_clients::PrivateImpl
 		contexts.clear();
 	}
 
-	static void timercb(evutil_socket_t fd, short, void* user_data)
-	{
-		auto client = (BaseClient*)user_data;
-		if (client->privateData->on_timer) {
-			client->privateData->on_timer(client, client->privateData->user_data);
-		}
-		client->privateData->timer = event_new(bufferevent_get_base(client->privateData->bev), client->fd(), 0, timercb, client);
-		struct timeval tv = { client->privateData->timeout, 0 };
-		event_add(client->privateData->timer, &tv);
-	}
-
-	static void lifetimer_cb(evutil_socket_t fd, short, void* user_data)
-	{
-		auto client = (BaseClient*)user_data;
-		client->shutdown();
-	}
-
 };
 
 simple_libevent_clients::simple_libevent_clients(OnConnectinoCallback onConn, OnMessageCallback onMsg, OnWriteCompleteCallback onWrite,
@@ -497,44 +600,32 @@ simple_libevent_clients::BaseClient* simple_libevent_clients::find_client(int fd
 
 void simple_libevent_clients::BaseClient::set_timer(OnTimerCallback cb, void* user_data, int seconds)
 {
-	if (privateData->timer) {
-		event_del(privateData->timer);
+	if (!privateData->wheel) {
+		JLOG_CRTC("BaseClient::set_timer not connected, #{}", fd());
+		return;
 	}
 	privateData->on_timer = cb;
 	privateData->user_data = user_data;
-	privateData->timeout = seconds;
-	auto base = bufferevent_get_base(privateData->bev);
-	privateData->timer = event_new(base, fd(), 0, PrivateImpl::timercb, this);
-	if (!privateData->timer) {
-		JLOG_CRTC("create timer failed");
-		return;
-	}
-	struct timeval tv = { seconds, 0 };
-	event_add(privateData->timer, &tv);
+	privateData->timeout = seconds >= 1 ? seconds : 1;
+	// +1 for the part of the current tick already gone, later runs are timeout apart
+	privateData->wheel->schedule(&privateData->timer, privateData->timeout + 1);
 }
 
 void simple_libevent_clients::BaseClient::set_lifetime(int seconds)
 {
 	if (seconds < 0) {
-		if (privateData->lifetimer) {
-			event_del(privateData->lifetimer);
-			privateData->lifetimer = nullptr;
+		if (privateData->wheel) {
+			privateData->wheel->cancel(&privateData->lifetimer);
 		}
 		return;
 	}
 
 	privateData->lifetime = seconds;
-	if (privateData->lifetimer) {
-		event_del(privateData->lifetimer);
-	}
-	auto base = bufferevent_get_base(privateData->bev);
-	privateData->lifetimer = event_new(base, fd(), 0, PrivateImpl::lifetimer_cb, this);
-	if (!privateData->lifetimer) {
-		JLOG_CRTC("create lifetimer failed");
+	if (!privateData->wheel) {
+		JLOG_CRTC("BaseClient::set_lifetime not connected, #{}", fd());
 		return;
 	}
-	struct timeval tv = { seconds, 0 };
-	event_add(privateData->lifetimer, &tv);
+	privateData->wheel->schedule(&privateData->lifetimer, seconds + 1);
 }
 
 }
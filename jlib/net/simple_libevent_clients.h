@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <chrono>
@@ -50,6 +51,14 @@ public:
 
 	typedef void(*OnWriteCompleteCallback)(BaseClient* client, void* user_data);
 
+	// immutable payload shared by any number of sends without copying
+	typedef std::shared_ptr<const std::string> SharedBuffer;
+
+	struct IoVec {
+		const void* data;
+		size_t len;
+	};
+
 
 	struct BaseClient {
 		explicit BaseClient();
@@ -66,9 +75,17 @@ public:
 		int lifetime() const;
 
 		void send(const void* data, size_t len);
+		// copies count pieces into the output buffer under one lock
+		void sendv(const IoVec* vec, int count);
+		// no copy, the output buffer references buffer until it is written to the socket
+		void send(const SharedBuffer& buffer);
+		// length bytes of file from offset, -1 for the rest, by sendfile if possible, file is closed when sent unless false is returned
+		bool sendFile(int file, int64_t offset = 0, int64_t length = -1);
 		void shutdown(int what = 1);
 		void updateLastTimeComm();
 		void set_auto_reconnect(bool b);
+		// timer and lifetime have a resolution of one second, call them in the client's worker thread,
+		// e.g. in OnConnectinoCallback, debug builds assert that
 		void set_timer(OnTimerCallback cb, void* user_data, int seconds);
 		// set to -1 for live until peer disconnected
 		void set_lifetime(int seconds);
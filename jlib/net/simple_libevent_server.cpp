@@ -11,9 +11,11 @@
 #include <event2/thread.h>
 #include <thread>
 #include <mutex>
+#include <unordered_set>
 #include <algorithm>
 #include <signal.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #if defined(DISABLE_JLIB_LOG2) && !defined(JLIB_DISABLE_LOG)
 #define JLIB_DISABLE_LOG
@@ -37,6 +39,7 @@
 #  define JLOG_WARN(...)
 #  define JLOG_ERRO(...)
 #  define JLOG_CRTC(...)
+#  define JLOG_RATELIMITED(...)
 #  define JLOG_ALL(...)
 
 class range_log {
@@ -54,14 +57,29 @@ public:
 # endif
 #endif // JLIB_DISABLE_LOG
 
+#ifdef SIMPLELIBEVENTSERVERLIB
+# include "../base/countdownlatch.h"
+# include "../base/currentthread.h"
+# include "../base/timingwheel.h"
+#else
+# include <jlib/base/countdownlatch.h>
+# include <jlib/base/currentthread.h>
+# include <jlib/base/timingwheel.h>
+#endif
+
 namespace jlib {
 namespace net {
 
 struct BaseClientPrivateData {
+	//! the callback argument of the bufferevent and the idle node is the client, this leads back to the server
+	simple_libevent_server* server = nullptr;
 	int thread_id = 0;
 	void* bev = nullptr;
-	void* timer = nullptr;
-	std::chrono::steady_clock::time_point lastTimeComm = {};
+	//! the wheel of its worker thread, idle expires maxIdleTime_ after the last updateLastTimeComm()
+	TimingWheel* wheel = nullptr;
+	TimingWheel::Node idle = {};
+	//! set by BaseClient::expect(), bytes the next OnMessageCallback needs in one piece
+	size_t expected = 0;
 };
 
 
@@ -101,6 +119,91 @@ void simple_libevent_server::BaseClient::send(const void* data, size_t len)
 	evbuffer_unlock(output);
 }
 
+void simple_libevent_server::BaseClient::sendv(const IoVec* vec, int count)
+{
+	if (!((BaseClientPrivateData*)privateData)->bev) {
+		JLOG_CRTC("BaseClient::sendv bev is nullptr, #{}", fd);
+		return;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)((BaseClientPrivateData*)privateData)->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::sendv bev output nullptr, #{}", fd);
+		return;
+	}
+
+	evbuffer_lock(output);
+	for (int i = 0; i < count; i++) {
+		evbuffer_add(output, vec[i].data, vec[i].len);
+	}
+	evbuffer_unlock(output);
+}
+
+static void releaseSharedBuffer(const void*, size_t, void* extra)
+{
+	delete (simple_libevent_server::SharedBuffer*)extra;
+}
+
+void simple_libevent_server::BaseClient::send(const SharedBuffer& buffer)
+{
+	if (!((BaseClientPrivateData*)privateData)->bev) {
+		JLOG_CRTC("BaseClient::send bev is nullptr, #{}", fd);
+		return;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)((BaseClientPrivateData*)privateData)->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::send bev output nullptr, #{}", fd);
+		return;
+	}
+
+	if (!buffer || buffer->empty()) {
+		return;
+	}
+
+	// released by releaseSharedBuffer once the bytes are written or the bufferevent is freed
+	auto ref = new SharedBuffer(buffer);
+	if (evbuffer_add_reference(output, buffer->data(), buffer->size(), releaseSharedBuffer, ref) != 0) {
+		JLOG_ERRO("BaseClient::send evbuffer_add_reference failed, #{}", fd);
+		delete ref;
+	}
+}
+
+bool simple_libevent_server::BaseClient::sendFile(int file, int64_t offset, int64_t length)
+{
+	if (!((BaseClientPrivateData*)privateData)->bev) {
+		JLOG_CRTC("BaseClient::sendFile bev is nullptr, #{}", fd);
+		return false;
+	}
+
+	auto output = bufferevent_get_output((bufferevent*)((BaseClientPrivateData*)privateData)->bev);
+	if (!output) {
+		JLOG_INFO("BaseClient::sendFile bev output nullptr, #{}", fd);
+		return false;
+	}
+
+	if (length < 0) {
+		// evbuffer_add_file would take -1 for the whole file even with an offset
+#ifdef _WIN32
+		struct _stati64 st;
+		if (_fstati64(file, &st) != 0) {
+#else
+		struct stat st;
+		if (fstat(file, &st) != 0) {
+#endif
+			JLOG_ERRO("BaseClient::sendFile fstat failed, #{} file={}", fd, file);
+			return false;
+		}
+		length = std::max<int64_t>(0, (int64_t)st.st_size - offset);
+	}
+
+	if (evbuffer_add_file(output, file, (ev_off_t)offset, (ev_off_t)length) != 0) {
+		JLOG_ERRO("BaseClient::sendFile evbuffer_add_file failed, #{} file={}", fd, file);
+		return false;
+	}
+	return true;
+}
+
 void simple_libevent_server::BaseClient::shutdown(int what)
 {
 	if (fd != 0) {
@@ -109,76 +212,167 @@ void simple_libevent_server::BaseClient::shutdown(int what)
 	}
 }
 
+void simple_libevent_server::BaseClient::expect(size_t bytes)
+{
+	((BaseClientPrivateData*)privateData)->expected = bytes;
+}
+
 void simple_libevent_server::BaseClient::updateLastTimeComm()
 {
-	((BaseClientPrivateData*)privateData)->lastTimeComm = std::chrono::steady_clock::now();
+	auto data = (BaseClientPrivateData*)privateData;
+	if (data->wheel) {
+		// +1 for the part of the current tick already gone
+		data->wheel->schedule(&data->idle, data->server->maxIdleTime_ + 1);
+	}
 }
 
 struct simple_libevent_server::PrivateImpl
 {
+	struct NewConnection;
+
 	struct WorkerThreadContext {
 		std::string name = {};
 		int thread_id = 0;
+		//! pinned to this cpu unless -1
+		int cpu = -1;
 		event_base* base = nullptr;
 		std::thread thread = {};
+		//! clients served by this worker, locked on connect and disconnect only, never per message
+		std::mutex mutex = {};
+		std::unordered_map<int, BaseClient*> clients = {};
+		struct BroadcastTask;
+		//! queued by event_base_once but not run yet, also under mutex, stop() frees those the exited loop left
+		std::unordered_set<NewConnection*> pendingConnections = {};
+		std::unordered_set<BroadcastTask*> pendingBroadcasts = {};
+		//! idle timeouts of the clients, ticked every second, only touched by this worker thread
+		TimingWheel wheel;
+		event* ticker = nullptr;
+		//! this worker's own SO_REUSEPORT listener, see setReusePort()
+		evconnlistener* listener = nullptr;
+		simple_libevent_server* server = nullptr;
+
+		// also keeps event_base_dispatch running without clients
+		static void tickcb(evutil_socket_t, short, void* arg)
+		{
+			auto ctx = (WorkerThreadContext*)arg;
+			ctx->wheel.tick(idlecb, ctx);
+		}
+
+		static void idlecb(TimingWheel::Node* node, void*)
+		{
+			auto client = (BaseClient*)node->user_data;
+			auto server = ((BaseClientPrivateData*)client->privateData)->server;
+			JLOG_INFO("{} client #{} idle > {}s, shutting down", server->name_, client->fd, server->maxIdleTime_);
+			client->shutdown();
+		}
 
-		static void dummy_timercb_avoid_worker_exit(evutil_socket_t, short, void*)
-		{}
+		struct BroadcastTask {
+			WorkerThreadContext* ctx;
+			SharedBuffer buffer;
+		};
 
-		explicit WorkerThreadContext(const std::string& name, int thread_id)
+		// runs in the worker thread, where the clients' bufferevents live
+		static void broadcastcb(evutil_socket_t, short, void* arg)
+		{
+			auto task = (BroadcastTask*)arg;
+			{
+				std::lock_guard<std::mutex> lg(task->ctx->mutex);
+				task->ctx->pendingBroadcasts.erase(task);
+				for (auto client : task->ctx->clients) {
+					client.second->send(task->buffer);
+				}
+			}
+			delete task;
+		}
+
+		//! started is counted down once base is ready, wait on it before touching base from another thread
+		explicit WorkerThreadContext(simple_libevent_server* server, const std::string& name, int thread_id, int cpu, CountDownLatch* started)
 			: name(name)
 			, thread_id(thread_id)
+			, cpu(cpu)
+			, server(server)
 		{
-			thread = std::thread(&WorkerThreadContext::worker, this);
+			thread = std::thread(&WorkerThreadContext::worker, this, started);
 		}
 
-		void worker() {
+		void worker(CountDownLatch* started) {
+			CurrentThread::setName((name + "-io" + std::to_string(thread_id)).c_str());
+			if (cpu >= 0 && !CurrentThread::setAffinity({ cpu })) {
+				JLOG_WARN("{} WorkerThread #{} cannot be pinned to cpu {}", name.data(), thread_id, cpu);
+			}
 			JLOG_INFO("{} WorkerThread #{} started", name.data(), thread_id);
+			wheel.bindToCurrentThread();
 			base = event_base_new();
 			timeval tv = { 1, 0 };
-			event_add(event_new(base, -1, EV_PERSIST, dummy_timercb_avoid_worker_exit, nullptr), &tv);
+			ticker = event_new(base, -1, EV_PERSIST, tickcb, this);
+			event_add(ticker, &tv);
+			started->countDown();
 			event_base_dispatch(base);
 			JLOG_INFO("{} WorkerThread #{} exited", name.data(), thread_id);
 		}
 
+		// user_data is the client, only this worker thread touches it until eventcb frees it
 		static void readcb(struct bufferevent* bev, void* user_data)
 		{
 			char buff[4096];
 			auto input = bufferevent_get_input(bev);
-			simple_libevent_server* server = (simple_libevent_server*)user_data;
-			if (/*server->userData_ && */server->onMsg_) {
-				int fd = (int)bufferevent_getfd(bev);
-				BaseClient* client = nullptr;
-				{
-					std::lock_guard<std::mutex> lg(server->mutex);
-					auto iter = server->clients.find(fd);
-					if (iter != server->clients.end()) {
-						client = iter->second;
-					}
-				}
-				if (client) {
-					while (1) {
-						int len = (int)evbuffer_copyout(input, buff, std::min(sizeof(buff), evbuffer_get_length(input)));
-						if (len > 0) {
-							size_t ate = server->onMsg_(buff, len, client, server->userData_);
-							if (ate > 0) {
-								evbuffer_drain(input, ate);
-								continue;
-							}
+			BaseClient* client = (BaseClient*)user_data;
+			simple_libevent_server* server = ((BaseClientPrivateData*)client->privateData)->server;
+			if (/*server->userData_ && */server->onMsg_ && server->msgDelivery_ == MessageDelivery::Pullup) {
+				deliverPullup(input, client, server);
+			} else if (/*server->userData_ && */server->onMsg_) {
+				while (1) {
+					int len = (int)evbuffer_copyout(input, buff, std::min(sizeof(buff), evbuffer_get_length(input)));
+					if (len > 0) {
+						size_t ate = server->onMsg_(buff, len, client, server->userData_);
+						if (ate > 0) {
+							evbuffer_drain(input, ate);
+							continue;
 						}
-						break;
 					}
-				} else {
-					bufferevent_free(bev);
+					break;
 				}
 			} else {
 				evbuffer_drain(input, evbuffer_get_length(input));
 			}
 		}
 
+		/*
+		* the callback gets a pointer into the input buffer, usually its first chain as it is,
+		* evbuffer_pullup copies only when more bytes are needed in one piece than that chain holds:
+		* the callback either called expect(n), or returned 0 without it, then all input is made contiguous
+		*/
+		static void deliverPullup(evbuffer* input, BaseClient* client, simple_libevent_server* server)
+		{
+			auto privateData = (BaseClientPrivateData*)client->privateData;
+			while (1) {
+				size_t len = evbuffer_get_length(input);
+				size_t want = std::max(evbuffer_get_contiguous_space(input), privateData->expected);
+				if (len == 0 || want > len) {
+					break; // wait for the expected bytes
+				}
+
+				privateData->expected = 0;
+				auto data = (const char*)evbuffer_pullup(input, (ev_ssize_t)want);
+				size_t ate = server->onMsg_(data, want, client, server->userData_);
+				if (ate > 0) {
+					evbuffer_drain(input, ate);
+					continue;
+				}
+
+				if (privateData->expected == 0 && want < len) {
+					privateData->expected = len; // try once more with all we have
+					continue;
+				}
+				break;
+			}
+		}
+
 		static void eventcb(struct bufferevent* bev, short events, void* user_data)
 		{
-			simple_libevent_server* server = (simple_libevent_server*)user_data;
+			BaseClient* client = (BaseClient*)user_data;
+			auto privateData = (BaseClientPrivateData*)client->privateData;
+			simple_libevent_server* server = privateData->server;
 			//printf("eventcb events=%d %s\n", events, eventToString(events).data());
 
 			std::string msg;
@@ -188,30 +382,16 @@ struct simple_libevent_server::PrivateImpl
 				msg = ("Got an error on the connection: ");
 				msg += strerror(errno);
 			}
-			int fd = (int)bufferevent_getfd(bev);
-			BaseClient* client = nullptr;
-			{
-				std::lock_guard<std::mutex> lg(server->mutex);
-				auto iter = server->clients.find(fd);
-				if (iter != server->clients.end()) {
-					client = iter->second;
-				} else {
-					JLOG_CRTC("eventcb cannot find client by fd #{}", (int)fd);
-				}
+			privateData->wheel->cancel(&privateData->idle);
+			if (/*server->userData_ && */server->onConn_) {
+				server->onConn_(false, msg, client, server->userData_);
 			}
-			if (client) {
-				if (((BaseClientPrivateData*)client->privateData)->timer) {
-					event_del((event*)((BaseClientPrivateData*)client->privateData)->timer);
-				}
-				if (/*server->userData_ && */server->onConn_) {
-					server->onConn_(false, msg, client, server->userData_);
-				}
-				{
-					std::lock_guard<std::mutex> lg(server->mutex);
-					server->clients.erase(fd);
-					delete client;
-				}
+			auto ctx = server->impl->workerThreadContexts[privateData->thread_id];
+			{
+				std::lock_guard<std::mutex> lg(ctx->mutex);
+				ctx->clients.erase(client->fd);
 			}
+			delete client;
 
 			bufferevent_free(bev);
 		}
@@ -223,9 +403,9 @@ struct simple_libevent_server::PrivateImpl
 	{}
 
 	event_base* base = nullptr;
+	evconnlistener* listener = nullptr;
 	void* user_data = nullptr;
 	std::thread thread = {};
-	timeval tv = {};
 	WorkerThreadContextPtr* workerThreadContexts = {};
 	int curWorkerId = 0;
 
@@ -238,36 +418,30 @@ struct simple_libevent_server::PrivateImpl
 		event_base_loopexit(base, nullptr);
 	}
 
-	static void timercb(evutil_socket_t fd, short, void* user_data)
+	struct NewConnection {
+		simple_libevent_server* server;
+		WorkerThreadContext* ctx;
+		evutil_socket_t fd;
+		sockaddr_in addr;
+	};
+
+	static void newConnectioncb(evutil_socket_t, short, void* arg)
 	{
-		auto server = (simple_libevent_server*)user_data;
-		std::lock_guard<std::mutex> lg(server->mutex);
-		auto iter = server->clients.find((int)fd);
-		if (iter != server->clients.end()) {
-			auto client = iter->second;
-			auto now = std::chrono::steady_clock::now();
-			auto diff = std::chrono::duration_cast<std::chrono::seconds>(now - ((BaseClientPrivateData*)client->privateData)->lastTimeComm);
-			if (diff.count() > server->maxIdleTime_) {
-				JLOG_INFO("{} client #{} timeout={}s > {}s, shutting down", server->name_, client->fd, diff.count(), server->maxIdleTime_);
-				((BaseClientPrivateData*)client->privateData)->timer = nullptr;
-				client->shutdown();
-			} else {
-				((BaseClientPrivateData*)client->privateData)->timer = event_new(server->impl->base, fd, 0, timercb, server);
-				event_add((event*)((BaseClientPrivateData*)client->privateData)->timer, &server->impl->tv);
-			}
-		} else {
-			JLOG_CRTC("{} timercb cannot find client by fd #{}", server->name_, (int)fd);
+		auto conn = (NewConnection*)arg;
+		{
+			std::lock_guard<std::mutex> lg(conn->ctx->mutex);
+			conn->ctx->pendingConnections.erase(conn);
 		}
+		newConnection(conn->server, conn->ctx, conn->fd, conn->addr);
+		delete conn;
 	}
 
-	static void accept_cb(evconnlistener* listener, evutil_socket_t fd, sockaddr* addr, int socklen, void* user_data)
+	// runs in the worker thread, which owns the client, its bufferevent and its idle node from now on
+	static void newConnection(simple_libevent_server* server, WorkerThreadContext* ctx, evutil_socket_t fd, const sockaddr_in& addr)
 	{
 		char str[INET_ADDRSTRLEN] = { 0 };
-		auto sin = (sockaddr_in*)addr;
-		inet_ntop(AF_INET, &sin->sin_addr, str, INET_ADDRSTRLEN);
-
-		simple_libevent_server* server = (simple_libevent_server*)user_data;
-		auto ctx = server->impl->workerThreadContexts[server->impl->curWorkerId];
+		inet_ntop(AF_INET, &addr.sin_addr, str, INET_ADDRSTRLEN);
+		uint16_t port = addr.sin_port;
 
 		auto bev = bufferevent_socket_new(ctx->base, fd, BEV_OPT_CLOSE_ON_FREE);
 		if (!bev) {
@@ -277,26 +451,65 @@ struct simple_libevent_server::PrivateImpl
 
 		assert(server->newClient_);
 		auto client = server->newClient_((int)fd, bev);
-		((BaseClientPrivateData*)client->privateData)->thread_id = server->impl->curWorkerId;
+		auto privateData = (BaseClientPrivateData*)client->privateData;
+		privateData->server = server;
+		privateData->thread_id = ctx->thread_id;
+		privateData->wheel = &ctx->wheel;
+		privateData->idle.user_data = client;
 		client->ip = str;
-		client->port = sin->sin_port;
+		client->port = port;
 		client->updateLastTimeComm();
-		((BaseClientPrivateData*)client->privateData)->timer = event_new(ctx->base, fd, 0, timercb, /*new TimerContext({ server, client })*/ server);
-		event_add((event*)((BaseClientPrivateData*)client->privateData)->timer, &server->impl->tv);
 
 		{
-			std::lock_guard<std::mutex> lg(server->mutex);
-			server->clients[(int)fd] = client;
+			std::lock_guard<std::mutex> lg(ctx->mutex);
+			ctx->clients[(int)fd] = client;
 		}
 
-		bufferevent_setcb(bev, WorkerThreadContext::readcb, nullptr, WorkerThreadContext::eventcb, server);
+		bufferevent_setcb(bev, WorkerThreadContext::readcb, nullptr, WorkerThreadContext::eventcb, client);
 		bufferevent_enable(bev, EV_WRITE | EV_READ);
 
 		if (/*server->userData_ && */server->onConn_) {
 			server->onConn_(true, "", client, server->userData_);
 		}
+	}
 
+	static void accept_cb(evconnlistener* listener, evutil_socket_t fd, sockaddr* addr, int socklen, void* user_data)
+	{
+		simple_libevent_server* server = (simple_libevent_server*)user_data;
+		auto ctx = server->impl->workerThreadContexts[server->impl->curWorkerId];
 		server->impl->curWorkerId = (server->impl->curWorkerId + 1) % server->threadNum_;
+
+		const timeval now{ 0, 0 };
+		auto conn = new NewConnection{ server, ctx, fd, *(sockaddr_in*)addr };
+		{
+			// before event_base_once, the worker may run newConnectioncb right away
+			std::lock_guard<std::mutex> lg(ctx->mutex);
+			ctx->pendingConnections.insert(conn);
+		}
+		if (event_base_once(ctx->base, -1, EV_TIMEOUT, newConnectioncb, conn, &now) != 0) {
+			JLOG_ERRO("{} cannot hand client #{} to worker #{}", server->name_, (int)fd, ctx->thread_id);
+			{
+				std::lock_guard<std::mutex> lg(ctx->mutex);
+				ctx->pendingConnections.erase(conn);
+			}
+			evutil_closesocket(fd);
+			delete conn;
+		}
+	}
+
+	// reuse port mode, accepted by the worker's own listener, no handoff
+	static void worker_accept_cb(evconnlistener*, evutil_socket_t fd, sockaddr* addr, int, void* user_data)
+	{
+		auto ctx = (WorkerThreadContext*)user_data;
+		newConnection(ctx->server, ctx, fd, *(sockaddr_in*)addr);
+	}
+
+	// unlike accpet_error_cb it keeps the worker running, it has clients to serve
+	static void worker_accept_error_cb(evconnlistener*, void* user_data)
+	{
+		auto ctx = (WorkerThreadContext*)user_data;
+		int err = EVUTIL_SOCKET_ERROR();
+		JLOG_RATELIMITED(CRTC, 1, 10, "{} worker #{} accept error:{}:{}", ctx->server->name_, ctx->thread_id, err, evutil_socket_error_to_string(err));
 	}
 
 };
@@ -321,59 +534,84 @@ bool simple_libevent_server::start(uint16_t port, std::string& msg)
 
 		std::lock_guard<std::mutex> lg(mutex);
 
-		impl = new PrivateImpl(this);
-		impl->base = event_base_new();
-		if (!impl->base) {
-			msg = name_ + " init libevent failed";
-			JLOG_CRTC(msg);
-			break;
+		bool reusePort = reusePort_;
+#ifdef _WIN32
+		if (reusePort) {
+			JLOG_WARN("{} SO_REUSEPORT is not supported, falling back to one listen thread", name_);
+			reusePort = false;
 		}
+#endif
+
+		impl = new PrivateImpl(this);
 
 		sockaddr_in sin = { 0 };
 		sin.sin_family = AF_INET;
 		sin.sin_addr.s_addr = htonl(INADDR_ANY);
 		sin.sin_port = htons(port);
 
-		auto listener = evconnlistener_new_bind(impl->base,
-												PrivateImpl::accept_cb,
-												this,
-												LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE,
-												-1, // backlog, -1 for default
-												(const sockaddr*)(&sin),
-												sizeof(sin));
-		if (!listener) {
-			msg = name_ + " create listener failed";
-			JLOG_CRTC(msg);
-			break;
-		}
-		evconnlistener_set_error_cb(listener, PrivateImpl::accpet_error_cb);
+		if (!reusePort) {
+			impl->base = event_base_new();
+			if (!impl->base) {
+				msg = name_ + " init libevent failed";
+				JLOG_CRTC(msg);
+				break;
+			}
 
-		// init common timeout 
-		impl->tv.tv_sec = maxIdleTime_;
-		impl->tv.tv_usec = 0;
-		const struct timeval* tv_out = event_base_init_common_timeout(impl->base, &impl->tv);
-		memcpy(&impl->tv, tv_out, sizeof(struct timeval));		
+			impl->listener = evconnlistener_new_bind(impl->base,
+													PrivateImpl::accept_cb,
+													this,
+													LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE,
+													-1, // backlog, -1 for default
+													(const sockaddr*)(&sin),
+													sizeof(sin));
+			if (!impl->listener) {
+				msg = name_ + " create listener failed";
+				JLOG_CRTC(msg);
+				break;
+			}
+			evconnlistener_set_error_cb(impl->listener, PrivateImpl::accpet_error_cb);
+		}
 
 		impl->workerThreadContexts = new PrivateImpl::WorkerThreadContextPtr[threadNum_];
+		// the latch publishes each worker's base to this thread, listeners below are bound to them
+		CountDownLatch workersStarted(threadNum_);
 		for (int i = 0; i < threadNum_; i++) {
-			impl->workerThreadContexts[i] = (new PrivateImpl::WorkerThreadContext(name_, i));
+			int cpu = cpus_.empty() ? -1 : cpus_[i % cpus_.size()];
+			impl->workerThreadContexts[i] = new PrivateImpl::WorkerThreadContext(this, name_, i, cpu, &workersStarted);
 		}
-
-		// fix 
-		// wait till all worker thread's base is created
-		bool all_created = false;
-		while (!all_created) {
-			all_created = true;
-			for (int i = 0; i < threadNum_; i++) {
-				if (!impl->workerThreadContexts[i]->base) {
-					all_created = false;
+		workersStarted.wait();
+
+		if (reusePort) {
+			// the kernel spreads connections over the listeners, each accepts into its own worker's base
+			bool listening = true;
+			for (int i = 0; i < threadNum_ && listening; i++) {
+				auto ctx = impl->workerThreadContexts[i];
+				ctx->listener = evconnlistener_new_bind(ctx->base,
+														PrivateImpl::worker_accept_cb,
+														ctx,
+														LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT | LEV_OPT_CLOSE_ON_FREE | LEV_OPT_DISABLED,
+														-1, // backlog, -1 for default
+														(const sockaddr*)(&sin),
+														sizeof(sin));
+				if (!ctx->listener) {
+					msg = name_ + " create listener for worker #" + std::to_string(i) + " failed";
+					JLOG_CRTC(msg);
+					listening = false;
 					break;
 				}
+				evconnlistener_set_error_cb(ctx->listener, PrivateImpl::worker_accept_error_cb);
+				evconnlistener_enable(ctx->listener);
 			}
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			if (!listening) {
+				break;
+			}
+
+			started_ = true;
+			return true;
 		}
 
 		impl->thread = std::thread([this]() {
+			CurrentThread::setName((name_ + "-listen").c_str());
 			JLOG_INFO("{} listen thread started", name_);
 			event_base_dispatch(this->impl->base);
 			JLOG_INFO("{} listen thread exited", name_);
@@ -403,6 +641,12 @@ void simple_libevent_server::stop()
 		impl->thread.join();
 	}
 
+	// closes the listening socket, so the port can be bound again by the next start()
+	if (impl->listener) {
+		evconnlistener_free(impl->listener);
+		impl->listener = nullptr;
+	}
+
 	if (impl->base) {
 		event_base_free(impl->base);
 		impl->base = nullptr;
@@ -418,6 +662,32 @@ void simple_libevent_server::stop()
 		for (int i = 0; i < threadNum_; i++) {
 			JLOG_DBUG("simple_libevent_server::stop joining worker #{}", i);
 			impl->workerThreadContexts[i]->thread.join();
+			if (impl->workerThreadContexts[i]->listener) {
+				evconnlistener_free(impl->workerThreadContexts[i]->listener);
+			}
+			// the worker has exited, so its clients get their disconnect here, as eventcb would have done
+			for (auto client : impl->workerThreadContexts[i]->clients) {
+				if (onConn_) {
+					onConn_(false, "server stopped", client.second, userData_);
+				}
+				bufferevent_free((bufferevent*)((BaseClientPrivateData*)client.second->privateData)->bev);
+				delete client.second;
+			}
+			// hand-offs the loop exited before running, their connections were never set up
+			if (!impl->workerThreadContexts[i]->pendingConnections.empty() || !impl->workerThreadContexts[i]->pendingBroadcasts.empty()) {
+				JLOG_INFO("{} worker #{} exited with {} connections and {} broadcasts pending, dropped", name_, i,
+						  impl->workerThreadContexts[i]->pendingConnections.size(), impl->workerThreadContexts[i]->pendingBroadcasts.size());
+			}
+			for (auto conn : impl->workerThreadContexts[i]->pendingConnections) {
+				evutil_closesocket(conn->fd);
+				delete conn;
+			}
+			for (auto task : impl->workerThreadContexts[i]->pendingBroadcasts) {
+				delete task;
+			}
+			if (impl->workerThreadContexts[i]->ticker) {
+				event_free(impl->workerThreadContexts[i]->ticker);
+			}
 			event_base_free(impl->workerThreadContexts[i]->base);
 			delete impl->workerThreadContexts[i];
 			JLOG_DBUG("simple_libevent_server::stop joined worker #{}", i);
@@ -429,12 +699,44 @@ void simple_libevent_server::stop()
 	delete impl;
 	impl = nullptr;
 
-	for (auto client : clients) {
-		delete client.second;
+	started_ = false;
+}
+
+void simple_libevent_server::broadcast(const SharedBuffer& buffer)
+{
+	std::lock_guard<std::mutex> lg(mutex);
+	if (!impl || !impl->workerThreadContexts || !buffer || buffer->empty()) { return; }
+	const timeval now{ 0, 0 };
+	for (int i = 0; i < threadNum_; i++) {
+		auto ctx = impl->workerThreadContexts[i];
+		auto task = new PrivateImpl::WorkerThreadContext::BroadcastTask{ ctx, buffer };
+		{
+			std::lock_guard<std::mutex> lock(ctx->mutex);
+			ctx->pendingBroadcasts.insert(task);
+		}
+		if (event_base_once(ctx->base, -1, EV_TIMEOUT, PrivateImpl::WorkerThreadContext::broadcastcb, task, &now) != 0) {
+			JLOG_ERRO("{} broadcast cannot schedule on worker #{}", name_, i);
+			{
+				std::lock_guard<std::mutex> lock(ctx->mutex);
+				ctx->pendingBroadcasts.erase(task);
+			}
+			delete task;
+		}
 	}
-	clients.clear();
+}
 
-	started_ = false;
+size_t simple_libevent_server::clientCount() const
+{
+	std::lock_guard<std::mutex> lg(mutex);
+	size_t count = 0;
+	if (impl && impl->workerThreadContexts) {
+		for (int i = 0; i < threadNum_; i++) {
+			auto ctx = impl->workerThreadContexts[i];
+			std::lock_guard<std::mutex> lock(ctx->mutex);
+			count += ctx->clients.size();
+		}
+	}
+	return count;
 }
 
 }
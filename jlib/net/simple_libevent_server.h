@@ -24,8 +24,10 @@
 
 #include <stdint.h>
 #include <string>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 #include <chrono>
 #include <assert.h>
 
@@ -35,6 +37,14 @@ namespace net {
 class simple_libevent_server
 {
 public:
+	// immutable payload shared by any number of sends without copying
+	typedef std::shared_ptr<const std::string> SharedBuffer;
+
+	struct IoVec {
+		const void* data;
+		size_t len;
+	};
+
 	struct BaseClient {
 		explicit BaseClient(int fd, void* bev);
 		virtual ~BaseClient();
@@ -42,9 +52,20 @@ public:
 		static BaseClient* createDefaultClient(int fd, void* bev);
 
 		void send(const void* data, size_t len);
+		// copies count pieces into the output buffer under one lock
+		void sendv(const IoVec* vec, int count);
+		// no copy, the output buffer references buffer until it is written to the socket
+		void send(const SharedBuffer& buffer);
+		// length bytes of file from offset, -1 for the rest, by sendfile if possible, file is closed when sent unless false is returned
+		bool sendFile(int file, int64_t offset = 0, int64_t length = -1);
 		// 0: recv, 1: send, 2: both
 		void shutdown(int what = 0);
+		// O(1) relink in the idle timing wheel, call it in the client's worker thread, e.g. in OnMessageCallback,
+		// debug builds assert that
 		void updateLastTimeComm();
+		// MessageDelivery::Pullup only, the next OnMessageCallback gets at least bytes in one piece,
+		// e.g. call it with the frame size after parsing a length header and return 0
+		void expect(size_t bytes);
 
 		int fd = 0;
 		std::string ip = {};
@@ -60,6 +81,14 @@ public:
 	// return 0 for stop
 	typedef size_t(*OnMessageCallback)(const char* data, size_t len, BaseClient* client, void* user_data);
 
+	// how the input buffer is handed to OnMessageCallback
+	enum class MessageDelivery {
+		//! copied to a 4KB buffer first, a message larger than 4KB can never be consumed
+		Copy,
+		//! a pointer into the input buffer, made contiguous by evbuffer_pullup only when needed, see BaseClient::expect
+		Pullup,
+	};
+
 
 public:
 	explicit simple_libevent_server();
@@ -72,13 +101,23 @@ public:
 	void setUserData(void* d) { userData_ = d; }
 	void setOnConnectionCallback(OnConnectinoCallback cb) { onConn_ = cb; }
 	void setOnMsgCallback(OnMessageCallback cb) { onMsg_ = cb; }
+	void setMessageDelivery(MessageDelivery delivery) { msgDelivery_ = delivery; }
 	void setClientMaxIdleTime(int sec) { maxIdleTime_ = sec; }
 	void setThreadNum(int threads) { assert(threads >= 1); if (threads >= 1) { threadNum_ = threads; } }
+	// worker thread n is pinned to cpus[n % cpus.size()], empty for no pinning
+	void setCpuAffinity(const std::vector<int>& cpus) { cpus_ = cpus; }
+	// every worker thread listens on its own SO_REUSEPORT socket and accepts into its own event_base,
+	// the kernel balances connections, no listen thread. Linux 3.9+, ignored on Windows
+	void setReusePort(bool on) { reusePort_ = on; }
 
 	// call above functions before start()
 	bool start(uint16_t port, std::string& msg);
 	void stop();
 	bool isStarted() const { return started_; }
+	// sends the same buffer to every connected client without copying it, in their worker threads
+	void broadcast(const SharedBuffer& buffer);
+	//! connected clients over all worker threads
+	size_t clientCount() const;
 
 protected:
 	struct PrivateImpl;
@@ -89,6 +128,7 @@ protected:
 	void* userData_ = nullptr;
 	OnConnectinoCallback onConn_ = nullptr;
 	OnMessageCallback onMsg_ = nullptr;
+	MessageDelivery msgDelivery_ = MessageDelivery::Copy;
 	NewClientCallback newClient_ = BaseClient::createDefaultClient;
 
 	//! 客户端最长无数据时间
@@ -97,8 +137,14 @@ protected:
 	//! 工作线程数量
 	int threadNum_ = 1;
 
-	std::mutex mutex = {};
-	std::unordered_map<int, BaseClient*> clients = {};
+	//! 工作线程绑定的CPU
+	std::vector<int> cpus_ = {};
+
+	//! 每个工作线程独立监听端口
+	bool reusePort_ = false;
+
+	//! guards start() and stop(), clients are registered per worker thread
+	mutable std::mutex mutex = {};
 };
 
 }
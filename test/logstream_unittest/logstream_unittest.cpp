@@ -1,7 +1,14 @@
 #include "../../jlib/base/logstream.h"
+#include "../../jlib/base/hexdump.h"
 
 #include <limits>
+#include <random>
+#include <math.h>
+#include <ctype.h>
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define BOOST_TEST_MAIN
 
@@ -111,6 +118,65 @@ BOOST_AUTO_TEST_CASE(testLogStreamIntegerLimits)
 	BOOST_CHECK_EQUAL(buf.toString(), string("000"));
 }
 
+template <typename T>
+static void checkIntegers(std::mt19937_64& rng, const char* fmt)
+{
+	LogStream os;
+	char expected[64];
+	for (int i = 0; i < 200000; ++i) {
+		// every digit count equally likely
+		T v = static_cast<T>(rng() >> (rng() % 64));
+		if (rng() & 1) { v = static_cast<T>(0 - v); }
+		snprintf(expected, sizeof expected, fmt, v);
+		os << v;
+		BOOST_REQUIRE_EQUAL(os.buffer().toString(), string(expected));
+		os.resetBuffer();
+
+		Format f(fmt, v);
+		BOOST_REQUIRE_EQUAL(string(f.data(), f.length()), string(expected));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(testLogStreamIntegersRandom)
+{
+	std::mt19937_64 rng(7);
+	checkIntegers<int16_t>(rng, "%hd");
+	checkIntegers<uint16_t>(rng, "%hu");
+	checkIntegers<int32_t>(rng, "%d");
+	checkIntegers<uint32_t>(rng, "%u");
+	checkIntegers<int64_t>(rng, "%" PRId64);
+	checkIntegers<uint64_t>(rng, "%" PRIu64);
+
+	LogStream os;
+	char expected[64];
+	for (int i = 0; i < 200000; ++i) {
+		uintptr_t v = static_cast<uintptr_t>(rng() >> (rng() % 64));
+		snprintf(expected, sizeof expected, "0x%" PRIXPTR, v);
+		os << reinterpret_cast<const void*>(v);
+		BOOST_REQUIRE_EQUAL(os.buffer().toString(), string(expected));
+		os.resetBuffer();
+	}
+
+	for (uint64_t p = 1, i = 1; i < 20; p *= 10, i++) {
+		BOOST_CHECK_EQUAL(detail::countDigits(p - 1), std::max<int>(1, static_cast<int>(i) - 1));
+		BOOST_CHECK_EQUAL(detail::countDigits(p), static_cast<int>(i));
+	}
+	BOOST_CHECK_EQUAL(detail::countDigits(UINT64_MAX), 20);
+
+	BOOST_CHECK_EQUAL(string(Format("%5d", -42).data()), string("  -42"));
+	BOOST_CHECK_EQUAL(string(Format("%05d", -42).data()), string("-0042"));
+	BOOST_CHECK_EQUAL(string(Format("%x", 255).data()), string("ff"));
+	BOOST_CHECK_EQUAL(string(Format("%d", true).data()), string("1"));
+	BOOST_CHECK_EQUAL(string(Format("%d", false).data()), string("0"));
+	// h and hh narrow values that do not fit, as printf does
+	BOOST_CHECK_EQUAL(string(Format("%hhd", 300).data()), string("44"));
+	BOOST_CHECK_EQUAL(string(Format("%hhd", 200).data()), string("-56"));
+	BOOST_CHECK_EQUAL(string(Format("%hhu", 300u).data()), string("44"));
+	BOOST_CHECK_EQUAL(string(Format("%hd", 70000).data()), string("4464"));
+	BOOST_CHECK_EQUAL(string(Format("%hd", 40000).data()), string("-25536"));
+	BOOST_CHECK_EQUAL(string(Format("%6hu", 70000u).data()), string("  4464"));
+}
+
 BOOST_AUTO_TEST_CASE(testLogStreamFloats)
 {
 	LogStream os;
@@ -151,8 +217,9 @@ BOOST_AUTO_TEST_CASE(testLogStreamFloats)
 	BOOST_CHECK_EQUAL(buf.toString(), string("0.15"));
 	os.resetBuffer();
 
+	// shortest round-trip, not rounded to 12 digits
 	os << a + b;
-	BOOST_CHECK_EQUAL(buf.toString(), string("0.15"));
+	BOOST_CHECK_EQUAL(buf.toString(), string("0.15000000000000002"));
 	os.resetBuffer();
 
 	BOOST_CHECK(a + b != c);
@@ -170,6 +237,117 @@ BOOST_AUTO_TEST_CASE(testLogStreamFloats)
 	os.resetBuffer();
 }
 
+BOOST_AUTO_TEST_CASE(testLogStreamFloatsSpecial)
+{
+	LogStream os;
+	const LogStream::Buffer& buf = os.buffer();
+
+	struct { double v; const char* s; } cases[] = {
+		{ -0.0, "-0" },
+		{ 1e-4, "0.0001" },
+		{ 1.5e-5, "1.5e-05" },
+		{ 123456789012345680.0, "1.2345678901234568e+17" },
+		{ 12345678901234567.0, "12345678901234568" },
+		{ 1e100, "1e+100" },
+		{ 5e-324, "5e-324" },
+		{ std::numeric_limits<double>::max(), "1.7976931348623157e+308" },
+		{ std::numeric_limits<double>::min(), "2.2250738585072014e-308" },
+		{ std::numeric_limits<double>::infinity(), "inf" },
+		{ -std::numeric_limits<double>::infinity(), "-inf" },
+		{ std::numeric_limits<double>::quiet_NaN(), "nan" },
+	};
+
+	for (const auto& c : cases) {
+		os << c.v;
+		BOOST_CHECK_EQUAL(buf.toString(), string(c.s));
+		os.resetBuffer();
+	}
+}
+
+static void checkRoundTrip(LogStream& os, double v)
+{
+	os.resetBuffer();
+	os << v;
+	string s = os.buffer().toString();
+	double back = strtod(s.c_str(), nullptr);
+	BOOST_REQUIRE_MESSAGE(memcmp(&back, &v, sizeof v) == 0, s);
+
+	// never longer than what printf needs to round-trip
+	char expected[64];
+	snprintf(expected, sizeof expected, "%.17g", v);
+	BOOST_REQUIRE_MESSAGE(s.size() <= strlen(expected), s << " vs " << expected);
+}
+
+BOOST_AUTO_TEST_CASE(testLogStreamFloatsRoundTrip)
+{
+	LogStream os;
+
+	// random bit patterns, covers subnormals and every exponent
+	std::mt19937_64 rng(20260101);
+	for (int i = 0; i < 2000000; ++i) {
+		uint64_t u = rng();
+		double v;
+		memcpy(&v, &u, sizeof v);
+		if (v != v || v - v != 0.0) { continue; } // nan, inf
+		checkRoundTrip(os, v);
+	}
+
+	// values typical for latencies and rates
+	std::uniform_real_distribution<double> dist(0.0, 1e6);
+	for (int i = 0; i < 1000000; ++i) {
+		checkRoundTrip(os, dist(rng));
+	}
+
+	// every power of 2 and its neighbours, which have asymmetric boundaries
+	for (int e = -1074; e <= 1023; ++e) {
+		double v = ldexp(1.0, e);
+		checkRoundTrip(os, v);
+		checkRoundTrip(os, nextafter(v, 0.0));
+		checkRoundTrip(os, nextafter(v, std::numeric_limits<double>::infinity()));
+	}
+
+	for (int i = 0; i < 100000; ++i) {
+		checkRoundTrip(os, static_cast<double>(i) / 1000);
+		checkRoundTrip(os, static_cast<double>(i) * 1e10);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(testFormatFixed)
+{
+	std::mt19937_64 rng(42);
+	std::uniform_real_distribution<double> small(-1000.0, 1000.0);
+	std::uniform_int_distribution<int> exp(-30, 62);
+	char fmt[8], expected[512];
+
+	for (int prec = 0; prec <= 9; ++prec) {
+		snprintf(fmt, sizeof fmt, "%%.%df", prec);
+		for (int i = 0; i < 100000; ++i) {
+			double vals[] = {
+				small(rng),
+				ldexp(small(rng), exp(rng)),
+				// ties like 0.125 or 2.5, rounded half to even
+				static_cast<double>(static_cast<int>(small(rng) * 8)) / 8,
+			};
+			for (double v : vals) {
+				snprintf(expected, sizeof expected, fmt, v);
+				if (strlen(expected) >= 32) { continue; }
+				Format f(fmt, v);
+				BOOST_REQUIRE_EQUAL(string(f.data(), f.length()), string(expected));
+			}
+		}
+	}
+
+	BOOST_CHECK_EQUAL(string(Format("%6.2f", -1.005).data()), string(" -1.00"));
+	BOOST_CHECK_EQUAL(string(Format("%.2f", std::numeric_limits<double>::infinity()).data()), string("inf"));
+	BOOST_CHECK_EQUAL(string(Format("%.2f", 0.0).data()), string("0.00"));
+	BOOST_CHECK_EQUAL(string(Format("%.1f", 0.25).data()), string("0.2"));
+	BOOST_CHECK_EQUAL(string(Format("%.1f", 0.35).data()), string("0.3"));
+	// the '0' flag is not a width digit, it pads with zeros
+	BOOST_CHECK_EQUAL(string(Format("%05.2f", 1.5).data()), string("01.50"));
+	BOOST_CHECK_EQUAL(string(Format("%08.3f", -2.25).data()), string("-002.250"));
+	BOOST_CHECK_EQUAL(string(Format("%010.1f", 3.0).data()), string("00000003.0"));
+}
+
 BOOST_AUTO_TEST_CASE(testLogStreamVoid)
 {
 	LogStream os;
@@ -234,6 +412,45 @@ BOOST_AUTO_TEST_CASE(testLogStreamLong)
 	BOOST_CHECK_EQUAL(buf.avail(), 87);
 }
 
+BOOST_AUTO_TEST_CASE(testHexDump)
+{
+	const char* hello = "Hello, world!\r\n\0\xff";
+	BOOST_CHECK_EQUAL(HexDump(hello, 17).toString(), string(
+		"00000000  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  |Hello, world!...|\n"
+		"00000010  FF                                                |.|\n"));
+	BOOST_CHECK_EQUAL(HexDump(hello, 8, HexDump::NO_LIMIT, HexDump::HEX).toString(), string("00000000  48 65 6C 6C 6F 2C 20 77\n"));
+	BOOST_CHECK_EQUAL(HexDump(hello, 17, HexDump::NO_LIMIT, HexDump::ASCII).toString(), string("00000000  |Hello, world!...|\n00000010  |.|\n"));
+	BOOST_CHECK_EQUAL(HexDump(hello, 17, 5, HexDump::HEX).toString(), string("00000000  48 65 6C 6C 6F\n... 12 more bytes\n"));
+	BOOST_CHECK_EQUAL(HexDump(hello, 0).toString(), string());
+
+	string data(5000, 'x');
+	for (size_t i = 0; i < data.size(); i++) { data[i] = static_cast<char>(i * 131); }
+	for (auto columns : { HexDump::HEX, HexDump::ASCII, HexDump::BOTH }) {
+		for (size_t len = 0; len < 40; len++) {
+			HexDump dump(data.data(), len, 33, columns);
+			BOOST_CHECK_EQUAL(dump.toString().size(), dump.size());
+		}
+		HexDump dump(data.data(), data.size(), HexDump::NO_LIMIT, columns);
+		string str = dump.toString();
+		BOOST_CHECK_EQUAL(str.size(), dump.size());
+		BOOST_CHECK_EQUAL(std::count(str.begin(), str.end(), '\n'), 313);
+		BOOST_CHECK_EQUAL(str.substr(str.rfind('\n', str.size() - 2) + 1, 8), string("00001380"));
+	}
+
+	LogStream os;
+	const LogStream::Buffer& buf = os.buffer();
+	os << "frame\n" << HexDump(hello, 17, 16);
+	BOOST_CHECK_EQUAL(buf.toString(), string(
+		"frame\n"
+		"00000000  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  |Hello, world!...|\n"
+		"... 1 more bytes\n"));
+	os.resetBuffer();
+
+	// rows past the end of the buffer are dropped
+	os << HexDump(data.data(), data.size());
+	BOOST_CHECK_EQUAL(buf.length(), 51 * 79);
+}
+
 BOOST_AUTO_TEST_CASE(testFormatSI)
 {
 	BOOST_CHECK_EQUAL(formatSI(0), string("0"));
@@ -249,17 +466,40 @@ BOOST_AUTO_TEST_CASE(testFormatSI)
 	BOOST_CHECK_EQUAL(formatSI(99949), string("99.9k"));
 	BOOST_CHECK_EQUAL(formatSI(99950), string("100k"));
 	BOOST_CHECK_EQUAL(formatSI(100499), string("100k"));
-	// FIXME:
-	// BOOST_CHECK_EQUAL(formatSI(100500), string("101k"));
+	BOOST_CHECK_EQUAL(formatSI(100500), string("101k"));
 	BOOST_CHECK_EQUAL(formatSI(100501), string("101k"));
 	BOOST_CHECK_EQUAL(formatSI(999499), string("999k"));
 	BOOST_CHECK_EQUAL(formatSI(999500), string("1.00M"));
 	BOOST_CHECK_EQUAL(formatSI(1004999), string("1.00M"));
-	// BOOST_CHECK_EQUAL(formatSI(1005000), string("1.01M"));
+	BOOST_CHECK_EQUAL(formatSI(1005000), string("1.01M"));
 	BOOST_CHECK_EQUAL(formatSI(1005001), string("1.01M"));
 	BOOST_CHECK_EQUAL(formatSI(INT64_MAX), string("9.22E"));
 }
 
+BOOST_AUTO_TEST_CASE(testFormatSIIECRandom)
+{
+	// same as printf except exact ties, which are rounded half up
+	std::mt19937_64 rng(99);
+	for (int i = 0; i < 200000; ++i) {
+		int64_t v = static_cast<int64_t>(rng() >> (1 + rng() % 63));
+		for (int iec = 0; iec < 2; ++iec) {
+			string s = iec ? formatIEC(v) : formatSI(v);
+			BOOST_REQUIRE(s.size() <= (iec ? 6u : 5u));
+			double back = strtod(s.c_str(), nullptr);
+			double unit = 1;
+			const char* units = iec ? "KMGTPE" : "kMGTPE";
+			for (const char* u = strchr(units, s[s.size() - (iec ? 2 : 1)]); u && u >= units; --u) {
+				unit *= iec ? 1024 : 1000;
+			}
+			if (!isdigit(static_cast<unsigned char>(s.back()))) {
+				BOOST_REQUIRE_MESSAGE(fabs(back * unit - v) <= unit * 0.0051 * (back < 10 ? 1 : back < 100 ? 10 : 100), v << " " << s);
+			} else {
+				BOOST_REQUIRE_EQUAL(back, static_cast<double>(v));
+			}
+		}
+	}
+}
+
 BOOST_AUTO_TEST_CASE(testFormatIEC)
 {
 	BOOST_CHECK_EQUAL(formatIEC(0), string("0"));
@@ -0,0 +1,85 @@
+#include "../../jlib/base/asynclogging.h"
+#include "../../jlib/base/logging.h"
+#include "../../jlib/base/logfile.h"
+#include "../../jlib/base/countdownlatch.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <thread>
+
+using namespace jlib;
+
+static constexpr off_t kRollSize = 500 * 1000 * 1000;
+
+AsyncLogging* g_asyncLog = nullptr;
+LogFile* g_logFile = nullptr;
+
+void asyncOutput(const char* msg, int len) { g_asyncLog->append(msg, len); }
+void syncOutput(const char* msg, int len) { g_logFile->append(msg, len); }
+void syncFlush() { g_logFile->flush(); }
+
+// latencies in micro-seconds, sorted
+std::vector<long long> bench(const char* name, int nThreads, int linesPerThread)
+{
+	std::vector<std::vector<long long>> latencies(nThreads);
+	std::vector<std::thread> threads;
+	CountDownLatch latch(nThreads);
+	std::string longStr(100, 'X');
+
+	Timestamp start(nowTimestamp());
+	for (int t = 0; t < nThreads; t++) {
+		threads.emplace_back([&, t]() {
+			auto& lat = latencies[t];
+			lat.reserve(linesPerThread);
+			for (int i = 0; i < linesPerThread; i++) {
+				Timestamp begin(nowTimestamp());
+				LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz " << longStr << i;
+				lat.push_back(timeDifference(nowTimestamp(), begin));
+			}
+			latch.countDown();
+		});
+	}
+	latch.wait();
+	Timestamp end(nowTimestamp());
+	for (auto& t : threads) { t.join(); }
+
+	std::vector<long long> all;
+	for (auto& lat : latencies) { all.insert(all.end(), lat.begin(), lat.end()); }
+	std::sort(all.begin(), all.end());
+
+	double seconds = timeDifferenceInS(end, start);
+	size_t n = all.size();
+	printf("%-6s threads=%d lines=%zu %.3fs %.0f lines/s, latency(us) p50=%lld p99=%lld p999=%lld max=%lld\n",
+		   name, nThreads, n, seconds, n / seconds,
+		   all[n / 2], all[n * 99 / 100], all[n * 999 / 1000], all.back());
+	return all;
+}
+
+int main(int argc, char* argv[])
+{
+	int nThreads = argc > 1 ? atoi(argv[1]) : 4;
+	int lines = argc > 2 ? atoi(argv[2]) : 200 * 1000;
+
+	{
+		LogFile logFile("test_logging_sync", kRollSize, true);
+		g_logFile = &logFile;
+		Logger::setOutput(syncOutput);
+		Logger::setFlush(syncFlush);
+		for (int n = 1; n <= nThreads; n *= 2) {
+			bench("sync", n, lines);
+		}
+		logFile.flush();
+	}
+
+	{
+		AsyncLogging log("test_logging_async", kRollSize);
+		g_asyncLog = &log;
+		log.start();
+		Logger::setOutput(asyncOutput);
+		for (int n = 1; n <= nThreads; n *= 2) {
+			bench("async", n, lines);
+		}
+		log.stop();
+		printf("async buffers allocated=%zu, dropped bytes=%zu\n", log.allocatedBuffers(), log.droppedBytes());
+	}
+}
@@ -0,0 +1,205 @@
+#include "../../jlib/base/binarylogging.h"
+#include "../../jlib/base/logging.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <thread>
+
+using namespace jlib;
+
+// test_binarylogging decode file.blog, renders a captured binary log as text
+int decode(const char* filename)
+{
+	BinaryLogDecoder decoder;
+	if (!decoder.open(filename)) {
+		fprintf(stderr, "%s: %s\n", filename, decoder.error().c_str());
+		return 1;
+	}
+	std::string line;
+	while (decoder.next(&line)) {
+		fwrite(line.data(), 1, line.size(), stdout);
+		line.clear();
+	}
+	if (!decoder.error().empty()) {
+		fprintf(stderr, "%s: %s\n", filename, decoder.error().c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int g_failures = 0;
+
+void expect(const std::string& line, const char* message)
+{
+	// skip "2019-01-01 12:00:00.123456(UTC) tid LEVEL "
+	size_t begin = line.find("(UTC) ");
+	begin = line.find(' ', begin + 6) + 1 + 6;
+	size_t end = line.rfind(" - ");
+	std::string actual = line.substr(begin, end - begin);
+	if (actual != message) {
+		printf("FAILED: expected '%s', got '%s'\n", message, actual.c_str());
+		g_failures++;
+	}
+}
+
+void testRoundTrip()
+{
+	const char* filename = "test_binarylogging_roundtrip.blog";
+	remove(filename);
+	const int kThreads = 4, kLines = 10000;
+	{
+		BinaryLogging blog(filename);
+		blog.start();
+
+		std::string str = "std::string";
+		StringPiece piece("StringPiece here", 11);
+		const char* nul = nullptr;
+		BLOG_INFO("no arguments");
+		BLOG_INFO("int %d, negative %d, unsigned %u, int64 %lld", 42, -7, 4000000000u, -9000000000000000000LL);
+		BLOG_INFO("double %.3f %g %e, width [%8.2f]", 3.14159, 0.5, 12345.678, 2.5);
+		BLOG_INFO("strings %s, %s, %s, [%-6s], %s", "literal", str, piece, "ab", nul);
+		BLOG_INFO("hex %x %08X, char %c, bool %d, 100%%", 255, 48879u, 'z', true);
+		BLOG_WARN("mismatched %f %d %s", 7, 2.75, 1);
+		BLOG_ERROR("missing %d %d", 1);
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < kThreads; t++) {
+			threads.emplace_back([t]() {
+				for (int i = 0; i < kLines; i++) {
+					BLOG_INFO("thread %d line %d", t, i);
+				}
+			});
+		}
+		for (auto& t : threads) { t.join(); }
+		blog.stop();
+	}
+
+	BinaryLogDecoder decoder;
+	if (!decoder.open(filename)) {
+		printf("FAILED: %s\n", decoder.error().c_str());
+		g_failures++;
+		return;
+	}
+
+	const char* expected[] = {
+		"no arguments",
+		"int 42, negative -7, unsigned 4000000000, int64 -9000000000000000000",
+		"double 3.142 0.5 1.234568e+04, width [    2.50]",
+		"strings literal, std::string, StringPiece, [ab    ], (null)",
+		"hex ff 0000BEEF, char z, bool 1, 100%",
+		"mismatched 7.000000 2 1",
+		"missing 1 %d",
+	};
+
+	std::string line;
+	for (const char* msg : expected) {
+		line.clear();
+		decoder.next(&line);
+		expect(line, msg);
+	}
+
+	// records of each thread are in order
+	std::vector<int> next(kThreads, 0);
+	int t, i;
+	line.clear();
+	while (decoder.next(&line)) {
+		if (sscanf(line.c_str() + line.find("thread "), "thread %d line %d", &t, &i) != 2 || next[t] != i) {
+			printf("FAILED: out of order %s", line.c_str());
+			g_failures++;
+			break;
+		}
+		next[t]++;
+		line.clear();
+	}
+	if (decoder.records() != 7 + kThreads * kLines || !decoder.error().empty()) {
+		printf("FAILED: %zu records, error '%s'\n", decoder.records(), decoder.error().c_str());
+		g_failures++;
+	}
+	printf("round trip: %zu records, dropped %zu\n", decoder.records(), BinaryLogging::droppedRecords());
+}
+
+size_t g_total = 0;
+void dummyOutput(const char*, int len) { g_total += len; }
+
+// lines per burst, a burst fits in the 1MB ring of a thread, so no record is dropped
+const int kBurst = 4096;
+
+/*
+ hot path cost per statement, the sink is not measured.
+ every thread logs in bursts and sleeps in between so the consumer drains its ring,
+ only the bursts are timed, a record dropped would time the cheaper drop path instead.
+*/
+void bench(int nThreads, int lines)
+{
+	std::string peer = "192.168.1.100:8000";
+	auto run = [&](const char* name, void (*f)(int, const std::string&), size_t droppedBefore) {
+		std::vector<std::vector<long long>> latencies(nThreads);
+		std::vector<long long> busy(nThreads, 0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < nThreads; t++) {
+			threads.emplace_back([&, t]() {
+				auto& lat = latencies[t];
+				lat.reserve(lines / 100);
+				for (int burst = 0; burst < lines; burst += kBurst) {
+					auto burstBegin = std::chrono::steady_clock::now();
+					for (int i = burst; i < std::min(lines, burst + kBurst); i++) {
+						if (i % 100 == 0) {
+							auto begin = std::chrono::steady_clock::now();
+							f(i, peer);
+							lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+						} else {
+							f(i, peer);
+						}
+					}
+					busy[t] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - burstBegin).count();
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				}
+			});
+		}
+		for (auto& t : threads) { t.join(); }
+		std::vector<long long> all;
+		for (auto& lat : latencies) { all.insert(all.end(), lat.begin(), lat.end()); }
+		std::sort(all.begin(), all.end());
+		size_t n = all.size();
+		long long busyTotal = 0;
+		for (auto b : busy) { busyTotal += b; }
+		return [=](size_t droppedAfter) {
+			size_t dropped = droppedAfter - droppedBefore;
+			if (dropped) {
+				printf("%-9s threads=%d dropped %zu of %d records, not timed\n", name, nThreads, dropped, lines * nThreads);
+				return;
+			}
+			printf("%-9s threads=%d %.1f ns/line per thread, latency(ns) p50=%lld p99=%lld p999=%lld\n",
+				   name, nThreads, (double)busyTotal / ((double)lines * nThreads), all[n / 2], all[n * 99 / 100], all[n * 999 / 1000]);
+		};
+	};
+
+	Logger::setOutput(dummyOutput);
+	run("LOG_INFO", [](int i, const std::string& peer) {
+		LOG_INFO << "conn " << i << " from " << peer << " took " << i * 0.001 << " ms";
+	}, 0)(0);
+
+	const char* filename = "test_binarylogging_bench.blog";
+	remove(filename);
+	BinaryLogging blog(filename);
+	blog.start();
+	// droppedRecords() is cumulative and collected by the back end, so take the delta after stop()
+	auto report = run("BLOG_INFO", [](int i, const std::string& peer) {
+		BLOG_INFO("conn %d from %s took %.3f ms", i, peer, i * 0.001);
+	}, BinaryLogging::droppedRecords());
+	blog.stop();
+	report(BinaryLogging::droppedRecords());
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2 && strcmp(argv[1], "decode") == 0) {
+		return decode(argv[2]);
+	}
+
+	testRoundTrip();
+	bench(1, 1000 * 1000);
+	bench(4, 250 * 1000);
+	return g_failures == 0 ? 0 : 1;
+}
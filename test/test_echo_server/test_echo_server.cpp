@@ -0,0 +1,333 @@
+#include "../../jlib/net/simple_libevent_server.h"
+#include "../../jlib/log2.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#define closesocket close
+typedef int socket_t;
+#else
+typedef SOCKET socket_t;
+#endif
+
+using namespace jlib::net;
+
+// echo server throughput, ping-pong clients over loopback
+// usage: test_echo_server [port] [clients] [seconds] [msgSize]
+
+typedef simple_libevent_server::MessageDelivery MessageDelivery;
+
+// user_data is the message size, only whole messages are echoed
+size_t onMessageCallback(const char* data, size_t len, simple_libevent_server::BaseClient* client, void* user_data)
+{
+	size_t msgSize = *(const size_t*)user_data;
+	if (len < msgSize) {
+		client->expect(msgSize);
+		return 0;
+	}
+	size_t ate = len - len % msgSize;
+	client->send(data, ate);
+	return ate;
+}
+
+// without TCP_NODELAY the tail of a large echo waits for the client's delayed ACK
+void onConnectionCallback(bool up, const std::string&, simple_libevent_server::BaseClient* client, void*)
+{
+	if (up) {
+		int on = 1;
+		setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	}
+}
+
+socket_t connectTo(uint16_t port)
+{
+	socket_t fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in sin = { 0 };
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	if (connect(fd, (const sockaddr*)&sin, sizeof(sin)) != 0) {
+		closesocket(fd);
+		return (socket_t)-1;
+	}
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	return fd;
+}
+
+bool recvAll(socket_t fd, char* buff, size_t len)
+{
+	size_t received = 0;
+	while (received < len) {
+		int n = recv(fd, buff + received, (int)(len - received), 0);
+		if (n <= 0) { return false; }
+		received += n;
+	}
+	return true;
+}
+
+//! each client sends msgSize bytes and waits for replySize bytes to come back
+void pingPong(uint16_t port, size_t msgSize, size_t replySize, std::atomic<bool>& running, std::atomic<long long>& messages)
+{
+	socket_t fd = connectTo(port);
+	if (fd == (socket_t)-1) {
+		fprintf(stderr, "connect failed\n");
+		return;
+	}
+
+	std::vector<char> msg(msgSize, 'x'), buff(replySize);
+	long long count = 0;
+	while (running) {
+		if (send(fd, msg.data(), (int)msg.size(), 0) != (int)msg.size()) { break; }
+		if (!recvAll(fd, buff.data(), replySize)) { break; }
+		count++;
+	}
+	closesocket(fd);
+	messages += count;
+}
+
+double runClients(uint16_t port, int clients, int seconds, size_t msgSize, size_t replySize)
+{
+	std::atomic<bool> running(true);
+	std::atomic<long long> messages(0);
+	std::vector<std::thread> threadsOfClients;
+	for (int i = 0; i < clients; i++) {
+		threadsOfClients.emplace_back(pingPong, port, msgSize, replySize, std::ref(running), std::ref(messages));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	running = false;
+	for (auto& t : threadsOfClients) {
+		t.join();
+	}
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return messages / elapsed;
+}
+
+double benchEcho(uint16_t port, int threads, int clients, int seconds, size_t msgSize, MessageDelivery delivery)
+{
+	simple_libevent_server server;
+	server.setName("echo");
+	server.setThreadNum(threads);
+	server.setClientMaxIdleTime(seconds + 60);
+	server.setUserData(&msgSize);
+	server.setOnConnectionCallback(onConnectionCallback);
+	server.setOnMsgCallback(onMessageCallback);
+	server.setMessageDelivery(delivery);
+	std::string msg;
+	if (!server.start(port, msg)) {
+		fprintf(stderr, "%s\n", msg.data());
+		exit(1);
+	}
+
+	double qps = runClients(port, clients, seconds, msgSize, msgSize);
+	server.stop();
+
+	printf("threads=%d clients=%d msgSize=%zu delivery=%s messages/s=%.0f MiB/s=%.1f\n",
+		   threads, clients, msgSize, delivery == MessageDelivery::Copy ? "copy" : "pullup",
+		   qps, qps * msgSize / 1024 / 1024);
+	return qps;
+}
+
+//! each client connects, waits for one byte echoed, then resets the connection, over and over
+void connectLoop(uint16_t port, std::atomic<bool>& running, std::atomic<long long>& connections)
+{
+	long long count = 0;
+	char c = 'c';
+	while (running) {
+		socket_t fd = connectTo(port);
+		if (fd == (socket_t)-1) { continue; }
+		// RST instead of FIN, or TIME_WAIT runs out of local ports
+		linger lg = { 1, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, (const char*)&lg, sizeof(lg));
+		if (send(fd, &c, 1, 0) == 1 && recvAll(fd, &c, 1)) {
+			count++;
+		}
+		closesocket(fd);
+	}
+	connections += count;
+}
+
+void benchConnect(uint16_t port, int threads, int clients, int seconds, bool reusePort)
+{
+	size_t msgSize = 1;
+	simple_libevent_server server;
+	server.setName("connect");
+	server.setThreadNum(threads);
+	server.setReusePort(reusePort);
+	server.setClientMaxIdleTime(seconds + 60);
+	server.setUserData(&msgSize);
+	server.setOnMsgCallback(onMessageCallback);
+	std::string msg;
+	if (!server.start(port, msg)) {
+		fprintf(stderr, "%s\n", msg.data());
+		exit(1);
+	}
+
+	std::atomic<bool> running(true);
+	std::atomic<long long> connections(0);
+	std::vector<std::thread> threadsOfClients;
+	for (int i = 0; i < clients; i++) {
+		threadsOfClients.emplace_back(connectLoop, port, std::ref(running), std::ref(connections));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	running = false;
+	for (auto& t : threadsOfClients) {
+		t.join();
+	}
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	server.stop();
+
+	printf("connect threads=%d clients=%d acceptor=%s connects/s=%.0f\n",
+		   threads, clients, reusePort ? "reuseport" : "listen thread", connections / elapsed);
+}
+
+// user_data is the payload, every byte received is answered with it, copied or shared
+template <bool shared>
+size_t onRequestCallback(const char*, size_t len, simple_libevent_server::BaseClient* client, void* user_data)
+{
+	auto payload = (const simple_libevent_server::SharedBuffer*)user_data;
+	for (size_t i = 0; i < len; i++) {
+		if (shared) {
+			client->send(*payload);
+		} else {
+			client->send((*payload)->data(), (*payload)->size());
+		}
+	}
+	return len;
+}
+
+void benchPayload(uint16_t port, int clients, int seconds, size_t payloadSize, bool shared)
+{
+	auto payload = std::make_shared<const std::string>(payloadSize, 'p');
+	simple_libevent_server server;
+	server.setName("payload");
+	server.setClientMaxIdleTime(seconds + 60);
+	server.setUserData(&payload);
+	server.setOnConnectionCallback(onConnectionCallback);
+	server.setOnMsgCallback(shared ? onRequestCallback<true> : onRequestCallback<false>);
+	std::string msg;
+	if (!server.start(port, msg)) {
+		fprintf(stderr, "%s\n", msg.data());
+		exit(1);
+	}
+
+	double qps = runClients(port, clients, seconds, 1, payloadSize);
+	server.stop();
+
+	printf("static payload clients=%d size=%zu send=%s replies/s=%.0f MiB/s=%.1f\n",
+		   clients, payloadSize, shared ? "shared" : "copy", qps, qps * payloadSize / 1024 / 1024);
+}
+
+// every client receives rounds broadcasts of the same payloadSize buffer
+void benchBroadcast(uint16_t port, int threads, int clients, int rounds, size_t payloadSize)
+{
+	simple_libevent_server server;
+	server.setName("broadcast");
+	server.setThreadNum(threads);
+	server.setClientMaxIdleTime(600);
+	server.setOnConnectionCallback(onConnectionCallback);
+	std::string msg;
+	if (!server.start(port, msg)) {
+		fprintf(stderr, "%s\n", msg.data());
+		exit(1);
+	}
+
+	std::atomic<long long> received(0);
+	std::atomic<int> failed(0);
+	std::vector<std::thread> receivers;
+	for (int i = 0; i < clients; i++) {
+		receivers.emplace_back([port, rounds, payloadSize, &received, &failed]() {
+			socket_t fd = connectTo(port);
+			if (fd == (socket_t)-1) {
+				failed++;
+				return;
+			}
+			// a connection the server never accepted must not block the join forever
+#ifdef _WIN32
+			DWORD timeout = 5000;
+#else
+			timeval timeout = { 5, 0 };
+#endif
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+			std::vector<char> buff(payloadSize);
+			int count = 0;
+			while (count < rounds && recvAll(fd, buff.data(), payloadSize)) {
+				count++;
+			}
+			closesocket(fd);
+			received += count;
+		});
+	}
+	// failed receivers count themselves out, the deadline covers anything else
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (server.clientCount() + failed < (size_t)clients && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (failed > 0) {
+		fprintf(stderr, "broadcast: %d of %d receivers could not connect\n", (int)failed, clients);
+	}
+
+	auto payload = std::make_shared<const std::string>(payloadSize, 'b');
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) {
+		server.broadcast(payload);
+	}
+	for (auto& t : receivers) {
+		t.join();
+	}
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	server.stop();
+
+	printf("broadcast threads=%d clients=%d size=%zu rounds=%d received=%lld MiB/s=%.1f\n",
+		   threads, clients, payloadSize, rounds, (long long)received,
+		   received * payloadSize / elapsed / 1024 / 1024);
+}
+
+int main(int argc, char** argv)
+{
+	uint16_t port = 9982;
+	int clients = 16;
+	int seconds = 3;
+	size_t msgSize = 64;
+	if (argc > 1) { port = (uint16_t)atoi(argv[1]); }
+	if (argc > 2) { clients = atoi(argv[2]); }
+	if (argc > 3) { seconds = atoi(argv[3]); }
+	if (argc > 4) { msgSize = (size_t)atoi(argv[4]); }
+
+	jlib::get_logger()->set_level(spdlog::level::warn);
+
+	printf("hardware_concurrency=%u\n", std::thread::hardware_concurrency());
+	double base = 0;
+	for (int threads : { 1, 2, 4, 8 }) {
+		double qps = benchEcho(port, threads, clients, seconds, msgSize, MessageDelivery::Pullup);
+		if (base == 0) { base = qps; }
+		printf("  speedup over 1 thread: %.2fx\n", base > 0 ? qps / base : 0.0);
+	}
+
+	// the copy delivery cannot hand over a message larger than its 4KB buffer
+	for (size_t size : { 64, 4096, 65536 }) {
+		if (size <= 4096) {
+			benchEcho(port, 1, clients, seconds, size, MessageDelivery::Copy);
+		}
+		benchEcho(port, 1, clients, seconds, size, MessageDelivery::Pullup);
+	}
+
+	for (size_t size : { 4096, 65536 }) {
+		benchPayload(port, clients, seconds, size, false);
+		benchPayload(port, clients, seconds, size, true);
+	}
+	benchBroadcast(port, 2, clients, 1000, 65536);
+
+	for (int threads : { 1, 2, 4 }) {
+		benchConnect(port, threads, clients, seconds, false);
+		benchConnect(port, threads, clients, seconds, true);
+	}
+}
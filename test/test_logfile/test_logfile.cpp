@@ -1,7 +1,32 @@
 #include "../../jlib/base/logfile.h"
 #include "../../jlib/base/logging.h"
+#include <thread>
+#include <chrono>
+
+using namespace jlib;
+
+std::unique_ptr<LogFile> g_logFile;
+
+void outputFunc(const char* msg, int len)
+{
+	g_logFile->append(msg, len);
+}
+
+void flushFunc()
+{
+	g_logFile->flush();
+}
 
 int main()
 {
+	g_logFile.reset(new LogFile("test_logfile", 200 * 1000));
+	Logger::setOutput(outputFunc);
+	Logger::setFlush(flushFunc);
+
+	std::string line = "1234567890 abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
 
+	for (int i = 0; i < 10000; ++i) {
+		LOG_INFO << line << i;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
 }
@@ -1,9 +1,140 @@
 #include "../../jlib/base/logging.h"
 #include "../../jlib/base/threadpool.h"
 #include "../../jlib/base/timezone.h"
+#include <thread>
 
 using namespace jlib;
 
+size_t g_total = 0;
+
+void dummyOutput(const char*, int len)
+{
+	g_total += len;
+}
+
+// lines/second of formatting a whole log line, output discarded
+void bench(const char* type)
+{
+	Logger::setOutput(dummyOutput);
+	const int n = 1000 * 1000;
+	const bool kLongLog = false;
+	std::string empty = " ";
+	std::string longStr(3000, 'X');
+	longStr += " ";
+	g_total = 0;
+
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < n; ++i) {
+		LOG_INFO << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz"
+			<< (kLongLog ? longStr : empty)
+			<< i;
+	}
+	Timestamp end(nowTimestamp());
+	double seconds = timeDifferenceInS(end, start);
+	printf("%12s: %f seconds, %zu bytes, %10.2f lines/s, %.2f MiB/s\n",
+		   type, seconds, g_total, n / seconds, g_total / seconds / (1024 * 1024));
+}
+
+// the line of bench() as Logger::Impl formatted it before caching, date::format for every line
+void uncachedLine(int i)
+{
+	LogStream os;
+	os << format("%F %T(%Z) ", nowTimestamp());
+	CurrentThread::tid();
+	os << jlib::detail::T(CurrentThread::tidString(), CurrentThread::tidStringLength());
+	os << jlib::detail::T(jlib::detail::LogLevelName[Logger::LOGLEVEL_INFO], 6);
+	os << "Hello 0123456789" << " abcdefghijklmnopqrstuvwxyz" << " " << i;
+	os << " - " << Logger::SourceFile(__FILE__) << ':' << __LINE__ << '\n';
+	dummyOutput(os.buffer().data(), os.buffer().length());
+}
+
+// lines/second of whole log lines, the timestamp formatted per line before caching and by Logger now
+void benchFormatTime()
+{
+	const int n = 1000 * 1000;
+	g_total = 0;
+
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < n; ++i) {
+		uncachedLine(i);
+	}
+	Timestamp end(nowTimestamp());
+	double seconds = timeDifferenceInS(end, start);
+	printf("%12s: %f seconds, %zu bytes, %10.2f lines/s, %.2f MiB/s\n",
+		   "date::format", seconds, g_total, n / seconds, g_total / seconds / (1024 * 1024));
+
+	bench("cached");
+}
+
+int g_evaluated = 0;
+
+int sideEffect()
+{
+	return ++g_evaluated;
+}
+
+// cost of statements below the level, they should not format or evaluate anything
+void benchDisabled()
+{
+	const int n = 100 * 1000 * 1000;
+	g_evaluated = 0;
+	Timestamp start(nowTimestamp());
+	for (int i = 0; i < n; ++i) {
+		LOG_DEBUG << "disabled " << sideEffect();
+	}
+	Timestamp end(nowTimestamp());
+	double seconds = timeDifferenceInS(end, start);
+	printf("%12s: %f seconds, %.2f ns/statement, evaluated %d times\n", "disabled", seconds, seconds * 1e9 / n, g_evaluated);
+}
+
+void moduleLevels()
+{
+	Logger::setLogLevel(Logger::LOGLEVEL_WARN);
+	LOG_DEBUG << "not shown, global level is WARN";
+
+	Logger::setModuleLogLevel("test_logging.cpp", Logger::LOGLEVEL_DEBUG);
+	LOG_DEBUG << "shown, module test_logging.cpp is DEBUG";
+	LOG_TRACE << "not shown, module test_logging.cpp is DEBUG";
+
+	Logger::setModuleLogLevel("test_logging.cpp", Logger::LOGLEVEL_ERROR);
+	LOG_WARN << "not shown, module test_logging.cpp is ERROR";
+	LOG_ERROR << "shown, module test_logging.cpp is ERROR";
+
+	Logger::setModuleLogLevel("test_logging.cpp", Logger::LOGLEVEL_INFO);
+	Logger::setLogLevel(Logger::LOGLEVEL_INFO);
+}
+
+int g_lines = 0;
+std::string g_lastLine;
+
+void countingOutput(const char* msg, int len)
+{
+	g_lines++;
+	g_lastLine.assign(msg, len);
+}
+
+// an error storm of 100000 identical lines in 0.2 seconds
+void sampling()
+{
+	Logger::setOutput(countingOutput);
+	auto storm = [](const char* name, void (*f)(int)) {
+		g_lines = 0;
+		Timestamp start(nowTimestamp());
+		for (int i = 0; i < 100000; i++) {
+			f(i);
+			if (i % 1000 == 0) { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }
+		}
+		double seconds = timeDifferenceInS(nowTimestamp(), start);
+		printf("%16s: %d of 100000 lines emitted in %.2fs, last: %s", name, g_lines, seconds, g_lastLine.c_str());
+	};
+
+	storm("LOG_EVERY_N", [](int i) { LOG_EVERY_N(ERROR, 10000) << "storm " << i; });
+	storm("LOG_FIRST_N", [](int i) { LOG_FIRST_N(ERROR, 3) << "storm " << i; });
+	storm("LOG_EVERY_T", [](int i) { LOG_EVERY_T(ERROR, 0.05) << "storm " << i; });
+	storm("LOG_RATELIMITED", [](int i) { LOG_RATELIMITED(ERROR, 20, 5) << "storm " << i; });
+	Logger::setOutput(jlib::detail::defaultOutput);
+}
+
 int main()
 {
 	Logger::setLogLevel(Logger::LOGLEVEL_TRACE);
@@ -17,4 +148,18 @@ int main()
 	LOG_INFO << sizeof(LogStream);
 	LOG_INFO << sizeof(Format);
 	LOG_INFO << sizeof(LogStream::Buffer);
-}
\ No newline at end of file
+
+	Logger::setTimeZone(*locate_zone("Asia/Shanghai"));
+	LOG_INFO << "Asia/Shanghai, date::format gives " << format("%F %T(%Z)", make_zoned(locate_zone("Asia/Shanghai"), nowTimestamp()));
+	Logger::setTimeZone(*locate_zone("America/New_York"));
+	LOG_INFO << "America/New_York, date::format gives " << format("%F %T(%Z)", make_zoned(locate_zone("America/New_York"), nowTimestamp()));
+	Logger::setTimeZone(*locate_zone("Etc/UTC"));
+	LOG_INFO << "Etc/UTC";
+
+	moduleLevels();
+	sampling();
+
+	Logger::setLogLevel(Logger::LOGLEVEL_INFO);
+	benchDisabled();
+	benchFormatTime();
+}
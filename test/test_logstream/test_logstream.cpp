@@ -1,6 +1,13 @@
 #include "../../jlib/base/logstream.h"
 #include "../../jlib/base/timestamp.h"
+#include "../../jlib/base/hexdump.h"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 using namespace jlib;
 
@@ -49,6 +56,187 @@ void benchLogStream()
 	printf("benchLogStream %s\n", format("%S", (end - start)).c_str());
 }
 
+// doubles with a fractional part, like latencies in ms
+std::vector<double> g_doubles;
+
+void benchDoublePrintf(const char* fmt)
+{
+	char buf[32];
+	Timestamp start(nowTimestamp());
+	for (double d : g_doubles)
+		snprintf(buf, sizeof buf, fmt, d);
+	Timestamp end(nowTimestamp());
+
+	printf("benchPrintf(%s) %s\n", fmt, format("%S", (end - start)).c_str());
+}
+
+void benchDoubleStringStream()
+{
+	Timestamp start(nowTimestamp());
+	std::ostringstream os;
+	os.precision(17);
+	for (double d : g_doubles) {
+		os << d;
+		os.seekp(0, std::ios_base::beg);
+	}
+	Timestamp end(nowTimestamp());
+
+	printf("benchStringStream(precision 17) %s\n", format("%S", (end - start)).c_str());
+}
+
+void benchDoubleLogStream()
+{
+	Timestamp start(nowTimestamp());
+	LogStream os;
+	for (double d : g_doubles) {
+		os << d;
+		os.resetBuffer();
+	}
+	Timestamp end(nowTimestamp());
+
+	printf("benchLogStream(shortest) %s\n", format("%S", (end - start)).c_str());
+}
+
+void benchFormat(const char* fmt)
+{
+	Timestamp start(nowTimestamp());
+	LogStream os;
+	for (double d : g_doubles) {
+		os << Format(fmt, d);
+		os.resetBuffer();
+	}
+	Timestamp end(nowTimestamp());
+
+	printf("benchFormat(%s) %s\n", fmt, format("%S", (end - start)).c_str());
+}
+
+// the previous convert(), Matthew Wilson's one digit per division and std::reverse
+template <typename T>
+size_t convertWilson(char buf[], T value)
+{
+	static const char digits[] = "9876543210123456789";
+	static const char* zero = digits + 9;
+	T i = value;
+	char *p = buf;
+	do {
+		int lsd = static_cast<int>(i % 10);
+		i /= 10; *p++ = zero[lsd];
+	} while (i != 0);
+	if (value < 0) { *p++ = '-'; }
+	*p = '\0';
+	std::reverse(buf, p);
+	return p - buf;
+}
+
+size_t convertHexWilson(char buf[], uintptr_t value)
+{
+	static const char digitsHex[] = "0123456789ABCDEF";
+	uintptr_t i = value;
+	char *p = buf;
+	do {
+		int lsd = static_cast<int>(i % 16);
+		i /= 16; *p++ = digitsHex[lsd];
+	} while (i != 0);
+	*p = '\0';
+	std::reverse(buf, p);
+	return p - buf;
+}
+
+// integers of every digit count, like sizes, ids and addresses
+template <typename T>
+std::vector<T> randomIntegers()
+{
+	std::mt19937_64 rng(2);
+	std::vector<T> v;
+	v.reserve(N);
+	for (size_t i = 0; i < N; ++i) {
+		v.push_back(static_cast<T>(rng() >> (rng() % 64)));
+	}
+	return v;
+}
+
+template <typename T, typename F>
+void benchConvert(const char* name, const std::vector<T>& values, F f)
+{
+	char buf[32];
+	size_t total = 0;
+	Timestamp start(nowTimestamp());
+	for (T v : values) {
+		total += f(buf, v);
+	}
+	Timestamp end(nowTimestamp());
+
+	printf("%s %s %zu\n", name, format("%S", (end - start)).c_str(), total);
+}
+
+void benchIntegers()
+{
+	puts("int32_t, random width");
+	auto i32 = randomIntegers<int32_t>();
+	benchConvert("snprintf", i32, [](char* buf, int32_t v) { return (size_t)snprintf(buf, 32, "%d", v); });
+	benchConvert("wilson  ", i32, [](char* buf, int32_t v) { return convertWilson(buf, v); });
+	benchConvert("pairs   ", i32, [](char* buf, int32_t v) { return jlib::detail::convert(buf, v); });
+
+	puts("int64_t, random width");
+	auto i64 = randomIntegers<int64_t>();
+	benchConvert("snprintf", i64, [](char* buf, int64_t v) { return (size_t)snprintf(buf, 32, "%" PRId64, v); });
+	benchConvert("wilson  ", i64, [](char* buf, int64_t v) { return convertWilson(buf, v); });
+	benchConvert("pairs   ", i64, [](char* buf, int64_t v) { return jlib::detail::convert(buf, v); });
+
+	puts("pointer, random width");
+	auto ptrs = randomIntegers<uintptr_t>();
+	benchConvert("snprintf", ptrs, [](char* buf, uintptr_t v) { return (size_t)snprintf(buf, 32, "%" PRIXPTR, v); });
+	benchConvert("wilson  ", ptrs, [](char* buf, uintptr_t v) { return convertHexWilson(buf, v); });
+	benchConvert("pairs   ", ptrs, [](char* buf, uintptr_t v) { return jlib::detail::convertHex(buf, v); });
+
+	puts("Format(\"%d\")");
+	benchConvert("snprintf", i32, [](char* buf, int32_t v) { return (size_t)snprintf(buf, 32, "%d", v); });
+	benchConvert("Format  ", i32, [](char*, int32_t v) { return (size_t)Format("%d", v).length(); });
+
+	puts("formatSI");
+	auto sizes = randomIntegers<int64_t>();
+	for (auto& v : sizes) { v &= INT64_MAX; }
+	benchConvert("formatSI ", sizes, [](char*, int64_t v) { return formatSI(v).size(); });
+	benchConvert("formatIEC", sizes, [](char*, int64_t v) { return formatIEC(v).size(); });
+}
+
+// the sprintf + strcat loop log.h used to dump with
+std::string dumpStrcat(const char* buff, size_t buff_len)
+{
+	std::unique_ptr<char[]> output(new char[buff_len * 6 + 64]);
+	output[0] = 0;
+	char c[64];
+	for (size_t i = 0; i < buff_len; i++) {
+		sprintf(c, "%02X ", static_cast<unsigned char>(buff[i]));
+		strcat(output.get(), c);
+		if (i > 0 && (i + 1) % 16 == 0) {
+			strcat(output.get(), "\n");
+		}
+	}
+	return output.get();
+}
+
+void benchHexDump()
+{
+	for (size_t len : { 64, 1024, 4096, 65536 }) {
+		std::string data(len, '\0');
+		for (size_t i = 0; i < len; i++) { data[i] = static_cast<char>(i * 131); }
+		const int n = static_cast<int>(64 * 1024 * 1024 / len / (len > 4096 ? 64 : 1));
+		size_t total = 0;
+		Timestamp start(nowTimestamp());
+		for (int i = 0; i < n; i++) {
+			total += dumpStrcat(data.data(), len).size();
+		}
+		Timestamp mid(nowTimestamp());
+		for (int i = 0; i < n; i++) {
+			total += HexDump(data.data(), len).toString().size();
+		}
+		Timestamp end(nowTimestamp());
+		printf("dump %6zu bytes: strcat %8.1f ns/byte, HexDump %5.2f ns/byte %zu\n", len,
+			   timeDifferenceInS(mid, start) * 1e9 / n / len, timeDifferenceInS(end, mid) * 1e9 / n / len, total);
+	}
+}
+
 int main()
 {
 	benchPrintf<int>("%d");
@@ -63,6 +251,22 @@ int main()
 	benchStringStream<double>();
 	benchLogStream<double>();
 
+	puts("double, fractional");
+	std::mt19937_64 rng(1);
+	std::exponential_distribution<double> dist(0.01);
+	g_doubles.reserve(N);
+	for (size_t i = 0; i < N; ++i) {
+		g_doubles.push_back(dist(rng));
+	}
+	benchDoublePrintf("%.12g");
+	benchDoublePrintf("%.17g");
+	benchDoubleStringStream();
+	benchDoubleLogStream();
+	benchDoublePrintf("%.2f");
+	benchFormat("%.2f");
+	benchDoublePrintf("%.6f");
+	benchFormat("%.6f");
+
 	puts("int64_t");
 	benchPrintf<int64_t>("%" PRId64);
 	benchStringStream<int64_t>();
@@ -73,4 +277,7 @@ int main()
 	benchStringStream<void*>();
 	benchLogStream<void*>();
 
+	benchIntegers();
+	benchHexDump();
+
 }
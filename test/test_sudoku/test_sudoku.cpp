@@ -1,8 +1,10 @@
 #include "../../jlib/misc/sudoku.h"
+#include "../../jlib/base/parallel.h"
 #include <chrono>
 #include <fstream>
 #include <sstream>
 #include <stdio.h>
+#include <thread>
 
 
 std::vector<std::string> solved_gridss{};
@@ -97,6 +99,25 @@ std::vector<std::string> from_file(std::string path) {
     return res;
 }
 
+// batch solve on every core, one parallel_for over the puzzles, the Helper is read only while solving
+void solve_all_parallel(const std::vector<std::string>& grids, std::string name, int threads) {
+    static jlib::misc::sudoku::Helper helper;
+    std::vector<std::string> solved(grids.size());
+    std::vector<char> ok(grids.size(), 0);
+    jlib::ThreadPool pool("sudoku");
+    pool.start(threads - 1); // the calling thread works too
+
+    auto start = std::chrono::steady_clock::now();
+    jlib::parallel_for(pool, size_t(0), grids.size(), size_t(1), [&](size_t i) {
+        ok[i] = jlib::misc::sudoku::solve(grids[i], solved[i], &helper);
+    });
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    pool.stop();
+
+    printf("parallel solved %d of %zu %s puzzles with %d threads, total %.2fms, %.1f puzzles/s\n",
+           (int)std::count(ok.begin(), ok.end(), 1), grids.size(), name.c_str(), threads, us / 1000.0, grids.size() * 1e6 / (us > 0 ? us : 1));
+}
+
 int main(int argc, char** argv)
 {
     int show_if = 0;
@@ -109,6 +130,14 @@ int main(int argc, char** argv)
     solve_all(from_file("./hardest.txt"), "hardest", show_if);
     solve_all(jlib::misc::sudoku::random_puzzles(99), "random", show_if);
 
+    auto batch = from_file("./top95.txt");
+    auto hardest = from_file("./hardest.txt");
+    batch.insert(batch.end(), hardest.begin(), hardest.end());
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= (cores > 1 ? cores : 1); threads *= 2) {
+        solve_all_parallel(batch, "top95+hardest", threads);
+    }
+
 
     //std::string grid1 = "003020600900305001001806400008102900700000008006708200002609500800203009005010300";
     std::string grid1 = "..3.2.6..9..3.5..1..18.64....81.29..7.......8..67.82....26.95..8..2.3..9..5.1.3..";
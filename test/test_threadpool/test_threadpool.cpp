@@ -1,9 +1,17 @@
-
+﻿
 #include "../../jlib/base/logging.h"
 #include "../../jlib/base/threadpool.h"
 #include "../../jlib/base/countdownlatch.h"
 #include "../../jlib/base/currentthread.h"
 #include "../../jlib/base/process.h"
+#include "../../jlib/base/parallel.h"
+#include "../../jlib/base/synchronization.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <vector>
 
 using namespace jlib;
 using namespace std::chrono;
@@ -43,6 +51,335 @@ void test(int maxSize) {
 	LOG_WARN << "All Done\n\n";
 }
 
+std::atomic<int> g_pending;
+CountDownLatch* g_done;
+
+void leaf() {
+	volatile int sum = 0;
+	for (int i = 0; i < 200; i++) { sum += i; }
+	if (g_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		g_done->countDown();
+	}
+}
+
+// binary tree of tasks, every inner task run()s two children from inside the pool
+void spawn(ThreadPool* pool, int depth) {
+	if (depth == 0) {
+		leaf();
+	} else {
+		pool->run(std::bind(spawn, pool, depth - 1));
+		pool->run(std::bind(spawn, pool, depth - 1));
+	}
+}
+
+const char* modeName(ThreadPool::Mode mode) {
+	switch (mode) {
+	case ThreadPool::SHARED_QUEUE: return "SHARED_QUEUE";
+	case ThreadPool::WORK_STEALING: return "WORK_STEALING";
+	case ThreadPool::LOCK_FREE_QUEUE: return "LOCK_FREE_QUEUE";
+	}
+	return "";
+}
+
+// fan-out to kTasks small tasks then fan-in on one latch, from outside (flat) and from inside (tree) the pool
+void benchFanOut(ThreadPool::Mode mode, int nThreads) {
+	const int kDepth = 16, kTasks = 1 << kDepth;
+	ThreadPool pool("bench");
+	pool.setMode(mode);
+	pool.start(nThreads);
+
+	auto measure = [&](std::function<void()> fanOut) {
+		CountDownLatch done(1);
+		g_done = &done;
+		g_pending = kTasks;
+		auto start = steady_clock::now();
+		fanOut();
+		done.wait();
+		return duration_cast<nanoseconds>(steady_clock::now() - start).count() / double(kTasks);
+	};
+
+	double flat = measure([&]() {
+		for (int i = 0; i < kTasks; i++) { pool.run(leaf); }
+	});
+	double tree = measure([&]() {
+		pool.run(std::bind(spawn, &pool, kDepth));
+	});
+	pool.stop();
+
+	printf("%-15s threads=%2d flat %7.1f ns/task, tree %7.1f ns/task\n",
+		   modeName(mode), nThreads, flat, tree);
+}
+
+// producers run() tiny tasks into a bounded pool of consumers
+void benchContention(ThreadPool::Mode mode, int producers, int consumers) {
+	const int kTasks = 1 << 18;
+	ThreadPool pool("contention");
+	pool.setMode(mode);
+	pool.setMaxQueueSize(1024);
+	pool.start(consumers);
+
+	CountDownLatch done(1);
+	g_done = &done;
+	g_pending = kTasks;
+	auto start = steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++) {
+		threads.emplace_back([&pool, producers]() {
+			for (int i = 0; i < kTasks / producers; i++) {
+				pool.run(leaf);
+			}
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	done.wait();
+	double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() / double(kTasks);
+	pool.stop();
+	printf("%-15s producers=%d consumers=%d %7.1f ns/task\n", modeName(mode), producers, consumers, ns);
+}
+
+// one run() per element and a latch, against one chunked parallel_for
+void benchParallelFor(int nThreads) {
+	const int n = 1 << 20;
+	std::vector<float> data(n, 1.0f);
+	ThreadPool pool("parallel_for");
+	pool.start(nThreads);
+
+	auto start = steady_clock::now();
+	CountDownLatch latch(n);
+	for (int i = 0; i < n; i++) {
+		pool.run([&data, &latch, i]() { data[i] = data[i] * 0.5f + 1.0f; latch.countDown(); });
+	}
+	latch.wait();
+	auto mid = steady_clock::now();
+	parallel_for(pool, 0, n, 4096, [&data](int i) { data[i] = data[i] * 0.5f + 1.0f; });
+	auto end = steady_clock::now();
+	pool.stop();
+
+	printf("threads=%2d run()+latch %6.1f ns/element, parallel_for %5.2f ns/element\n", nThreads,
+		   duration_cast<nanoseconds>(mid - start).count() / double(n), duration_cast<nanoseconds>(end - mid).count() / double(n));
+}
+
+// enqueue-to-start latency of sparse urgent tasks while a loader keeps the pool saturated with 20us bulk tasks
+void benchPriority(int probePriority) {
+	const int kProbes = 1000, kBacklog = 256;
+	ThreadPool pool("priority");
+	pool.start(4);
+
+	std::atomic<bool> loading(true);
+	std::thread loader([&]() {
+		while (loading) {
+			if (pool.queueSize() < kBacklog) {
+				pool.run([]() {
+					auto end = steady_clock::now() + microseconds(20);
+					while (steady_clock::now() < end) {}
+				});
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	std::vector<long long> latencies(kProbes);
+	CountDownLatch done(kProbes);
+	for (int i = 0; i < kProbes; i++) {
+		auto enqueued = steady_clock::now();
+		pool.run([&latencies, &done, enqueued, i]() {
+			latencies[i] = duration_cast<microseconds>(steady_clock::now() - enqueued).count();
+			done.countDown();
+		}, probePriority);
+		std::this_thread::sleep_for(microseconds(500));
+	}
+	done.wait();
+	loading = false;
+	loader.join();
+	pool.stop();
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("probe priority %d: latency(us) p50=%lld p99=%lld max=%lld\n", probePriority,
+		   latencies[kProbes / 2], latencies[kProbes * 99 / 100], latencies.back());
+}
+
+// cost of scheduling and cancelling 100k timers, then how late the rest fire
+void benchTimers() {
+	const int kTimers = 100 * 1000;
+	ThreadPool pool("timers");
+	pool.start(4);
+	std::mt19937 rng(1);
+	std::vector<TimerId> ids(kTimers);
+	std::vector<steady_clock::time_point> deadlines(kTimers);
+	std::vector<long long> lateness(kTimers, -1);
+	CountDownLatch done(kTimers / 2);
+
+	auto start = steady_clock::now();
+	for (int i = 0; i < kTimers; i++) {
+		auto delay = milliseconds(200 + rng() % 800);
+		deadlines[i] = steady_clock::now() + delay;
+		ids[i] = pool.runAfter(delay, [&lateness, &deadlines, &done, i]() {
+			lateness[i] = duration_cast<microseconds>(steady_clock::now() - deadlines[i]).count();
+			done.countDown();
+		});
+	}
+	auto scheduled = steady_clock::now();
+	for (int i = 1; i < kTimers; i += 2) {
+		pool.cancel(ids[i]);
+	}
+	auto cancelled = steady_clock::now();
+	done.wait();
+	pool.stop();
+
+	std::vector<long long> fired;
+	for (int i = 0; i < kTimers; i += 2) { fired.push_back(lateness[i]); }
+	std::sort(fired.begin(), fired.end());
+	size_t n = fired.size();
+	printf("timers: schedule %.1f ns/op, cancel %.1f ns/op, lateness(us) p50=%lld p99=%lld max=%lld\n",
+		   duration_cast<nanoseconds>(scheduled - start).count() / double(kTimers),
+		   duration_cast<nanoseconds>(cancelled - scheduled).count() / double(kTimers / 2),
+		   fired[n / 2], fired[n * 99 / 100], fired.back());
+}
+
+// bursts of 1ms blocking tasks separated by idle periods, a fixed pool of 8 against an elastic one of 1 to 8
+void benchElastic(bool elastic) {
+	const int kBursts = 3, kTasks = 400;
+	ThreadPool pool("elastic");
+	pool.setIdleTimeout(milliseconds(100));
+	if (elastic) {
+		pool.start(1, 8);
+	} else {
+		pool.start(8);
+	}
+	for (int b = 0; b < kBursts; b++) {
+		CountDownLatch done(kTasks);
+		auto start = steady_clock::now();
+		for (int i = 0; i < kTasks; i++) {
+			pool.run([&done]() {
+				std::this_thread::sleep_for(milliseconds(1));
+				done.countDown();
+			});
+		}
+		done.wait();
+		auto busy = duration_cast<milliseconds>(steady_clock::now() - start).count();
+		size_t threads = pool.threadCount();
+		std::this_thread::sleep_for(milliseconds(300));
+		printf("%s burst %d: %lld ms, %zu threads after the burst, %zu after idling, peak %zu, started %zu, retired %zu\n",
+			   elastic ? "elastic" : "fixed", b, static_cast<long long>(busy), threads, pool.threadCount(),
+			   pool.peakThreadCount(), pool.threadsStarted(), pool.threadsRetired());
+	}
+	pool.stop();
+}
+
+// per-task cost of metrics with empty tasks, then the stats of a pool running 100us tasks
+void benchMetrics(ThreadPool::Mode mode) {
+	const int kTasks = 1 << 18;
+	for (int on = 0; on < 2; on++) {
+		ThreadPool pool("metrics");
+		pool.setMode(mode);
+		pool.setMetricsEnabled(on != 0);
+		pool.start(4);
+		CountDownLatch done(kTasks);
+		auto start = steady_clock::now();
+		for (int i = 0; i < kTasks; i++) {
+			pool.run([&done]() { done.countDown(); });
+		}
+		done.wait();
+		auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+		pool.stop();
+		printf("%-16s metrics %-3s %6.1f ns/task\n", modeName(mode), on ? "on" : "off", ns / double(kTasks));
+	}
+
+	ThreadPool pool("metrics");
+	pool.setMode(mode);
+	pool.setMetricsEnabled(true);
+	pool.start(4);
+	CountDownLatch done(2000);
+	for (int i = 0; i < 2000; i++) {
+		pool.run([&done]() {
+			auto end = steady_clock::now() + microseconds(100);
+			while (steady_clock::now() < end) {}
+			done.countDown();
+		});
+	}
+	done.wait();
+	pool.stop();
+	printf("%s", pool.stats().toString().c_str());
+}
+
+// the mutex/condvar counterparts of Semaphore and Barrier
+class MutexSemaphore {
+public:
+	explicit MutexSemaphore(int permits) : permits_(permits) {}
+	void acquire() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this]() { return permits_ > 0; });
+		permits_--;
+	}
+	void release() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		permits_++;
+		cv_.notify_one();
+	}
+private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	int permits_;
+};
+
+class MutexBarrier {
+public:
+	explicit MutexBarrier(int count) : count_(count), arrived_(0), generation_(0) {}
+	void arriveAndWait() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		int generation = generation_;
+		if (++arrived_ == count_) {
+			arrived_ = 0;
+			generation_++;
+			cv_.notify_all();
+		} else {
+			cv_.wait(lock, [this, generation]() { return generation_ != generation; });
+		}
+	}
+private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	int count_, arrived_, generation_;
+};
+
+template <typename F>
+double nsPerOp(int ops, F f) {
+	auto start = steady_clock::now();
+	f();
+	return duration_cast<nanoseconds>(steady_clock::now() - start).count() / double(ops);
+}
+
+// nThreads threads hammering one primitive: fan-in countDown(), a semaphore of nThreads / 2 permits, barrier phases
+void benchSynchronization(int nThreads) {
+	const int kOps = 1 << 16;
+	auto onThreads = [nThreads](std::function<void()> body) {
+		std::vector<std::thread> threads;
+		for (int t = 0; t < nThreads; t++) { threads.emplace_back(body); }
+		for (auto& t : threads) { t.join(); }
+	};
+
+	CountDownLatch cdl(nThreads * kOps);
+	double cdlNs = nsPerOp(nThreads * kOps, [&]() { onThreads([&]() { for (int i = 0; i < kOps; i++) { cdl.countDown(); } }); cdl.wait(); });
+	Latch latch(nThreads * kOps);
+	double latchNs = nsPerOp(nThreads * kOps, [&]() { onThreads([&]() { for (int i = 0; i < kOps; i++) { latch.countDown(); } }); latch.wait(); });
+
+	int permits = std::max(nThreads / 2, 1);
+	MutexSemaphore msem(permits);
+	double msemNs = nsPerOp(nThreads * kOps, [&]() { onThreads([&]() { for (int i = 0; i < kOps; i++) { msem.acquire(); msem.release(); } }); });
+	Semaphore sem(permits);
+	double semNs = nsPerOp(nThreads * kOps, [&]() { onThreads([&]() { for (int i = 0; i < kOps; i++) { sem.acquire(); sem.release(); } }); });
+
+	const int kPhases = 1 << 12;
+	MutexBarrier mbar(nThreads);
+	double mbarNs = nsPerOp(kPhases, [&]() { onThreads([&]() { for (int i = 0; i < kPhases; i++) { mbar.arriveAndWait(); } }); });
+	Barrier bar(nThreads);
+	double barNs = nsPerOp(kPhases, [&]() { onThreads([&]() { for (int i = 0; i < kPhases; i++) { bar.arriveAndWait(); } }); });
+
+	printf("threads=%2d countDown %6.1f -> %6.1f ns, acquire+release %7.1f -> %7.1f ns, barrier phase %8.1f -> %8.1f ns\n",
+		   nThreads, cdlNs, latchNs, msemNs, semNs, mbarNs, barNs);
+}
+
 int main()
 {
 	Logger::setLogLevel(Logger::LOGLEVEL_DEBUG);
@@ -53,4 +390,35 @@ int main()
 	//test(10);
 	test(50);
 
+	for (int n = 1; n <= 64; n *= 2) {
+		benchFanOut(ThreadPool::SHARED_QUEUE, n);
+		benchFanOut(ThreadPool::WORK_STEALING, n);
+	}
+
+	for (int n = 1; n <= 8; n *= 2) {
+		benchParallelFor(n);
+	}
+
+	benchPriority(0);
+	benchPriority(ThreadPool::PRIORITY_LEVELS - 1);
+
+	benchTimers();
+
+	benchElastic(false);
+	benchElastic(true);
+
+	benchMetrics(ThreadPool::SHARED_QUEUE);
+	benchMetrics(ThreadPool::WORK_STEALING);
+	benchMetrics(ThreadPool::LOCK_FREE_QUEUE);
+
+	for (int n = 1; n <= 8; n *= 2) {
+		benchSynchronization(n);
+	}
+
+	const int ratios[][2] = { { 1, 1 }, { 1, 4 }, { 4, 1 }, { 4, 4 }, { 8, 8 }, { 16, 4 } };
+	for (auto& r : ratios) {
+		benchContention(ThreadPool::SHARED_QUEUE, r[0], r[1]);
+		benchContention(ThreadPool::LOCK_FREE_QUEUE, r[0], r[1]);
+	}
+
 }
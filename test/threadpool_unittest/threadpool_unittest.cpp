@@ -0,0 +1,824 @@
+﻿#include "../../jlib/base/threadpool.h"
+#include "../../jlib/base/countdownlatch.h"
+#include "../../jlib/base/parallel.h"
+#include "../../jlib/base/synchronization.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+using namespace jlib;
+
+// every allocation in this process is counted
+std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1)) { return p; }
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return ::operator new(size); }
+
+// every form of delete, so none of them reaches the library's and frees memory it did not allocate
+// gcc inlines these into callers and then pairs the free() with operator new, a false positive
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+struct Payload
+{
+	char bytes[40];
+};
+
+BOOST_AUTO_TEST_CASE(testTaskInline)
+{
+	int called = 0;
+	Payload payload = {};
+	payload.bytes[0] = 1;
+	auto small = [&called, payload]() { called += payload.bytes[0]; };
+	static_assert(sizeof(small) == 48, "capture of 48 bytes");
+	BOOST_CHECK(Task::fitsInline<decltype(small)>());
+
+	size_t before = g_allocations.load();
+	Task task(small);
+	Task moved(std::move(task));
+	moved();
+	BOOST_CHECK_EQUAL(g_allocations.load() - before, 0u);
+	BOOST_CHECK(!task);
+	BOOST_CHECK(moved.isInline());
+	BOOST_CHECK_EQUAL(called, 1);
+
+	char big[64] = { 2 };
+	Task large([&called, big]() { called += big[0]; });
+	BOOST_CHECK(!large.isInline());
+	BOOST_CHECK_EQUAL(g_allocations.load() - before, 1u);
+	Task moved2(std::move(large));
+	moved2();
+	BOOST_CHECK_EQUAL(g_allocations.load() - before, 1u);
+	BOOST_CHECK_EQUAL(called, 3);
+}
+
+BOOST_AUTO_TEST_CASE(testTaskMoveOnly)
+{
+	std::unique_ptr<int> p(new int(42));
+	int result = 0;
+	Task task([&result, p = std::move(p)]() { result = *p; });
+	BOOST_CHECK(task.isInline());
+	Task other;
+	other = std::move(task);
+	other();
+	BOOST_CHECK_EQUAL(result, 42);
+
+	std::function<void()> empty;
+	void (*null)() = nullptr;
+	BOOST_CHECK(!Task(empty));
+	BOOST_CHECK(!Task(null));
+	BOOST_CHECK(!Task(nullptr));
+}
+
+BOOST_AUTO_TEST_CASE(testTaskDestroysCapture)
+{
+	auto counter = std::make_shared<int>(0);
+	{
+		Task task([counter]() {});
+		BOOST_CHECK_EQUAL(counter.use_count(), 2);
+		Task moved(std::move(task));
+		BOOST_CHECK_EQUAL(counter.use_count(), 2);
+	}
+	BOOST_CHECK_EQUAL(counter.use_count(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(testRunAllocations)
+{
+	const int n = 10000;
+	std::atomic<int> sum(0);
+	Payload payload = {};
+	payload.bytes[0] = 1;
+
+	// no worker threads, run() calls the task in place
+	ThreadPool inlinePool;
+	inlinePool.start(0);
+	size_t before = g_allocations.load();
+	for (int i = 0; i < n; i++) {
+		inlinePool.run([&sum, payload]() { sum += payload.bytes[0]; });
+	}
+	BOOST_CHECK_EQUAL(g_allocations.load() - before, 0u);
+	inlinePool.stop();
+
+	// only the blocks of the std::deque queue remain, not one allocation per task
+	ThreadPool pool;
+	pool.start(2);
+	before = g_allocations.load();
+	for (int i = 0; i < n; i++) {
+		pool.run([&sum, payload]() { sum += payload.bytes[0]; });
+	}
+	CountDownLatch latch(1);
+	pool.run([&latch]() { latch.countDown(); });
+	latch.wait();
+	size_t allocations = g_allocations.load() - before;
+	BOOST_TEST_MESSAGE("allocations per run(): " << double(allocations) / n);
+	BOOST_CHECK_LT(allocations, size_t(n / 4));
+	pool.stop();
+	BOOST_CHECK_EQUAL(sum.load(), 2 * n);
+}
+
+BOOST_AUTO_TEST_CASE(testSubmit)
+{
+	for (auto mode : { ThreadPool::SHARED_QUEUE, ThreadPool::WORK_STEALING, ThreadPool::LOCK_FREE_QUEUE }) {
+		ThreadPool pool;
+		pool.setMode(mode);
+		pool.start(4);
+
+		auto sum = pool.submit([](int a, int b) { return a + b; }, 1, 2);
+		auto str = pool.submit([](std::string s) { return s + "!"; }, std::string("hello"));
+		auto moved = pool.submit([](std::unique_ptr<int> p) { return *p; }, std::unique_ptr<int>(new int(7)));
+		auto thrown = pool.submit([]() -> int { throw std::runtime_error("boom"); });
+		int value = 0;
+		auto none = pool.submit([&value]() { value = 1; });
+
+		BOOST_CHECK_EQUAL(sum.get(), 3);
+		BOOST_CHECK_EQUAL(str.get(), "hello!");
+		BOOST_CHECK_EQUAL(moved.get(), 7);
+		BOOST_CHECK_THROW(thrown.get(), std::runtime_error);
+		none.get();
+		BOOST_CHECK_EQUAL(value, 1);
+
+		// submit from inside the pool
+		auto nested = pool.submit([&pool]() { return pool.submit([]() { return 5; }).get(); });
+		BOOST_CHECK_EQUAL(nested.get(), 5);
+		pool.stop();
+	}
+}
+
+BOOST_AUTO_TEST_CASE(testSubmitAllocations)
+{
+	ThreadPool pool;
+	pool.start(0);
+	size_t before = g_allocations.load();
+	auto future = pool.submit([](int a) { return a * 2; }, 21);
+	// the shared state of the future (libstdc++ allocates its result slot separately), nothing for the task itself
+	BOOST_CHECK_LE(g_allocations.load() - before, 2u);
+	BOOST_CHECK_EQUAL(future.get(), 42);
+}
+
+BOOST_AUTO_TEST_CASE(testBoundedMpmcQueue)
+{
+	BoundedMpmcQueue<std::unique_ptr<int>> queue(5);
+	BOOST_CHECK_EQUAL(queue.capacity(), 8u);
+	for (int i = 0; i < 8; i++) {
+		BOOST_CHECK(queue.tryPush(std::unique_ptr<int>(new int(i))));
+	}
+	std::unique_ptr<int> item(new int(8));
+	BOOST_CHECK(!queue.tryPush(std::move(item)));
+	BOOST_CHECK(item); // not moved from on failure
+	BOOST_CHECK_EQUAL(queue.size(), 8u);
+	for (int i = 0; i < 8; i++) {
+		BOOST_CHECK(queue.tryPop(item));
+		BOOST_CHECK_EQUAL(*item, i);
+	}
+	BOOST_CHECK(!queue.tryPop(item));
+
+	// leftovers are destroyed with the queue
+	auto counter = std::make_shared<int>(0);
+	{
+		BoundedMpmcQueue<std::shared_ptr<int>> q(4);
+		q.tryPush(counter);
+		q.tryPush(counter);
+		BOOST_CHECK_EQUAL(counter.use_count(), 3);
+	}
+	BOOST_CHECK_EQUAL(counter.use_count(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(testBoundedMpmcQueueBlocking)
+{
+	// a tiny queue so producers and consumers both park
+	BoundedMpmcQueue<int> queue(4);
+	const int kProducers = 4, kConsumers = 3, kItems = 20000;
+	std::atomic<long long> sum(0);
+	std::atomic<int> popped(0);
+	std::vector<std::thread> threads;
+	for (int c = 0; c < kConsumers; c++) {
+		threads.emplace_back([&]() {
+			int item;
+			while (queue.pop(item)) {
+				sum += item;
+				popped++;
+			}
+		});
+	}
+	std::vector<std::thread> producers;
+	for (int p = 0; p < kProducers; p++) {
+		producers.emplace_back([&]() {
+			for (int i = 1; i <= kItems; i++) {
+				queue.push(i);
+			}
+		});
+	}
+	for (auto& t : producers) { t.join(); }
+	while (queue.size() > 0) { std::this_thread::yield(); }
+	queue.close();
+	for (auto& t : threads) { t.join(); }
+	BOOST_CHECK_EQUAL(popped.load(), kProducers * kItems);
+	BOOST_CHECK_EQUAL(sum.load(), kProducers * (long long)kItems * (kItems + 1) / 2);
+	BOOST_CHECK(!queue.push(1));
+}
+
+BOOST_AUTO_TEST_CASE(testParallelFor)
+{
+	for (auto mode : { ThreadPool::SHARED_QUEUE, ThreadPool::WORK_STEALING }) {
+		for (int threads : { 0, 1, 4 }) {
+			ThreadPool pool;
+			pool.setMode(mode);
+			pool.start(threads);
+			for (int grain : { 1, 7, 1000, 100000 }) {
+				std::vector<std::atomic<int>> hits(10007);
+				for (auto& h : hits) { h = 0; }
+				parallel_for(pool, 0, 10007, grain, [&hits](int i) { hits[i]++; });
+				BOOST_CHECK(std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& h) { return h == 1; }));
+			}
+
+			int called = 0;
+			parallel_for(pool, 5, 5, 1, [&called](int) { called++; });
+			parallel_for(pool, 5, 3, 1, [&called](int) { called++; });
+			BOOST_CHECK_EQUAL(called, 0);
+
+			// nested inside pool tasks, the callers participate so nothing deadlocks
+			std::atomic<int> sum(0);
+			parallel_for(pool, 0, 16, 1, [&pool, &sum](int) {
+				parallel_for(pool, 0, 100, 10, [&sum](int j) { sum += j; });
+			});
+			BOOST_CHECK_EQUAL(sum.load(), 16 * 4950);
+
+			BOOST_CHECK_THROW(parallel_for(pool, 0, 1000, 1, [](int i) {
+				if (i == 500) { throw std::runtime_error("500"); }
+			}), std::runtime_error);
+			pool.stop();
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(testParallelReduce)
+{
+	ThreadPool pool;
+	pool.start(4);
+	long long n = 1000000;
+	long long sum = parallel_reduce(pool, 1LL, n + 1, 1000LL, 0LL,
+		[](long long b, long long e, long long acc) {
+			for (long long i = b; i < e; i++) { acc += i; }
+			return acc;
+		},
+		[](long long a, long long b) { return a + b; });
+	BOOST_CHECK_EQUAL(sum, n * (n + 1) / 2);
+
+	int maxValue = parallel_reduce(pool, 0, 1000, 10, -1,
+		[](int, int e, int acc) { return std::max(acc, e - 1); },
+		[](int a, int b) { return std::max(a, b); });
+	BOOST_CHECK_EQUAL(maxValue, 999);
+	BOOST_CHECK_EQUAL(parallel_reduce(pool, 0, 0, 1, 42, [](int, int, int acc) { return acc; }, [](int a, int b) { return a + b; }), 42);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSort)
+{
+	ThreadPool pool;
+	pool.start(3);
+	std::mt19937 rng(1);
+	for (size_t n : { 0, 1, 100, 5000, 300001 }) {
+		std::vector<int> v(n);
+		for (auto& x : v) { x = static_cast<int>(rng() % 1000); }
+		std::vector<int> expected = v;
+		std::sort(expected.begin(), expected.end());
+		parallel_sort(pool, v.begin(), v.end(), std::less<int>(), 1000);
+		BOOST_CHECK(v == expected);
+	}
+
+	std::vector<std::string> words;
+	for (int i = 0; i < 100000; i++) { words.push_back(std::to_string(rng())); }
+	std::vector<std::string> expected = words;
+	std::sort(expected.begin(), expected.end(), std::greater<std::string>());
+	parallel_sort(pool, words.begin(), words.end(), std::greater<std::string>());
+	BOOST_CHECK(words == expected);
+	pool.stop();
+}
+
+// one worker held by a gate task while the queue fills, then the execution order is recorded
+std::vector<int> runOrdered(ThreadPool& pool, const std::vector<std::pair<int, int>>& tasks, int sleepAfterFirstMs = 0)
+{
+	std::mutex mutex;
+	std::vector<int> order;
+	CountDownLatch gate(1), started(1), done(static_cast<int>(tasks.size()));
+	pool.run([&]() { started.countDown(); gate.wait(); });
+	started.wait();
+	for (size_t i = 0; i < tasks.size(); i++) {
+		int id = tasks[i].first;
+		pool.run([&, id]() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				order.push_back(id);
+			}
+			done.countDown();
+		}, tasks[i].second);
+		if (i == 0 && sleepAfterFirstMs > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(sleepAfterFirstMs));
+		}
+	}
+	gate.countDown();
+	done.wait();
+	return order;
+}
+
+BOOST_AUTO_TEST_CASE(testPriority)
+{
+	ThreadPool pool;
+	pool.start(1);
+	// { id, priority }
+	auto order = runOrdered(pool, { { 1, 0 }, { 2, 3 }, { 3, 7 }, { 4, 3 }, { 5, 0 }, { 6, 99 }, { 7, -5 } });
+	std::vector<int> expected = { 3, 6, 2, 4, 1, 5, 7 }; // out of range priorities are clamped
+	BOOST_CHECK(order == expected);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testPriorityAging)
+{
+	ThreadPool pool;
+	pool.setAgingInterval(std::chrono::milliseconds(1));
+	pool.start(1);
+	// the low priority task waited 20 intervals, more than the 7 levels between them
+	auto order = runOrdered(pool, { { 1, 0 }, { 2, 7 }, { 3, 7 } }, 20);
+	BOOST_CHECK_EQUAL(order.front(), 1);
+	pool.stop();
+
+	ThreadPool noAging;
+	noAging.setAgingInterval(std::chrono::milliseconds(0));
+	noAging.start(1);
+	order = runOrdered(noAging, { { 1, 0 }, { 2, 7 }, { 3, 7 } }, 20);
+	BOOST_CHECK_EQUAL(order.back(), 1);
+	noAging.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testPriorityWorkStealing)
+{
+	ThreadPool pool;
+	pool.setMode(ThreadPool::WORK_STEALING);
+	pool.start(1);
+	// from inside a worker, the prioritized task overtakes the local deque
+	std::vector<int> order;
+	CountDownLatch done(1);
+	pool.run([&]() {
+		for (int i = 0; i < 5; i++) {
+			pool.run([&order, i]() { order.push_back(i); });
+		}
+		pool.run([&order]() { order.push_back(100); }, 5);
+		pool.run([&done]() { done.countDown(); });
+	});
+	done.wait();
+	pool.stop(); // before reading order, deque pops are LIFO so some tasks may still be running
+	BOOST_REQUIRE(!order.empty());
+	BOOST_CHECK_EQUAL(order.front(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(testTimerHeap)
+{
+	// random pushes and removals, pops must come out ordered
+	std::mt19937 rng(7);
+	std::vector<std::unique_ptr<jlib::detail::Timer>> timers;
+	jlib::detail::TimerHeap heap;
+	auto now = std::chrono::steady_clock::now();
+	for (uint64_t i = 1; i <= 1000; i++) {
+		timers.emplace_back(new jlib::detail::Timer(i, now + std::chrono::microseconds(rng() % 100), std::chrono::steady_clock::duration::zero(), Task()));
+		heap.push(timers.back().get());
+	}
+	for (size_t i = 0; i < timers.size(); i += 3) {
+		heap.remove(timers[i].get());
+	}
+	BOOST_CHECK_EQUAL(heap.size(), 666u);
+	const jlib::detail::Timer* last = nullptr;
+	while (!heap.empty()) {
+		auto top = heap.top();
+		if (last) {
+			BOOST_REQUIRE(last->when < top->when || (last->when == top->when && last->id < top->id));
+		}
+		heap.remove(top);
+		last = top;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(testRunAfter)
+{
+	ThreadPool pool;
+	pool.start(2);
+	std::mutex mutex;
+	std::vector<int> order;
+	CountDownLatch done(3);
+	auto record = [&](int id) {
+		return [&, id]() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				order.push_back(id);
+			}
+			done.countDown();
+		};
+	};
+	auto start = std::chrono::steady_clock::now();
+	pool.runAfter(std::chrono::milliseconds(60), record(3));
+	pool.runAfter(std::chrono::milliseconds(20), record(1));
+	pool.runAt(std::chrono::system_clock::now() + std::chrono::milliseconds(40), record(2));
+	done.wait();
+	BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(60));
+	std::vector<int> expected = { 1, 2, 3 };
+	BOOST_CHECK(order == expected);
+	BOOST_CHECK_EQUAL(pool.timerCount(), 0u);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testTimerCancel)
+{
+	ThreadPool pool;
+	pool.start(1);
+	std::atomic<int> fired(0);
+	auto cancelled = pool.runAfter(std::chrono::milliseconds(30), [&]() { fired += 100; });
+	auto kept = pool.runAfter(std::chrono::milliseconds(10), [&]() { fired++; });
+	BOOST_CHECK(cancelled.valid());
+	BOOST_CHECK(pool.cancel(cancelled));
+	BOOST_CHECK(!pool.cancel(cancelled));
+	BOOST_CHECK(!pool.cancel(TimerId()));
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	BOOST_CHECK_EQUAL(fired.load(), 1);
+	BOOST_CHECK(!pool.cancel(kept)); // already fired
+
+	// pending timers are dropped by stop()
+	pool.runAfter(std::chrono::hours(1), [&]() { fired += 1000; });
+	BOOST_CHECK_EQUAL(pool.timerCount(), 1u);
+	pool.stop();
+	BOOST_CHECK_EQUAL(pool.timerCount(), 0u);
+	BOOST_CHECK(!pool.runAfter(std::chrono::milliseconds(1), []() {}).valid());
+}
+
+BOOST_AUTO_TEST_CASE(testRunEvery)
+{
+	ThreadPool pool;
+	pool.start(2);
+	std::atomic<int> ticks(0);
+	CountDownLatch done(5);
+	auto id = pool.runEvery(std::chrono::milliseconds(5), [&]() {
+		if (++ticks <= 5) { done.countDown(); }
+	});
+	done.wait();
+	BOOST_CHECK(pool.cancel(id));
+	int seen = ticks.load();
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	BOOST_CHECK_LE(ticks.load(), seen + 1); // a tick dispatched before cancel() may still run
+
+	// a slow callback does not overlap itself, ticks are skipped instead
+	std::atomic<int> running(0), overlapped(0), slowTicks(0);
+	id = pool.runEvery(std::chrono::milliseconds(1), [&]() {
+		if (running++ > 0) { overlapped++; }
+		slowTicks++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		running--;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	pool.cancel(id);
+	pool.stop();
+	BOOST_CHECK_EQUAL(overlapped.load(), 0);
+	BOOST_CHECK_GT(slowTicks.load(), 0);
+	BOOST_CHECK_LT(slowTicks.load(), 20);
+}
+
+BOOST_AUTO_TEST_CASE(testElastic)
+{
+	ThreadPool pool;
+	pool.setGrowThreshold(2, std::chrono::milliseconds(2));
+	pool.setIdleTimeout(std::chrono::milliseconds(50));
+	pool.start(1, 4);
+	BOOST_CHECK(pool.elastic());
+	BOOST_CHECK_EQUAL(pool.threadCount(), 1u);
+
+	// a burst backs the queue up, workers are added up to the maximum
+	CountDownLatch done(200);
+	for (int i = 0; i < 200; i++) {
+		pool.run([&done]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			done.countDown();
+		});
+	}
+	done.wait();
+	BOOST_CHECK_GT(pool.peakThreadCount(), 1u);
+	BOOST_CHECK_LE(pool.peakThreadCount(), 4u);
+	BOOST_CHECK_EQUAL(pool.threadsStarted(), pool.peakThreadCount());
+
+	// idle workers above the minimum retire
+	for (int i = 0; i < 100 && pool.threadCount() > 1; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_CHECK_EQUAL(pool.threadCount(), 1u);
+	BOOST_CHECK_EQUAL(pool.threadsRetired(), pool.threadsStarted() - 1);
+	BOOST_CHECK_EQUAL(pool.queueSize(), 0u);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testElasticFromZero)
+{
+	ThreadPool pool;
+	pool.setIdleTimeout(std::chrono::milliseconds(20));
+	pool.start(0, 2);
+	BOOST_CHECK_EQUAL(pool.threadCount(), 0u);
+	for (int round = 0; round < 2; round++) {
+		// the first task starts a worker, which retires once idle
+		auto f = pool.submit([]() { return std::this_thread::get_id(); });
+		BOOST_CHECK(f.get() != std::this_thread::get_id());
+		for (int i = 0; i < 100 && pool.threadCount() > 0; i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		BOOST_CHECK_EQUAL(pool.threadCount(), 0u);
+	}
+	BOOST_CHECK_EQUAL(pool.threadsStarted(), 2u);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testThreadNameAffinityCpuTime)
+{
+	ThreadPool pool("named");
+	pool.setCpuAffinity({ 0 }, true);
+	pool.start(2);
+
+	// busy for 20ms of CPU time
+	auto burn = []() {
+		auto start = CurrentThread::cpuTime();
+		while (CurrentThread::cpuTime() - start < std::chrono::milliseconds(20)) {}
+		return std::string(CurrentThread::name());
+	};
+	auto name = pool.submit(burn).get();
+	BOOST_CHECK(name == "named1" || name == "named2");
+
+#ifdef JLIB_LINUX
+	auto osName = pool.submit([]() {
+		char buf[16] = { 0 };
+		pthread_getname_np(pthread_self(), buf, sizeof(buf));
+		return std::string(buf);
+	}).get();
+	BOOST_CHECK(osName == "named1" || osName == "named2");
+
+	auto cpus = pool.submit([]() {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		sched_getaffinity(0, sizeof(set), &set);
+		return CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set);
+	}).get();
+	BOOST_CHECK(cpus);
+#endif
+
+	auto stats = pool.threadStats();
+	BOOST_REQUIRE_EQUAL(stats.size(), 2u);
+	std::chrono::nanoseconds total(0);
+	for (auto& s : stats) {
+		BOOST_CHECK(s.name == "named1" || s.name == "named2");
+		BOOST_CHECK(s.tid != 0 && s.tid != CurrentThread::tid());
+		total += s.cpuTime;
+	}
+	BOOST_CHECK(stats[0].name != stats[1].name);
+	BOOST_CHECK(total >= std::chrono::milliseconds(20));
+	pool.stop();
+
+	CurrentThread::setName("longer than fifteen bytes");
+	BOOST_CHECK_EQUAL(std::string(CurrentThread::name()), "longer than fifteen bytes");
+}
+
+BOOST_AUTO_TEST_CASE(testHistogram)
+{
+	BOOST_CHECK_EQUAL(Histogram::bucketOf(0), 0);
+	BOOST_CHECK_EQUAL(Histogram::bucketOf(1), 1);
+	BOOST_CHECK_EQUAL(Histogram::bucketOf(3), 2);
+	BOOST_CHECK_EQUAL(Histogram::bucketOf(1024), 11);
+	BOOST_CHECK_EQUAL(Histogram::bucketOf(~0ULL), Histogram::BUCKETS - 1);
+
+	Histogram h;
+	for (uint64_t i = 1; i <= 1000; i++) {
+		h.add(i * 1000); // 1us to 1ms
+	}
+	BOOST_CHECK_EQUAL(h.count(), 1000u);
+	BOOST_CHECK_EQUAL(h.max(), 1000000u);
+	BOOST_CHECK_CLOSE(h.mean(), 500500.0, 0.01);
+	// within a factor of 2 above the exact value
+	BOOST_CHECK(h.percentile(50) >= 500000 && h.percentile(50) < 1000000);
+	BOOST_CHECK(h.percentile(99) >= 990000 && h.percentile(99) <= 1000000);
+	BOOST_CHECK_EQUAL(h.percentile(100), 1000000u);
+
+	jlib::detail::HistogramCounters counters;
+	counters.add(std::chrono::microseconds(5));
+	counters.add(std::chrono::microseconds(7));
+	Histogram merged = h;
+	counters.mergeInto(merged);
+	BOOST_CHECK_EQUAL(counters.count(), 2u);
+	BOOST_CHECK_EQUAL(merged.count(), 1002u);
+	BOOST_CHECK_EQUAL(merged.sum(), h.sum() + 12000);
+}
+
+BOOST_AUTO_TEST_CASE(testStats)
+{
+	const ThreadPool::Mode modes[] = { ThreadPool::SHARED_QUEUE, ThreadPool::WORK_STEALING, ThreadPool::LOCK_FREE_QUEUE };
+	for (auto mode : modes) {
+		ThreadPool pool("stats");
+		pool.setMode(mode);
+		pool.setMetricsEnabled(true);
+		pool.start(2);
+		CountDownLatch done(50);
+		for (int i = 0; i < 50; i++) {
+			pool.run([&done]() {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				done.countDown();
+			});
+		}
+		done.wait();
+		pool.stop(); // the last task may still be timing itself after countDown()
+
+		auto stats = pool.stats();
+		BOOST_CHECK_EQUAL(stats.execution.count(), 50u);
+		BOOST_CHECK_EQUAL(stats.queueWait.count(), 50u);
+		BOOST_CHECK_GE(stats.execution.percentile(50), 500000u); // ns, the bucket holding 1ms
+		BOOST_CHECK_GE(stats.peakQueueSize, 1u);
+		BOOST_CHECK(stats.toString().find("ThreadPool stats") == 0);
+	}
+
+	ThreadPool pool("stats");
+	pool.setMetricsEnabled(true);
+	pool.start(2);
+	CountDownLatch done(40);
+	for (int i = 0; i < 40; i++) {
+		pool.run([&done]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			done.countDown();
+		});
+	}
+	done.wait();
+	auto threads = pool.threadStats();
+	BOOST_REQUIRE_EQUAL(threads.size(), 2u);
+	uint64_t tasks = 0;
+	for (auto& t : threads) {
+		tasks += t.tasks;
+		BOOST_CHECK(t.busyRatio() >= 0.0 && t.busyRatio() <= 1.0);
+		BOOST_CHECK(t.busyTime <= t.lifetime);
+	}
+	BOOST_CHECK_LE(tasks, 40u);
+	BOOST_CHECK_GE(tasks, 38u);
+	pool.stop();
+}
+
+BOOST_AUTO_TEST_CASE(testStatsBlockedPushes)
+{
+	ThreadPool pool;
+	pool.setMaxQueueSize(2);
+	pool.start(1);
+	CountDownLatch done(10);
+	for (int i = 0; i < 10; i++) {
+		pool.run([&done]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			done.countDown();
+		});
+	}
+	done.wait();
+	auto stats = pool.stats();
+	BOOST_CHECK_GT(stats.blockedPushes, 0u);
+	BOOST_CHECK_EQUAL(stats.execution.count(), 0u); // metrics are off
+	pool.stop();
+
+	// the periodic dump enables metrics
+	ThreadPool logged;
+	std::atomic<int> dumps(0);
+	logged.setStatsLog(std::chrono::milliseconds(5), [&dumps](const ThreadPool::Stats& s) {
+		BOOST_CHECK_EQUAL(s.threads.size(), 1u);
+		dumps++;
+	});
+	BOOST_CHECK(logged.metricsEnabled());
+	logged.start(1);
+	for (int i = 0; i < 100 && dumps < 2; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	logged.stop();
+	BOOST_CHECK_GE(dumps.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(testLatch)
+{
+	Latch open(0);
+	BOOST_CHECK(open.tryWait());
+	open.wait();
+
+	// fan-in from many tasks, the latch lives on the stack and is gone right after wait()
+	ThreadPool pool;
+	pool.start(4);
+	for (int round = 0; round < 100; round++) {
+		Latch latch(64);
+		BOOST_CHECK_EQUAL(latch.getCount(), 64);
+		for (int i = 0; i < 64; i++) {
+			pool.run([&latch]() { latch.countDown(); });
+		}
+		latch.wait();
+		BOOST_CHECK_LE(latch.getCount(), 0);
+	}
+	pool.stop();
+
+	Latch latch(1);
+	latch.countDown();
+	latch.countDown(); // below zero, still open
+	BOOST_CHECK_EQUAL(latch.getCount(), -1);
+	BOOST_CHECK(latch.tryWait());
+}
+
+BOOST_AUTO_TEST_CASE(testLatchParks)
+{
+	Latch latch(1);
+	std::atomic<bool> released(false);
+	std::atomic<int> early(0);
+	std::vector<std::thread> waiters;
+	for (int i = 0; i < 4; i++) {
+		waiters.emplace_back([&]() {
+			latch.wait();
+			if (!released) { early++; }
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20)); // long past spinning
+	released = true;
+	latch.countDown();
+	for (auto& t : waiters) { t.join(); }
+	BOOST_CHECK_EQUAL(early.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(testSemaphore)
+{
+	Semaphore sem(2);
+	BOOST_CHECK(sem.tryAcquire());
+	BOOST_CHECK(sem.tryAcquire());
+	BOOST_CHECK(!sem.tryAcquire());
+	sem.release(2);
+	BOOST_CHECK_EQUAL(sem.available(), 2);
+
+	// at most 3 threads inside at once
+	Semaphore slots(3);
+	std::atomic<int> inside(0), maxInside(0), done(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; t++) {
+		threads.emplace_back([&]() {
+			for (int i = 0; i < 200; i++) {
+				slots.acquire();
+				int n = ++inside;
+				int m = maxInside.load();
+				while (n > m && !maxInside.compare_exchange_weak(m, n)) {}
+				if (i % 50 == 0) { std::this_thread::sleep_for(std::chrono::microseconds(200)); }
+				inside--;
+				slots.release();
+			}
+			done++;
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	BOOST_CHECK_EQUAL(done.load(), 8);
+	BOOST_CHECK_LE(maxInside.load(), 3);
+	BOOST_CHECK_EQUAL(slots.available(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(testBarrier)
+{
+	const int kThreads = 4, kPhases = 500;
+	Barrier barrier(kThreads);
+	std::atomic<int> phaseCount[kPhases];
+	for (auto& c : phaseCount) { c = 0; }
+	std::atomic<int> completers(0);
+	std::atomic<bool> ordered(true);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kThreads; t++) {
+		threads.emplace_back([&, t]() {
+			for (int p = 0; p < kPhases; p++) {
+				phaseCount[p]++;
+				if (t == 0 && p % 100 == 0) { std::this_thread::sleep_for(std::chrono::milliseconds(2)); } // others park
+				if (barrier.arriveAndWait()) { completers++; }
+				// everyone arrived at phase p before anyone leaves it
+				if (phaseCount[p].load() != kThreads) { ordered = false; }
+			}
+		});
+	}
+	for (auto& t : threads) { t.join(); }
+	BOOST_CHECK(ordered.load());
+	BOOST_CHECK_EQUAL(completers.load(), kPhases);
+}